@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+struct audio_device_status {
+  _Bool open;
+  char name[256];
+  int frequency;
+  int refresh;
+  int requested_frequency;
+  int requested_refresh;
+};
+
+void audio_device_open_async(void);
+int audio_device_wait(void);
+_Bool audio_device_ready(void);
+void audio_device_close(void);
+
+int audio_device_move(const char *name);
+int audio_device_reopen(const char *name);
+void audio_device_set_frequency(int);
+void audio_device_set_refresh(int);
+void audio_device_read_status(struct audio_device_status *);
+const char *audio_device_list(void);
+
+int audio_device_open_loopback(int rate);
+void audio_device_render(float *out, int frames);
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+
+// Brings in struct track_meta, so files including this header shouldn't include track_meta.h again
+#include <track_meta.h>
+
+
+// How decoded audio is converted to the output rate. RESAMPLE_OFF hands the file's own rate to OpenAL
+#define RESAMPLE_OFF 0
+#define RESAMPLE_LINEAR 1
+#define RESAMPLE_STANDARD 2
+#define RESAMPLE_HIGH 3
+#define RESAMPLE_SOXR 4
+#define MAX_RESAMPLE 4
+
+struct track_data {
+  uint16_t duration;
+  uint16_t channels;
+  unsigned int samplerate;
+  unsigned int output_rate;
+};
+
+// Each source owns its packet and frame, so any number of them can be decoded on different threads
+typedef struct {
+  AVFormatContext *format_context;
+  AVCodecParameters *codec_param;
+  const AVCodec *codec;
+  AVCodecContext *codec_context;
+  SwrContext *swr_context;
+  AVPacket *packet;
+  AVFrame *frame;
+  struct io_handle *io;
+  struct demuxer *demux;
+  char *filename;
+  struct track_data track_data;
+  struct track_meta meta;
+  int resample_quality;
+} AUDIO_SOURCE;
+
+AUDIO_SOURCE *new_audio_source(const char *filename);
+int prep_audio_source(AUDIO_SOURCE *);
+int prep_audio_source_rate(AUDIO_SOURCE *, int dst_rate);
+int prep_audio_source_quality(AUDIO_SOURCE *, int dst_rate, int quality);
+uint8_t *decode_chunk(AUDIO_SOURCE *, int *buf_size);
+uint8_t *flush_chunk(AUDIO_SOURCE *, int *buf_size);
+uint8_t *decode_frames(AUDIO_SOURCE *, int min_frames, int *buf_size);
+void free_audio_source(AUDIO_SOURCE *);
+
+void resample_set_quality(int);
+int resample_get_quality(void);
+int resample_quality_from_name(const char *);
+const char *resample_quality_name(int);
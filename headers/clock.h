@@ -18,5 +18,10 @@ If not, see <https://www.gnu.org/licenses/>.
 
 
 
+struct pollfd;
+
+// Descriptors sleep_until_next_tick() can watch besides the terminal
+#define CLOCK_MAX_WATCHED 32
+
 void init_clock(void);
-void sleep_until_next_tick(void);
+void sleep_until_next_tick(_Bool busy, struct pollfd *extra, unsigned int extra_count);
@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define CMDLINE_MAX 512
+#define CMDLINE_HISTORY 100
+
+// What cmdline_key() did with a key
+#define CMDLINE_KEEP 0
+#define CMDLINE_SUBMIT 1
+#define CMDLINE_CLOSED 2
+
+void cmdline_begin(const char *initial);
+int cmdline_key(int ch);
+const char *cmdline_text(void);
+unsigned int cmdline_cursor_column(void);
+void cmdline_cleanup(void);
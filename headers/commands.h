@@ -0,0 +1,47 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// What a command takes after its name
+#define ARG_NONE 0
+#define ARG_TEXT 1
+#define ARG_PATH 2
+#define ARG_NUMBER 3
+
+// The argument as the handler gets it. text is "" when none was given, number is only set for ARG_NUMBER
+struct command_args {
+  char *text;
+  long number;
+};
+
+struct command {
+  const char *name;
+  int arg_type;
+  _Bool arg_required;
+  // Words offered by tab completion for the argument, space separated
+  const char *choices;
+  const char *usage;
+  const char *help;
+  void (*run)(struct command_args *);
+};
+
+void parse_cmd(char *command);
+
+const struct command *command_find(const char *name, unsigned int length);
+const struct command *command_at(unsigned int index);
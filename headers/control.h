@@ -0,0 +1,34 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// Clients beyond this many are turned away
+#define CONTROL_MAX_CLIENTS 16
+
+// Longest command line accepted, and how much unsent output a client may pile up before it is dropped
+#define CONTROL_LINE_MAX 1024
+#define CONTROL_OUTPUT_MAX (64 * 1024)
+
+struct pollfd;
+
+int control_init(void);
+void control_poll(void);
+unsigned int control_pollfds(struct pollfd *, unsigned int max);
+void control_cleanup(void);
+const char *control_socket_path(void);
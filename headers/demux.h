@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stdint.h>
+
+// How far ahead each demuxer reads. Whichever limit is hit first stops it, so a
+// high bitrate file still gets a few seconds and a typical mp3 or Opus gets minutes
+#define DEMUX_MAX_PACKETS 2048
+#define DEMUX_MAX_BYTES (4 * 1024 * 1024)
+
+struct AVFormatContext;
+struct AVPacket;
+typedef struct demuxer DEMUXER;
+
+struct demux_stats {
+  uint64_t queued_bytes;
+  uint64_t queued_packets;
+  uint64_t waits;
+  uint64_t wait_ns;
+};
+
+DEMUXER *demux_start(struct AVFormatContext *, int stream);
+int demux_read(DEMUXER *, struct AVPacket *);
+void demux_stop(DEMUXER *);
+void demux_read_stats(struct demux_stats *);
@@ -22,3 +22,5 @@ If not, see <https://www.gnu.org/licenses/>.
 #define JACK_ERR_LIBAV_MSG 2
 #define JACK_ERR_OPENDIR 3
 #define JACK_ERR_PLAYBACK_SOURCE_PREP 4
+#define JACK_ERR_AUDIO_DEVICE 5
+#define JACK_ERR_CONTROL_SOCKET 6
@@ -0,0 +1,29 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+
+#define WAV_HEADER_SIZE 44
+
+#define SAMPLE_F32 0
+#define SAMPLE_S16 1
+
+void export_cmd(char *args);
+void write_wav_header(int fd, int sample_format, uint32_t rate, int channels, uint64_t data_bytes);
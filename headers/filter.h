@@ -0,0 +1,29 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// Longest query filter_update() keeps intermediate results for
+#define FILTER_MAX_QUERY 64
+
+void filter_set_candidates(const char **names, unsigned int count);
+void filter_clear(void);
+
+unsigned int filter_update(const char *query);
+unsigned int filter_result(unsigned int);
+int filter_positions(unsigned int candidate, const char *query, int *positions);
@@ -0,0 +1,30 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stddef.h>
+
+// Interned strings live until intern_cleanup(). Equal strings always come back as the same pointer,
+// so they can be compared with == and are only ever stored once
+const char *intern(const char *);
+const char *intern_n(const char *, size_t length);
+const char *intern_find(const char *);
+
+void intern_stats(size_t *strings, size_t *bytes);
+void intern_cleanup(void);
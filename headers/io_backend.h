@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+
+#define IO_BACKEND_LIBAV 0
+#define IO_BACKEND_MMAP 1
+#define IO_BACKEND_URING 2
+#define MAX_IO_BACKEND 2
+
+struct AVIOContext;
+typedef struct io_handle IO_HANDLE;
+
+struct io_stats {
+  uint64_t bytes;
+  uint64_t reads;
+  uint64_t wait_ns;
+};
+
+IO_HANDLE *io_open(const char *filename, int backend);
+struct AVIOContext *io_avio_context(IO_HANDLE *);
+void io_close(IO_HANDLE *);
+
+int io_set_backend(int);
+int io_get_backend(void);
+int io_backend_from_name(const char *);
+const char *io_backend_name(int);
+void io_read_stats(int backend, struct io_stats *);
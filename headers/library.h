@@ -0,0 +1,38 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stddef.h>
+
+// Levels of the tag browser. An id at one level is the parent passed for the next
+#define LIBRARY_ARTISTS 0
+#define LIBRARY_ALBUMS 1
+#define LIBRARY_TRACKS 2
+
+unsigned int library_build(void);
+void library_cleanup(void);
+
+unsigned int library_count(int level, unsigned int parent);
+unsigned int library_child(int level, unsigned int parent, unsigned int row);
+void library_label(int level, unsigned int id, char *buffer, size_t size);
+const char *library_track_path(unsigned int id);
+unsigned int library_queue(int level, unsigned int id);
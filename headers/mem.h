@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What tracked memory is counted against. See mem.c
+#define MEM_LISTING 0
+#define MEM_MESSAGES 1
+#define MEM_DECODE 2
+#define MEM_READAHEAD 3
+#define MEM_CACHE 4
+#define MEM_META 5
+#define MAX_MEM_POOL 5
+
+struct mem_pool_stats {
+  uint64_t current;
+  uint64_t peak;
+  uint64_t count;
+};
+
+void *mem_alloc(int pool, size_t);
+void *mem_calloc(int pool, size_t count, size_t size);
+void *mem_realloc(void *, size_t);
+char *mem_strdup(int pool, const char *);
+void mem_free(void *);
+void mem_account(int pool, long bytes, int blocks);
+
+void mem_read_stats(int pool, struct mem_pool_stats *);
+const char *mem_pool_name(int);
+uint64_t mem_total(void);
+
+void mem_set_budget(unsigned int mb);
+unsigned int mem_get_budget(void);
+_Bool mem_over_budget(void);
+void mem_add_release_hook(void (*release)(void));
+void mem_release(void);
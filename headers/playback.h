@@ -18,6 +18,7 @@ If not, see <https://www.gnu.org/licenses/>.
 
 
 
+#include <limits.h>
 
 #define META_TRACK_TITLE 0
 #define META_ABLUM_TITLE 1
@@ -31,17 +32,58 @@ If not, see <https://www.gnu.org/licenses/>.
 
 #define MAX_VOLUME 180
 
+// OpenAL buffers kept queued, and the frames decoded into each. See playback_set_buffering()
+#define PLAYBACK_DEFAULT_BUFFERS 3
+#define PLAYBACK_MAX_BUFFERS 16
+#define PLAYBACK_DEFAULT_FRAMES 4096
+#define PLAYBACK_MIN_FRAMES 256
+#define PLAYBACK_MAX_FRAMES 65536
+
+// For playback_set_device_rate(): mix at whatever rate the track that was started has
+#define PLAYBACK_RATE_MATCH -1
+
+#define STATE_STR_SIZE 256
+// Sources are opened by absolute path, anything open() accepts has to fit or a reopen would get a truncated name
+#define STATE_PATH_SIZE PATH_MAX
+
+// Everything the UI shows about playback, published by the playback side whenever it changes.
+// Read it with playback_read_state(), never by reaching into playback.c
+struct playback_state {
+  unsigned int track_serial;
+  _Bool active;
+  _Bool playing;
+  int position;
+  unsigned int duration;
+  unsigned int year;
+  char meta[MAX_META_TYPE_STR + 1][STATE_STR_SIZE];
+  char path[STATE_PATH_SIZE];
+  char next_path[STATE_PATH_SIZE];
+};
+
 void playback_init(void);
 
-char *metadata_retrieve_str(int);
-int metadata_retrieve_int(int);
+void playback_read_state(struct playback_state *);
 
 int playback_read_clock(void);
 void playback_cleanup(void);
 
 void playback_update(void);
 void playback_start(const char *);
+void playback_start_at(const char *, unsigned int seconds, _Bool paused);
+int playback_seek(unsigned int seconds);
+void playback_resume_async(const char *, unsigned int seconds, _Bool paused);
+void playback_resume_update(void);
 void playback_queue(const char *);
+void playback_play_queue(void);
+unsigned int playback_track_serial(void);
+
+int playback_reopen_device(const char *name);
+int playback_set_device_rate(int);
+void playback_set_buffering(unsigned int count, unsigned int frames);
+void playback_get_buffering(unsigned int *count, unsigned int *frames);
+_Bool playback_matches_rate(void);
+void playback_set_driven(_Bool);
+_Bool playback_draining(void);
 
 int set_master_volume(unsigned int);
 int check_playback_active(void);
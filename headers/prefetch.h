@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// Seconds before the end of the current track at which the next one is warmed completely
+#define PREFETCH_TAIL_SECONDS 20
+
+struct prefetch_status {
+  unsigned int budget_mb;
+  unsigned int head_mb;
+  unsigned long warmed_bytes;
+  unsigned int tracked_files;
+  _Bool under_pressure;
+};
+
+void prefetch_init(void);
+void prefetch_cleanup(void);
+
+void prefetch_track(const char *path);
+void prefetch_rest(const char *path);
+void prefetch_hint(const char *path);
+void prefetch_consumed(const char *path);
+
+void prefetch_set_budget(unsigned int mb);
+void prefetch_set_head(unsigned int mb);
+void prefetch_read_status(struct prefetch_status *);
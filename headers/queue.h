@@ -0,0 +1,30 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+void queue_push(const char *path);
+void queue_push_batch(char **entries, unsigned int count);
+void queue_insert(unsigned int position, const char *path);
+int queue_remove(unsigned int position);
+char *queue_pop(void);
+char *queue_copy_entry(unsigned int position);
+unsigned int queue_length(void);
+void queue_clear(void);
+
+int queue_push_dir(const char *dir);
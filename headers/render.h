@@ -0,0 +1,31 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// Mixing rate of --render unless another is given
+#define RENDER_DEFAULT_RATE 48000
+
+// Frames mixed per render_step()
+#define RENDER_BLOCK 1024
+
+int render_open(const char *output, int rate);
+_Bool render_active(void);
+void render_step(void);
+void render_drain(void);
+void render_close(void);
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stddef.h>
+
+#define SORT_NAME 0
+#define SORT_TRACK 1
+#define SORT_YEAR 2
+#define SORT_DURATION 3
+#define MAX_SORT_MODE 3
+
+struct dirent;
+
+unsigned char *collation_key(const char *name, size_t *length);
+void sort_dirents(const char *dir, struct dirent **list, int count, int mode);
+
+int sort_mode_from_name(const char *);
+const char *sort_mode_name(int);
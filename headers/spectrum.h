@@ -0,0 +1,33 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+
+// Lowest band of the analyser, the highest is 16 kHz or the Nyquist frequency if that is lower
+#define SPECTRUM_MIN_FREQ 40
+#define SPECTRUM_MAX_FREQ 16000
+
+void spectrum_init(void);
+void spectrum_cleanup(void);
+
+int spectrum_set_enabled(_Bool);
+void spectrum_tap(const float *pcm, int frames, int channels, unsigned int rate, uint64_t position);
+void spectrum_clock(uint64_t position, _Bool running);
+int spectrum_update(int band_count, float *levels);
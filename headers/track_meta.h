@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+
+// All strings are interned (see intern.h), so a record can be copied around freely and never needs freeing.
+// Missing tags are NULL or 0
+struct track_meta {
+  const char *title;
+  const char *album;
+  const char *album_artist;
+  const char *artist;
+  const char *genre;
+  const char *label;
+  const char *producer;
+  const char *composer;
+  uint16_t track;
+  uint16_t track_total;
+  uint16_t disc;
+  uint16_t disc_total;
+  uint16_t year;
+  uint32_t duration;
+};
+
+struct AVDictionary;
+
+void track_meta_read(const struct AVDictionary *, struct track_meta *);
+
+void meta_cache_store(const char *path, const struct track_meta *);
+int meta_cache_lookup(const char *path, struct track_meta *);
+unsigned int meta_cache_copy(const char **paths, struct track_meta *, unsigned int max);
+unsigned int meta_cache_count(void);
+void meta_cache_trim(void);
+void meta_cache_cleanup(void);
@@ -21,8 +21,17 @@ If not, see <https://www.gnu.org/licenses/>.
 #define ELEM_DIR 0
 #define ELEM_FILE 1
 
+// What ui_filter_key() did with a key
+#define FILTER_KEEP 0
+#define FILTER_SELECTED 1
+#define FILTER_CLOSED 2
+
 void init_ui(void);
+void ui_set_headless(void);
+_Bool ui_is_headless(void);
 void update_msgbox(void);
+void update_spectrum(void);
+void ui_toggle_spectrum(void);
 void display_msg(char *msg);
 //void display_msgbox(void);
 void display_file_window(void);
@@ -35,7 +44,24 @@ void display_metadata_bar(char *album, char *artist, unsigned int, char *feature
 void user_nav_up(void);
 void user_nav_down(void);
 void ui_open_dir(const char *dir_name);
+void ui_set_sort_mode(int);
+void ui_get_cursor(unsigned int *selected, unsigned int *offset, unsigned int *y);
+void ui_set_cursor(unsigned int selected, unsigned int offset, unsigned int y);
+void ui_filter_begin(void);
+_Bool ui_filter_active(void);
+int ui_filter_key(int);
+void ui_cmdline_begin(const char *initial);
+_Bool ui_cmdline_active(void);
+int ui_cmdline_key(int);
+int ui_get_sort_mode(void);
+
+void ui_library_open(void);
+void ui_library_close(void);
+_Bool ui_library_active(void);
+char *ui_library_enter(void);
+void ui_library_queue_selected(void);
 void reset_cursor(void);
+_Bool ui_render(void);
 
 int fs_list_check_valid(int);
 char *fs_list_find_name(int);
@@ -0,0 +1,29 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+// Queues every audio file under a directory tree, see walk.c
+long walk_tree(const char *dir, int sort_mode, volatile bool *stop, void (*found)(char *path, void *data), void *data);
+int walk_enqueue(const char *dir, int sort_mode);
+void walk_update(void);
+int walk_running(void);
+void walk_cleanup(void);
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdint.h>
+
+// Resolution of a stored overview. Each bin is a signed 8 bit min/max pair, so one track costs 2 KB
+#define WAVEFORM_BINS 1024
+
+// Levels handed out by waveform_render(), 0 being silence
+#define WAVEFORM_LEVELS 8
+
+void waveform_init(void);
+void waveform_cleanup(void);
+void waveform_trim(void);
+
+void waveform_request(const char *path);
+void waveform_set_current(const char *path);
+int waveform_render(int width, uint8_t *levels);
@@ -0,0 +1,374 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <AL/al.h>
+#include <AL/alc.h>
+#include <AL/alext.h>
+
+#include <audio_device.h>
+#include <startup.h>
+#include <error.h>
+
+
+#define DEVICE_CLOSED 0
+#define DEVICE_OPENING 1
+#define DEVICE_OPEN 2
+#define DEVICE_FAILED 3
+
+
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t device_cond = PTHREAD_COND_INITIALIZER;
+static int device_state = DEVICE_CLOSED;
+static pthread_t opener;
+static bool opener_started = false;
+
+static ALCdevice *device = NULL;
+static ALCcontext *context = NULL;
+
+// A loopback device mixes only when asked to, into memory. See audio_device_open_loopback()
+static bool loopback = false;
+static LPALCRENDERSAMPLESSOFT render_samples = NULL;
+
+// What the next open asks for. A NULL name is the system default, 0 leaves the rate or the
+// mixer update period up to OpenAL
+static char *device_name = NULL;
+static int requested_frequency = 0;
+static int requested_refresh = 0;
+
+
+
+// Zero terminated ALC attribute list for the current settings
+static void build_attributes(ALCint *attributes) {
+  int i = 0;
+
+  if(requested_frequency > 0) {
+    attributes[i++] = ALC_FREQUENCY;
+    attributes[i++] = requested_frequency;
+  }
+  if(requested_refresh > 0) {
+    attributes[i++] = ALC_REFRESH;
+    attributes[i++] = requested_refresh;
+  }
+  attributes[i] = 0;
+
+  return;
+}
+
+
+static int open_device_locked(void) {
+  ALCint attributes[8];
+  build_attributes(attributes);
+
+  if((device = alcOpenDevice(device_name)) == NULL) {return -1;}
+
+  if((context = alcCreateContext(device, attributes)) == NULL || alcMakeContextCurrent(context) != ALC_TRUE) {
+    if(context) {alcDestroyContext(context);}
+    alcCloseDevice(device);
+    context = NULL;
+    device = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void close_device_locked(void) {
+  alcMakeContextCurrent(NULL);
+  if(context) {alcDestroyContext(context);}
+  if(device) {alcCloseDevice(device);}
+  context = NULL;
+  device = NULL;
+  return;
+}
+
+
+static void open_device(void) {
+  int state = open_device_locked() == 0 ? DEVICE_OPEN : DEVICE_FAILED;
+  startup_mark("audio device open");
+
+  pthread_mutex_lock(&device_lock);
+  device_state = state;
+  pthread_cond_broadcast(&device_cond);
+  pthread_mutex_unlock(&device_lock);
+
+  return;
+}
+
+
+static void *opener_thread(void *arg) {
+  (void)arg;
+  open_device();
+  return NULL;
+}
+
+
+
+// Opening the device can take hundreds of milliseconds, so it's started next to drawing the UI
+// rather than before it. Anything that touches OpenAL calls audio_device_wait() first
+void audio_device_open_async(void) {
+  pthread_mutex_lock(&device_lock);
+  if(device_state != DEVICE_CLOSED) {
+    pthread_mutex_unlock(&device_lock);
+    return;
+  }
+  device_state = DEVICE_OPENING;
+  pthread_mutex_unlock(&device_lock);
+
+  if(pthread_create(&opener, NULL, opener_thread, NULL) == 0) {opener_started = true;}
+  else {open_device();}
+
+  return;
+}
+
+
+// Returns 0 once the device is open, opening it right here if nobody asked for it yet
+int audio_device_wait(void) {
+  pthread_mutex_lock(&device_lock);
+  if(device_state == DEVICE_CLOSED) {
+    device_state = DEVICE_OPENING;
+    pthread_mutex_unlock(&device_lock);
+    open_device();
+    pthread_mutex_lock(&device_lock);
+  }
+
+  while(device_state == DEVICE_OPENING) {
+    pthread_cond_wait(&device_cond, &device_lock);
+  }
+
+  int ret = device_state == DEVICE_OPEN ? 0 : -1;
+  pthread_mutex_unlock(&device_lock);
+
+  // Reported here rather than by the opener, which may finish before there is a message box
+  if(ret != 0) {trackjack_error(JACK_ERR_AUDIO_DEVICE, (LIB_ERROR)0);}
+  return ret;
+}
+
+
+bool audio_device_ready(void) {
+  pthread_mutex_lock(&device_lock);
+  bool ret = device_state == DEVICE_OPEN;
+  pthread_mutex_unlock(&device_lock);
+  return ret;
+}
+
+
+void audio_device_close(void) {
+  if(opener_started) {
+    pthread_join(opener, NULL);
+    opener_started = false;
+  }
+
+  pthread_mutex_lock(&device_lock);
+  if(device_state == DEVICE_OPEN) {close_device_locked();}
+  device_state = DEVICE_CLOSED;
+  loopback = false;
+  pthread_mutex_unlock(&device_lock);
+
+  free(device_name);
+  device_name = NULL;
+
+  return;
+}
+
+
+
+static void set_name_locked(const char *name) {
+  if(name == NULL) {return;}
+  free(device_name);
+  device_name = *name ? strdup(name) : NULL;
+  return;
+}
+
+
+// Moves the open device over to the named one ("" for the system default, NULL to stay on the
+// same one) with the current settings, keeping the context and everything in it, so playback
+// carries on. Needs OpenAL Soft's ALC_SOFT_reopen_device. Returns -1 and changes nothing otherwise
+int audio_device_move(const char *name) {
+  LPALCREOPENDEVICESOFT reopen_device = NULL;
+  ALCint attributes[8];
+  int ret = -1;
+
+  if(!audio_device_ready() || loopback) {return -1;}
+
+  pthread_mutex_lock(&device_lock);
+  if(alcIsExtensionPresent(device, "ALC_SOFT_reopen_device")) {
+    reopen_device = (LPALCREOPENDEVICESOFT)alcGetProcAddress(device, "alcReopenDeviceSOFT");
+  }
+
+  if(reopen_device) {
+    build_attributes(attributes);
+    if(reopen_device(device, name ? (*name ? name : NULL) : device_name, attributes) == ALC_TRUE) {
+      set_name_locked(name);
+      ret = 0;
+    }
+  }
+  pthread_mutex_unlock(&device_lock);
+
+  return ret;
+}
+
+
+// Closes the device and opens the named one, as for audio_device_move(). The context goes with
+// the old device, so every source and buffer has to have been deleted first.
+// Also works after the first open failed, which is when switching devices is needed most.
+// Falls back to the system default if the named device won't open
+int audio_device_reopen(const char *name) {
+  int ret;
+
+  pthread_mutex_lock(&device_lock);
+  while(device_state == DEVICE_OPENING) {
+    pthread_cond_wait(&device_cond, &device_lock);
+  }
+
+  if(loopback) {
+    pthread_mutex_unlock(&device_lock);
+    return -1;
+  }
+
+  close_device_locked();
+  set_name_locked(name);
+
+  if((ret = open_device_locked()) != 0 && device_name) {
+    set_name_locked("");
+    ret = open_device_locked();
+  }
+  device_state = ret == 0 ? DEVICE_OPEN : DEVICE_FAILED;
+  pthread_cond_broadcast(&device_cond);
+  pthread_mutex_unlock(&device_lock);
+
+  return ret;
+}
+
+
+void audio_device_set_frequency(int frequency) {
+  pthread_mutex_lock(&device_lock);
+  requested_frequency = frequency;
+  pthread_mutex_unlock(&device_lock);
+  return;
+}
+
+void audio_device_set_refresh(int refresh) {
+  pthread_mutex_lock(&device_lock);
+  requested_refresh = refresh;
+  pthread_mutex_unlock(&device_lock);
+  return;
+}
+
+
+
+// Mixing rate and update period the device actually runs at, which may differ from what was asked
+void audio_device_read_status(struct audio_device_status *out) {
+  ALCint value = 0;
+
+  pthread_mutex_lock(&device_lock);
+  out->open = device_state == DEVICE_OPEN;
+  out->frequency = 0;
+  out->refresh = 0;
+  out->requested_frequency = requested_frequency;
+  out->requested_refresh = requested_refresh;
+  out->name[0] = 0;
+
+  if(out->open) {
+    alcGetIntegerv(device, ALC_FREQUENCY, 1, &value);
+    out->frequency = value;
+    value = 0;
+    alcGetIntegerv(device, ALC_REFRESH, 1, &value);
+    out->refresh = value;
+
+    const ALCchar *name = NULL;
+    if(alcIsExtensionPresent(device, "ALC_ENUMERATE_ALL_EXT")) {name = alcGetString(device, ALC_ALL_DEVICES_SPECIFIER);}
+    if(name == NULL) {name = alcGetString(device, ALC_DEVICE_SPECIFIER);}
+    if(name) {
+      strncpy(out->name, name, sizeof(out->name) - 1);
+      out->name[sizeof(out->name) - 1] = 0;
+    }
+  }
+  pthread_mutex_unlock(&device_lock);
+
+  return;
+}
+
+
+// Names of the playback devices OpenAL knows of, back to back and each NUL terminated, with an
+// empty name at the end. Owned by OpenAL
+const char *audio_device_list(void) {
+  const ALCchar *list = NULL;
+
+  if(alcIsExtensionPresent(NULL, "ALC_ENUMERATE_ALL_EXT")) {list = alcGetString(NULL, ALC_ALL_DEVICES_SPECIFIER);}
+  if(list == NULL) {list = alcGetString(NULL, ALC_DEVICE_SPECIFIER);}
+
+  return list ? list : "";
+}
+
+
+
+// Instead of a sound card, a device that mixes into memory whenever audio_device_render() asks,
+// as fast as the CPU goes. Everything else about playback stays the same. Needs ALC_SOFT_loopback,
+// and has to be called before anything else opens a device. Returns 0 on success
+int audio_device_open_loopback(int rate) {
+  LPALCLOOPBACKOPENDEVICESOFT open_loopback;
+  LPALCISRENDERFORMATSUPPORTEDSOFT format_supported;
+  ALCint attributes[] = {
+    ALC_FREQUENCY, rate,
+    ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+    ALC_FORMAT_TYPE_SOFT, ALC_FLOAT_SOFT,
+    0
+  };
+  int ret = -1;
+
+  if(!alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")) {return -1;}
+  open_loopback = (LPALCLOOPBACKOPENDEVICESOFT)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+  format_supported = (LPALCISRENDERFORMATSUPPORTEDSOFT)alcGetProcAddress(NULL, "alcIsRenderFormatSupportedSOFT");
+  render_samples = (LPALCRENDERSAMPLESSOFT)alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+  if(open_loopback == NULL || format_supported == NULL || render_samples == NULL) {return -1;}
+
+  pthread_mutex_lock(&device_lock);
+  if(device_state != DEVICE_CLOSED) {
+    pthread_mutex_unlock(&device_lock);
+    return -1;
+  }
+
+  if((device = open_loopback(NULL))) {
+    if(format_supported(device, rate, ALC_STEREO_SOFT, ALC_FLOAT_SOFT) && (context = alcCreateContext(device, attributes)) && alcMakeContextCurrent(context) == ALC_TRUE) {
+      ret = 0;
+    }
+    else {close_device_locked();}
+  }
+
+  if(ret == 0) {
+    loopback = true;
+    device_state = DEVICE_OPEN;
+  }
+  pthread_mutex_unlock(&device_lock);
+
+  return ret;
+}
+
+
+// Mixes the next frames of output into out, interleaved stereo float
+void audio_device_render(float *out, int frames) {
+  if(loopback) {render_samples(device, out, frames);}
+  return;
+}
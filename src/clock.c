@@ -18,28 +18,60 @@ If not, see <https://www.gnu.org/licenses/>.
 
 
 
+#include <stdbool.h>
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
 
-#define FRAMETIME_MS 33
+#include <clock.h>
+
+
+// Frames come quickly while something is changing on screen. Once nothing does, each idle frame
+// waits twice as long as the last, up to FRAMETIME_IDLE_MS. Input ends the wait immediately
+// either way, so only redraws nobody asked for are slowed down
+#define FRAMETIME_MS 16
+#define FRAMETIME_IDLE_MS 250
+
+static struct timespec last_frame;
+static int frametime = FRAMETIME_MS;
+
+
+
+static int ms_since(struct timespec *then) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
 
-static int last_frame_clockstate;
 
 void init_clock(void) {
-  last_frame_clockstate = clock() * 1000 / CLOCKS_PER_SEC;
+  clock_gettime(CLOCK_MONOTONIC, &last_frame);
   return;
 }
 
-void sleep_until_next_tick(void) {
-  int current_state = clock() * 1000 / CLOCKS_PER_SEC;
-  if(current_state - last_frame_clockstate >= FRAMETIME_MS) {
-    last_frame_clockstate = current_state;
-    return;
+
+// busy says whether the frame just finished drew or handled anything. Besides the terminal,
+// the wait also ends when one of the extra descriptors becomes readable
+void sleep_until_next_tick(bool busy, struct pollfd *extra, unsigned int extra_count) {
+  struct pollfd fds[CLOCK_MAX_WATCHED + 1];
+  unsigned int i;
+
+  if(busy) {frametime = FRAMETIME_MS;}
+  else if(frametime < FRAMETIME_IDLE_MS) {
+    frametime *= 2;
+    if(frametime > FRAMETIME_IDLE_MS) {frametime = FRAMETIME_IDLE_MS;}
   }
-  int difference = current_state - last_frame_clockstate;
 
-  usleep((FRAMETIME_MS - difference) * 1000);
-  last_frame_clockstate = current_state;
+  int remaining = frametime - ms_since(&last_frame);
+
+  if(remaining > 0) {
+    if(extra_count > CLOCK_MAX_WATCHED) {extra_count = CLOCK_MAX_WATCHED;}
+    fds[0] = (struct pollfd){.fd = STDIN_FILENO, .events = POLLIN};
+    for(i = 0; i < extra_count; i++) {fds[i + 1] = extra[i];}
+
+    poll(fds, extra_count + 1, remaining);
+  }
 
+  clock_gettime(CLOCK_MONOTONIC, &last_frame);
   return;
 }
@@ -0,0 +1,407 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <ncurses.h>
+
+#include <cmdline.h>
+#include <commands.h>
+#include <ui.h>
+
+
+// The ':' command line. Only the text and cursor live here, ui.c draws them. Keys come in one at
+// a time from the main loop, so nothing stops while a command is typed
+//
+// The text is UTF-8, the cursor a byte offset that is always kept on the start of a character
+
+
+#define IS_CONTINUATION(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+// Completion candidates listed at once when Tab can't narrow them down any further
+#define COMPLETION_LIST_MAX 30
+
+
+static char line[CMDLINE_MAX + 1];
+static unsigned int line_length = 0;
+static unsigned int cursor = 0;
+
+// history[0] is the oldest entry. While browsing, history_pos is the entry shown and draft
+// keeps what was being typed before Up was pressed
+static char *history[CMDLINE_HISTORY];
+static unsigned int history_count = 0;
+static unsigned int history_pos = 0;
+static char draft[CMDLINE_MAX + 1];
+
+
+
+void cmdline_begin(const char *initial) {
+  snprintf(line, sizeof(line), "%s", initial ? initial : "");
+  line_length = strlen(line);
+  cursor = line_length;
+  history_pos = history_count;
+  return;
+}
+
+
+const char *cmdline_text(void) {
+  return line;
+}
+
+
+// Terminal columns before the cursor, counting every character as one wide
+unsigned int cmdline_cursor_column(void) {
+  unsigned int column = 0;
+  size_t i;
+
+  for(i = 0; i < cursor; i++) {
+    if(!IS_CONTINUATION(line[i])) {column++;}
+  }
+
+  return column;
+}
+
+
+
+static void set_line(const char *text) {
+  snprintf(line, sizeof(line), "%s", text);
+  line_length = strlen(line);
+  cursor = line_length;
+  return;
+}
+
+
+static void insert(const char *text, unsigned int length) {
+  if(line_length + length > CMDLINE_MAX) {length = CMDLINE_MAX - line_length;}
+
+  memmove(line + cursor + length, line + cursor, line_length - cursor + 1);
+  memcpy(line + cursor, text, length);
+  line_length += length;
+  cursor += length;
+
+  return;
+}
+
+
+// Removes the bytes from start up to the cursor
+static void delete_back_to(unsigned int start) {
+  memmove(line + start, line + cursor, line_length - cursor + 1);
+  line_length -= cursor - start;
+  cursor = start;
+  return;
+}
+
+
+static unsigned int previous_char(unsigned int pos) {
+  if(pos == 0) {return 0;}
+  do {pos--;} while(pos > 0 && IS_CONTINUATION(line[pos]));
+  return pos;
+}
+
+
+static unsigned int next_char(unsigned int pos) {
+  if(pos >= line_length) {return line_length;}
+  do {pos++;} while(pos < line_length && IS_CONTINUATION(line[pos]));
+  return pos;
+}
+
+
+static unsigned int previous_word(unsigned int pos) {
+  while(pos > 0 && line[pos - 1] == ' ') {pos--;}
+  while(pos > 0 && line[pos - 1] != ' ') {pos--;}
+  return pos;
+}
+
+
+
+static void history_add(void) {
+  if(line_length == 0) {return;}
+  if(history_count > 0 && strcmp(history[history_count - 1], line) == 0) {return;}
+
+  if(history_count == CMDLINE_HISTORY) {
+    free(history[0]);
+    memmove(history, history + 1, (CMDLINE_HISTORY - 1) * sizeof(char *));
+    history_count--;
+  }
+  history[history_count++] = strdup(line);
+
+  return;
+}
+
+
+static void history_move(int direction) {
+  if(direction < 0 && history_pos == 0) {return;}
+  if(direction > 0 && history_pos >= history_count) {return;}
+
+  if(history_pos == history_count) {snprintf(draft, sizeof(draft), "%s", line);}
+  history_pos += direction;
+
+  set_line(history_pos == history_count ? draft : history[history_pos]);
+  return;
+}
+
+
+
+// Candidates for completing word, gathered for one Tab press
+struct completion {
+  char **words;
+  unsigned int count;
+  unsigned int capacity;
+};
+
+
+static void add_candidate(struct completion *c, const char *word, unsigned int length) {
+  if(c->count == c->capacity) {
+    c->capacity = c->capacity ? c->capacity * 2 : 16;
+    c->words = realloc(c->words, c->capacity * sizeof(char *));
+  }
+  c->words[c->count++] = strndup(word, length);
+  return;
+}
+
+
+static void complete_command(struct completion *c, const char *word, unsigned int length) {
+  const struct command *cmd;
+  int i;
+
+  for(i = 0; (cmd = command_at(i)); i++) {
+    if(strncmp(cmd->name, word, length) == 0) {add_candidate(c, cmd->name, strlen(cmd->name));}
+  }
+
+  return;
+}
+
+
+static void complete_choice(struct completion *c, const char *choices, const char *word, unsigned int length) {
+  const char *choice = choices;
+  unsigned int choice_length;
+
+  while(*choice) {
+    choice_length = strcspn(choice, " ");
+    if(choice_length >= length && strncmp(choice, word, length) == 0) {add_candidate(c, choice, choice_length);}
+    choice += choice_length;
+    while(*choice == ' ') {choice++;}
+  }
+
+  return;
+}
+
+
+// Candidates are whole paths as typed, directories with a trailing '/'
+static void complete_path(struct completion *c, const char *word, unsigned int length) {
+  char *path = strndup(word, length);
+  char *slash = strrchr(path, '/');
+  const char *base = slash ? slash + 1 : path;
+  unsigned int dir_length = slash ? slash + 1 - path : 0;
+  char *dir_name = slash ? strndup(path, dir_length) : strdup(".");
+  size_t base_length = strlen(base);
+  struct dirent *entry;
+  DIR *dir;
+
+  if((dir = opendir(dir_name))) {
+    while((entry = readdir(dir))) {
+      if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {continue;}
+      if(strncmp(entry->d_name, base, base_length) != 0) {continue;}
+      // Hidden files only when asked for
+      if(entry->d_name[0] == '.' && base_length == 0) {continue;}
+
+      size_t name_length = strlen(entry->d_name);
+      char *candidate = malloc(dir_length + name_length + 2);
+      memcpy(candidate, path, dir_length);
+      memcpy(candidate + dir_length, entry->d_name, name_length + 1);
+      if(entry->d_type == DT_DIR) {strcat(candidate, "/");}
+
+      add_candidate(c, candidate, strlen(candidate));
+      free(candidate);
+    }
+    closedir(dir);
+  }
+
+  free(dir_name);
+  free(path);
+  return;
+}
+
+
+static int compare_words(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+
+// Extends the word before the cursor as far as all candidates agree. A single candidate is
+// completed outright, several that can't be narrowed down are listed in the message box
+static void complete(void) {
+  struct completion c = {0};
+  unsigned int command_length = strcspn(line, " ");
+  const struct command *cmd;
+  unsigned int start, length, common, i;
+  char buffer[256];
+
+  // Paths may contain spaces, so the argument of a path command is completed as a whole
+  cmd = command_length < cursor ? command_find(line, command_length) : NULL;
+  if(cmd && cmd->arg_type == ARG_PATH) {
+    start = command_length + 1;
+    complete_path(&c, line + start, cursor - start);
+  }
+  else {
+    start = previous_word(cursor);
+    if(start == 0) {complete_command(&c, line, cursor);}
+    else if(cmd && cmd->choices && start == command_length + 1) {complete_choice(&c, cmd->choices, line + start, cursor - start);}
+  }
+  length = cursor - start;
+
+  if(c.count == 0) {
+    free(c.words);
+    return;
+  }
+
+  qsort(c.words, c.count, sizeof(char *), compare_words);
+
+  common = strlen(c.words[0]);
+  for(i = 1; i < c.count; i++) {
+    unsigned int j = 0;
+    while(j < common && c.words[i][j] == c.words[0][j]) {j++;}
+    common = j;
+  }
+
+  if(common > length) {insert(c.words[0] + length, common - length);}
+  if(c.count == 1 && c.words[0][common - 1] != '/') {insert(" ", 1);}
+
+  if(c.count > 1 && common == length) {
+    for(i = 0; i < c.count && i < COMPLETION_LIST_MAX; i++) {
+      snprintf(buffer, sizeof(buffer), "  %s", c.words[i]);
+      display_msg(buffer);
+    }
+    if(c.count > COMPLETION_LIST_MAX) {
+      snprintf(buffer, sizeof(buffer), "  ... %u more", c.count - COMPLETION_LIST_MAX);
+      display_msg(buffer);
+    }
+  }
+
+  for(i = 0; i < c.count; i++) {free(c.words[i]);}
+  free(c.words);
+
+  return;
+}
+
+
+
+int cmdline_key(int ch) {
+  char byte;
+
+  switch(ch) {
+    case 27:
+    case 7:
+      return CMDLINE_CLOSED;
+
+    case KEY_ENTER:
+    case 10:
+    case 13:
+      history_add();
+      history_pos = history_count;
+      return CMDLINE_SUBMIT;
+
+    case KEY_BACKSPACE:
+    case 127:
+    case 8:
+      // Backspace on an empty line closes it, like in vi
+      if(line_length == 0) {return CMDLINE_CLOSED;}
+      delete_back_to(previous_char(cursor));
+      break;
+
+    case KEY_DC:
+    case 4:
+      if(cursor < line_length) {
+        unsigned int start = cursor;
+        cursor = next_char(cursor);
+        delete_back_to(start);
+      }
+      break;
+
+    case KEY_LEFT:
+    case 2:
+      cursor = previous_char(cursor);
+      break;
+
+    case KEY_RIGHT:
+    case 6:
+      cursor = next_char(cursor);
+      break;
+
+    case KEY_HOME:
+    case 1:
+      cursor = 0;
+      break;
+
+    case KEY_END:
+    case 5:
+      cursor = line_length;
+      break;
+
+    case KEY_UP:
+    case 16:
+      history_move(-1);
+      break;
+
+    case KEY_DOWN:
+    case 14:
+      history_move(1);
+      break;
+
+    case 21:
+      // Ctrl-U
+      delete_back_to(0);
+      break;
+
+    case 23:
+      // Ctrl-W
+      delete_back_to(previous_word(cursor));
+      break;
+
+    case 11:
+      // Ctrl-K
+      line[cursor] = 0;
+      line_length = cursor;
+      break;
+
+    case 9:
+      complete();
+      break;
+
+    default:
+      // Bytes of UTF-8 sequences arrive one getch() at a time and are simply inserted in order
+      if(ch >= 32 && ch < 256) {
+        byte = ch;
+        insert(&byte, 1);
+      }
+      break;
+  }
+
+  return CMDLINE_KEEP;
+}
+
+
+void cmdline_cleanup(void) {
+  while(history_count > 0) {free(history[--history_count]);}
+  return;
+}
@@ -18,55 +18,597 @@ If not, see <https://www.gnu.org/licenses/>.
 
 
 
-
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <dirent.h>
-#include <ncurses.h>
+#include <pthread.h>
 
+#include <commands.h>
 #include <ui.h>
 #include <playback.h>
+#include <io_backend.h>
+#include <demux.h>
+#include <prefetch.h>
+#include <queue.h>
+#include <playlist.h>
+#include <walk.h>
+#include <scan.h>
+#include <export.h>
+#include <dupes.h>
+#include <jobs.h>
+#include <sort.h>
+#include <startup.h>
+#include <audio_device.h>
+#include <audio_source.h>
+#include <mem.h>
+#include <intern.h>
 
 
-void parse_cmd(char *command) {
-  char *buffer = malloc(160);
-  char *bufferB = malloc(160);
-  char *final_msg;
+// Slots in the name lookup table. A power of two comfortably above the number of commands
+#define COMMAND_SLOTS 64
+
+
+
+static void cmd_help(struct command_args *args) {
+  (void)args;
+  display_msg("Use return key to start audio playback, and the up and down arrows to navigate. The space bar can be used to pause and unpause the active track.");
+  display_msg("Press 'a' to add the highlighted file, or every track in the highlighted directory, to the play queue.");
+  display_msg("Press '/' to narrow the file window down to fuzzy matches as you type. Enter opens the highlighted match, Esc goes back.");
+  display_msg("Press 'v' to swap this message box for a spectrum analyser of what's playing, and again to get it back.");
+  display_msg("All other functionality is available via command line. Tab completes commands and paths, up and down go through earlier commands.");
+  display_msg("For a list of commands available, use the \'lscmd\' command.");
+  return;
+}
+
+
+static void cmd_list(struct command_args *args) {
+  const struct command *cmd;
+  char buffer[256];
   int i;
 
+  (void)args;
 
-  if(strcmp(command, "h") == 0) {
-    display_msg("Use return key to start audio playback, and the up and down arrows to navigate. The space bar can be used to pause and unpause the active track.");
-    display_msg("All other functionality is available via command line.");
-    display_msg("For a list of commands available, use the \'lscmd\' command.");
+  display_msg("Command list:");
+  for(i = 0; (cmd = command_at(i)); i++) {
+    if(cmd->help == NULL) {continue;}
+    snprintf(buffer, sizeof(buffer), "%s - %s", cmd->usage, cmd->help);
+    display_msg(buffer);
   }
+  display_msg("I removed most of the commands because they sucked. New ones will follow.");
+
+  return;
+}
+
 
-  else if(strcmp(command, "lscmd") == 0) {
-    display_msg("Command list:");
-    display_msg("vol - Set master volume (0-180)");
-    display_msg("I removed most of the commands because they sucked. New ones will follow.");
+
+static void cmd_vol(struct command_args *args) {
+  // Asked for on the command line rather than with a second, blocking prompt
+  if(*args->text == 0) {
+    if(ui_is_headless()) {display_msg("Usage: vol <0-180>");}
+    else {ui_cmdline_begin("vol ");}
+    return;
   }
 
+  if(args->number < 0 || set_master_volume(args->number) != 0) {display_msg("Selected value exceeds 180. Volume unchanged.");}
+  else {display_msg("Succesfully changed volume.");}
+
+  return;
+}
 
 
-  else if(strcmp(command, "vol") == 0) {
-    // SET VOLUME
+static void cmd_open(struct command_args *args) {
+  ui_open_dir(args->text);
+  return;
+}
+
 
-    display_command_bar("Enter volume percentage: ");
-    getstr(buffer);
-    unsigned int volume = atoi(buffer);
+static void cmd_play(struct command_args *args) {
+  if(*args->text) {playback_start(args->text);}
+  else {playback_play_queue();}
+  return;
+}
+
+
+static void cmd_seek(struct command_args *args) {
+  if(args->number < 0 || playback_seek(args->number) != 0) {display_msg("Nothing is playing.");}
+  return;
+}
 
-    if(set_master_volume(volume) == 0) {display_msg("Succesfully changed volume.");
-    } else {display_msg("Selected value exceeds 180. Volume unchanged.");}
 
+static void cmd_scan(struct command_args *args) {
+  job_run(scan_cmd, args->text);
+  return;
+}
+
+static void cmd_analyze(struct command_args *args) {
+  job_run(analyze_cmd, args->text);
+  return;
+}
+
+static void cmd_export(struct command_args *args) {
+  job_run(export_cmd, args->text);
+  return;
+}
+
+static void cmd_dupes(struct command_args *args) {
+  job_run(dupes_cmd, args->text);
+  return;
+}
+
+
+
+static void cmd_io(struct command_args *args) {
+  char buffer[160];
+  int i;
+
+  if(*args->text) {
+    int backend = io_backend_from_name(args->text);
+
+    if(backend < 0) {display_msg("Unknown I/O backend. Use libav, mmap or uring.");}
+    else {
+      io_set_backend(backend);
+      snprintf(buffer, 160, "I/O backend set to %s. Applies to the next file opened.", io_backend_name(backend));
+      display_msg(buffer);
+    }
+  }
+  else {
+    struct io_stats stats;
+
+    snprintf(buffer, 160, "I/O backend: %s", io_backend_name(io_get_backend()));
+    display_msg(buffer);
+
+    for(i = IO_BACKEND_MMAP; i <= MAX_IO_BACKEND; i++) {
+      io_read_stats(i, &stats);
+      snprintf(buffer, 160, "%s: %.1f MB in %lu reads, %.2f ms waiting", io_backend_name(i), stats.bytes / 1048576.0, (unsigned long)stats.reads, stats.wait_ns / 1000000.0);
+      display_msg(buffer);
+    }
+
+    // What the playback demuxers hold read ahead, and how often decoding still had to wait on them
+    struct demux_stats queued;
+    demux_read_stats(&queued);
+    snprintf(buffer, 160, "Read ahead: %.1f KB in %lu packets. Decoder waited %lu times, %.2f ms", queued.queued_bytes / 1024.0, (unsigned long)queued.queued_packets, (unsigned long)queued.waits, queued.wait_ns / 1000000.0);
+    display_msg(buffer);
   }
 
+  return;
+}
+
+
 
+static void cmd_queue(struct command_args *args) {
+  char *arg = args->text;
+  char buffer[160];
+  int i;
+
+  if(strncmp(arg, "add ", 4) == 0) {
+    playback_queue(arg + 4);
+    display_msg("Added to queue.");
+  }
+  else if((strncmp(arg, "dir", 3) == 0 && arg[3] == 0) || strncmp(arg, "dir ", 4) == 0) {
+    char *dir = arg[3] ? arg + 4 : ".";
+    int count = queue_push_dir(dir);
+
+    if(count < 0) {display_msg("Could not read directory.");}
+    else {
+      snprintf(buffer, 160, "Queued %d tracks.", count);
+      display_msg(buffer);
+      playback_play_queue();
+    }
+  }
+  else if((strncmp(arg, "tree", 4) == 0 && arg[4] == 0) || strncmp(arg, "tree ", 5) == 0) {
+    // An optional "track" at the end orders each directory by disc and track tags
+    char *dir = arg[4] ? arg + 5 : ".";
+    int mode = SORT_NAME;
+    char *last = strrchr(dir, ' ');
+
+    if(strcmp(dir, "track") == 0) {
+      dir = ".";
+      mode = SORT_TRACK;
+    }
+    else if(last && strcmp(last, " track") == 0) {
+      *last = 0;
+      mode = SORT_TRACK;
+    }
+
+    int ret = walk_enqueue(dir, mode);
+    if(ret == 1) {display_msg("Still queueing the last directory tree.");}
+    else if(ret < 0) {display_msg("Could not read directory.");}
+  }
+  else if(strncmp(arg, "ins ", 4) == 0) {
+    // Positions are shown to the user counting from 1
+    char *path;
+    unsigned int position = strtoul(arg + 4, &path, 10);
+
+    if(*path != ' ' || position == 0) {display_msg("Usage: queue ins <position> <file>");}
+    else {
+      queue_insert(position - 1, path + 1);
+      display_msg("Inserted into queue.");
+    }
+  }
+  else if(strncmp(arg, "rm ", 3) == 0) {
+    if(queue_remove(atoi(arg + 3) - 1) != 0) {display_msg("No such queue entry.");}
+    else {display_msg("Removed from queue.");}
+  }
+  else if(strcmp(arg, "clear") == 0) {
+    queue_clear();
+    display_msg("Queue cleared.");
+  }
+  else {
+    unsigned int length = queue_length();
+    char *entry;
+    char *entry_name;
+
+    snprintf(buffer, 160, "Queue: %u tracks", length);
+    display_msg(buffer);
+
+    for(i = 0; i < 10 && (entry = queue_copy_entry(i)); i++) {
+      entry_name = strrchr(entry, '/');
+      snprintf(buffer, 160, "%d. %s", i + 1, entry_name ? entry_name + 1 : entry);
+      display_msg(buffer);
+      free(entry);
+    }
+    if(length > 10) {display_msg("...");}
+  }
+
+  return;
+}
+
+
+
+static void cmd_load(struct command_args *args) {
+  int ret = playlist_load(args->text);
+  if(ret == 1) {display_msg("A playlist is already loading.");}
+  else if(ret < 0) {display_msg("TJ_ERR: Could not start loading the playlist.");}
+  return;
+}
+
+
+static void cmd_save(struct command_args *args) {
+  if(playlist_save(args->text) != 0) {display_msg("TJ_ERR: Failed to write playlist.");}
+  else {display_msg("Saved queue as playlist.");}
+  return;
+}
+
+
+
+static void cmd_prefetch(struct command_args *args) {
+  char *arg = args->text;
+  char buffer[160];
+
+  if(strncmp(arg, "budget ", 7) == 0) {
+    prefetch_set_budget(atoi(arg + 7));
+    display_msg("Prefetch memory budget changed.");
+  }
+  else if(strncmp(arg, "head ", 5) == 0) {
+    prefetch_set_head(atoi(arg + 5));
+    display_msg("Prefetch head size changed.");
+  }
+  else {
+    struct prefetch_status status;
+    prefetch_read_status(&status);
+
+    snprintf(buffer, 160, "Prefetch: %.1f of %u MB budget warmed across %u files, first %u MB of queued tracks%s", status.warmed_bytes / 1048576.0, status.budget_mb, status.tracked_files, status.head_mb, status.under_pressure ? ", paused by memory pressure" : "");
+    display_msg(buffer);
+  }
+
+  return;
+}
+
+
+
+static void cmd_mem(struct command_args *args) {
+  char *arg = args->text;
+  char buffer[160];
+  struct mem_pool_stats stats;
+  int i;
+
+  if(strncmp(arg, "budget ", 7) == 0) {
+    mem_set_budget(atoi(arg + 7));
+    display_msg("Memory budget changed. Past it, read-ahead and prefetching are held back and the caches are shrunk.");
+    return;
+  }
+  else if(*arg) {
+    display_msg("Usage: mem [budget <MB>]");
+    return;
+  }
+
+  display_msg("Pool       current      peak    blocks");
+  for(i = 0; i <= MAX_MEM_POOL; i++) {
+    mem_read_stats(i, &stats);
+    snprintf(buffer, 160, "%-9s %7.1f KB %7.1f KB %9lu", mem_pool_name(i), stats.current / 1024.0, stats.peak / 1024.0, (unsigned long)stats.count);
+    display_msg(buffer);
+  }
+
+  size_t strings, string_bytes;
+  intern_stats(&strings, &string_bytes);
+  snprintf(buffer, 160, "%u files with cached tags, %lu distinct strings", meta_cache_count(), (unsigned long)strings);
+  display_msg(buffer);
+
+  // Everything libav, OpenAL and ncurses hold on to is only in the resident size
+  long resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if(statm) {
+    if(fscanf(statm, "%*d %ld", &resident) != 1) {resident = 0;}
+    fclose(statm);
+  }
 
+  char budget[40] = "no budget";
+  if(mem_get_budget()) {snprintf(budget, sizeof(budget), "a %u MB budget", mem_get_budget());}
 
-  free(buffer);
-  free(bufferB);
+  snprintf(buffer, 160, "Tracked %.1f MB against %s%s, resident %.1f MB", mem_total() / 1048576.0, budget, mem_over_budget() ? " (over it)" : "", resident * (sysconf(_SC_PAGESIZE) / 1048576.0));
+  display_msg(buffer);
+
+  return;
+}
+
+
+
+static void show_device(void) {
+  struct audio_device_status status;
+  unsigned int count, frames;
+  char buffer[400];
+
+  audio_device_read_status(&status);
+  playback_get_buffering(&count, &frames);
+
+  if(!status.open) {display_msg("No audio device is open.");}
+  else {
+    snprintf(buffer, sizeof(buffer), "Device: %s", status.name);
+    display_msg(buffer);
+    snprintf(buffer, sizeof(buffer), "Mixing at %d Hz (%s), %d updates per second (%s)", status.frequency, playback_matches_rate() ? "following the track" : status.requested_frequency ? "requested" : "device default", status.refresh, status.requested_refresh ? "requested" : "device default");
+    display_msg(buffer);
+  }
+
+  snprintf(buffer, sizeof(buffer), "Buffering: %u buffers of %u frames", count, frames);
+  display_msg(buffer);
+
+  return;
+}
+
+
+static void cmd_device(struct command_args *args) {
+  char *arg = args->text;
+  const char *name;
+  char buffer[300];
+  int i;
+
+  if(strcmp(arg, "list") == 0) {
+    display_msg("Audio devices:");
+    for(i = 1, name = audio_device_list(); *name; i++, name += strlen(name) + 1) {
+      snprintf(buffer, sizeof(buffer), "%d. %s", i, name);
+      display_msg(buffer);
+    }
+  }
+  else if(strncmp(arg, "use ", 4) == 0) {
+    // By number from 'device list', or by name
+    char *end;
+    long number = strtol(arg + 4, &end, 10);
+    name = arg + 4;
+
+    if(*end == 0 && end != arg + 4) {
+      for(i = 1, name = audio_device_list(); *name && i < number; i++) {name += strlen(name) + 1;}
+      if(*name == 0 || number < 1) {
+        display_msg("No such device. 'device list' shows them.");
+        return;
+      }
+    }
+    if(strcmp(name, "default") == 0) {name = "";}
+
+    if(playback_reopen_device(name) != 0) {display_msg("Could not open that device.");}
+    show_device();
+  }
+  else if(strncmp(arg, "rate ", 5) == 0) {
+    int rate = strcmp(arg + 5, "auto") == 0 ? PLAYBACK_RATE_MATCH : atoi(arg + 5);
+
+    if(playback_set_device_rate(rate) != 0) {display_msg("Could not reopen the device.");}
+    show_device();
+  }
+  else if(strncmp(arg, "refresh ", 8) == 0) {
+    audio_device_set_refresh(atoi(arg + 8));
+    if(playback_reopen_device(NULL) != 0) {display_msg("Could not reopen the device.");}
+    show_device();
+  }
+  else if(strncmp(arg, "buffers ", 8) == 0) {
+    unsigned int count, frames;
+    char *end;
+
+    playback_get_buffering(&count, &frames);
+    count = strtoul(arg + 8, &end, 10);
+    if(*end == ' ') {frames = strtoul(end + 1, NULL, 10);}
+
+    playback_set_buffering(count, frames);
+    show_device();
+  }
+  else if(*arg == 0) {show_device();}
+  else {display_msg("Usage: device [list|use <n|name>|rate <hz|auto|default>|refresh <hz>|buffers <count> [frames]]");}
+
+  return;
+}
+
+
+
+static void cmd_resample(struct command_args *args) {
+  char buffer[160];
+  int quality;
+
+  if(strncmp(args->text, "bench ", 6) == 0) {
+    job_run(resample_bench_cmd, args->text + 6);
+  }
+  else if(*args->text == 0) {
+    snprintf(buffer, 160, "Resampling: %s%s", resample_quality_name(resample_get_quality()), resample_get_quality() == RESAMPLE_OFF ? ", OpenAL converts to the device rate" : "");
+    display_msg(buffer);
+  }
+  else if((quality = resample_quality_from_name(args->text)) < 0) {
+    display_msg("Usage: resample [off|linear|standard|high|soxr|bench <file> [rate]]");
+  }
+  else {
+    resample_set_quality(quality);
+    snprintf(buffer, 160, "Resampling set to %s. Applies from the next track.", resample_quality_name(quality));
+    display_msg(buffer);
+  }
+
+  return;
+}
+
+
+
+static void cmd_library(struct command_args *args) {
+  (void)args;
+  if(ui_library_active()) {ui_library_close();}
+  else {ui_library_open();}
+  return;
+}
+
+
+static void cmd_startup(struct command_args *args) {
+  (void)args;
+  startup_report();
+  return;
+}
+
+
+static void cmd_sort(struct command_args *args) {
+  char buffer[160];
+  int mode = sort_mode_from_name(args->text);
+
+  if(*args->text == 0) {
+    snprintf(buffer, 160, "Files are sorted by %s.", sort_mode_name(ui_get_sort_mode()));
+    display_msg(buffer);
+  }
+  else if(mode < 0) {display_msg("Usage: sort [name|track|year|duration]");}
+  else {
+    ui_set_sort_mode(mode);
+    snprintf(buffer, 160, "Sorting files by %s. Tracks whose tags haven't been read yet come last, 'scan' reads them.", sort_mode_name(mode));
+    display_msg(buffer);
+  }
+
+  return;
+}
+
+
+
+
+// In the order lscmd lists them. Entries without help text are left out of the list
+static const struct command commands[] = {
+  {"h", ARG_NONE, false, NULL, "h", NULL, cmd_help},
+  {"lscmd", ARG_NONE, false, NULL, "lscmd", NULL, cmd_list},
+  {"vol", ARG_NUMBER, false, NULL, "vol [n]", "Set master volume (0-180)", cmd_vol},
+  {"open", ARG_PATH, true, NULL, "open <dir>", "Open a directory", cmd_open},
+  {"play", ARG_PATH, false, NULL, "play [file]", "Play a file, or start the play queue", cmd_play},
+  {"scan", ARG_PATH, false, NULL, "scan [dir]", "Count the tracks under a directory and their total length", cmd_scan},
+  {"analyze", ARG_PATH, true, NULL, "analyze <file>", "Decode a file and report its peak and RMS level", cmd_analyze},
+  {"export", ARG_PATH, true, NULL, "export <src> <dst> [wav|raw] [rate] [f32|s16]", "Decode a file or directory to PCM on all cores", cmd_export},
+  {"dupes", ARG_PATH, false, NULL, "dupes [dir] [seconds]", "Find files holding the same recording, by how they sound, on all cores", cmd_dupes},
+  {"io", ARG_TEXT, false, "libav mmap uring", "io [libav|mmap|uring]", "Pick how audio files are read, or show I/O wait statistics", cmd_io},
+  {"queue", ARG_TEXT, false, "add dir tree ins rm clear", "queue [add <file>|dir [dir]|tree [dir] [track]|ins <n> <file>|rm <n>|clear]", "Edit the play queue, or show it", cmd_queue},
+  {"load", ARG_PATH, true, NULL, "load <playlist>", "Append an M3U or PLS playlist to the play queue", cmd_load},
+  {"save", ARG_PATH, true, NULL, "save <playlist>", "Write the play queue out as an M3U playlist", cmd_save},
+  {"prefetch", ARG_TEXT, false, "budget head", "prefetch [budget|head <MB>]", "Set how much upcoming audio is warmed, or show prefetch status", cmd_prefetch},
+  {"sort", ARG_TEXT, false, "name track year duration", "sort [name|track|year|duration]", "Order files in the file window, or show the current order", cmd_sort},
+  {"device", ARG_TEXT, false, "list use rate refresh buffers", "device [list|use <n|name>|rate <hz|auto|default>|refresh <hz>|buffers <count> [frames]]", "Pick the output device and tune its mixing rate and latency, or show them", cmd_device},
+  {"resample", ARG_TEXT, false, "off linear standard high soxr bench", "resample [off|linear|standard|high|soxr|bench <file> [rate]]", "Pick how tracks are converted to the device rate, or time each way on a file", cmd_resample},
+  {"mem", ARG_TEXT, false, "budget", "mem [budget <MB>]", "Show memory use by part of the program, or cap it", cmd_mem},
+  {"library", ARG_NONE, false, NULL, "library", "Browse the tags read so far by artist and album, or go back to the directory", cmd_library},
+  {"startup", ARG_NONE, false, NULL, "startup", "Show how long each part of startup took", cmd_startup},
+  {"seek", ARG_NUMBER, true, NULL, "seek <seconds>", "Jump to a position in the current track", cmd_seek},
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+// Index + 1 of the command whose name hashes to each slot, 0 for empty
+static unsigned char command_slots[COMMAND_SLOTS];
+static pthread_once_t slots_once = PTHREAD_ONCE_INIT;
+
+
+
+static unsigned int hash_name(const char *name, unsigned int length) {
+  unsigned int hash = 2166136261u;
+  size_t i;
+
+  for(i = 0; i < length; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+
+static void build_slots(void) {
+  unsigned int i, slot;
+
+  for(i = 0; i < COMMAND_COUNT; i++) {
+    slot = hash_name(commands[i].name, strlen(commands[i].name)) & (COMMAND_SLOTS - 1);
+    while(command_slots[slot]) {slot = (slot + 1) & (COMMAND_SLOTS - 1);}
+    command_slots[slot] = i + 1;
+  }
+
+  return;
+}
+
+
+// name doesn't have to be terminated, so the first word of a command line can be looked up in place
+const struct command *command_find(const char *name, unsigned int length) {
+  unsigned int slot;
+  const struct command *cmd;
+
+  // Jobs run commands from their own threads, so the table may be first needed on any of them
+  pthread_once(&slots_once, build_slots);
+
+  slot = hash_name(name, length) & (COMMAND_SLOTS - 1);
+  while(command_slots[slot]) {
+    cmd = &commands[command_slots[slot] - 1];
+    if(strncmp(cmd->name, name, length) == 0 && cmd->name[length] == 0) {return cmd;}
+    slot = (slot + 1) & (COMMAND_SLOTS - 1);
+  }
+
+  return NULL;
+}
+
+
+const struct command *command_at(unsigned int index) {
+  if(index >= COMMAND_COUNT) {return NULL;}
+  return &commands[index];
+}
+
+
+
+void parse_cmd(char *command) {
+  struct command_args args = {.text = "", .number = 0};
+  const struct command *cmd;
+  char buffer[192];
+  char *end;
+
+  while(*command == ' ') {command++;}
+  if(*command == 0) {return;}
+
+  unsigned int length = strcspn(command, " ");
+  if((cmd = command_find(command, length)) == NULL) {
+    snprintf(buffer, sizeof(buffer), "Unknown command '%.*s'. Use 'lscmd' for a list.", length, command);
+    display_msg(buffer);
+    return;
+  }
+
+  if(command[length] == ' ') {args.text = command + length + 1;}
+
+  // Arguments are checked here once, so the handlers can take them as given
+  if((cmd->arg_required && *args.text == 0) || (cmd->arg_type == ARG_NONE && *args.text)) {
+    snprintf(buffer, sizeof(buffer), "Usage: %s", cmd->usage);
+    display_msg(buffer);
+    return;
+  }
+
+  if(cmd->arg_type == ARG_NUMBER && *args.text) {
+    args.number = strtol(args.text, &end, 10);
+    if(end == args.text || *end != 0) {
+      snprintf(buffer, sizeof(buffer), "Usage: %s", cmd->usage);
+      display_msg(buffer);
+      return;
+    }
+  }
 
+  cmd->run(&args);
   return;
 }
@@ -0,0 +1,448 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <control.h>
+#include <playback.h>
+#include <queue.h>
+#include <prefetch.h>
+#include <intern.h>
+#include <track_meta.h>
+#include <error.h>
+
+
+// Newline separated commands in, newline separated replies out. Every command gets exactly one
+// reply line: "ok", "err <reason>", or for status and stats the line itself.
+//
+//   play [file]      start file, or resume if paused
+//   pause            pause
+//   toggle           pause or resume
+//   queue <file>     add to the play queue
+//   seek <seconds>   jump within the current track
+//   status           status state=<playing|paused|stopped> pos=<s> dur=<s> track=<serial> path=<file>
+//   stats            stats key=value ...
+//   subscribe        push a status line whenever playback changes, until unsubscribe
+//
+// Files are absolute paths or URLs. The client's working directory isn't the player's, so a
+// relative path would name some other file, and is refused.
+//
+// Everything runs on the main loop, between frames, so commands never race the UI
+
+
+struct client {
+  int fd;
+  bool subscribed;
+  char in[CONTROL_LINE_MAX];
+  size_t in_length;
+  bool discarding;
+  char *out;
+  size_t out_length;
+  size_t out_capacity;
+  // A reply couldn't be buffered, the client is dropped rather than sent half its replies
+  bool failed;
+};
+
+
+static int listen_fd = -1;
+static char *socket_path = NULL;
+static struct client clients[CONTROL_MAX_CLIENTS];
+static unsigned int client_count = 0;
+
+// What subscribers were last told about
+static unsigned int pushed_serial = 0;
+static int pushed_position = -1;
+static bool pushed_playing = false;
+static bool pushed_active = false;
+
+
+
+static const char *default_socket_path(void) {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+  if(runtime && *runtime) {snprintf(path, sizeof(path), "%s/trackjack.sock", runtime);}
+  else {snprintf(path, sizeof(path), "/tmp/trackjack-%u.sock", (unsigned int)getuid());}
+
+  return path;
+}
+
+
+// Returns 0 on success. Failing to listen isn't fatal, the player just can't be driven remotely
+int control_init(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  const char *path = default_socket_path();
+
+  if(listen_fd >= 0) {return 0;}
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listen_fd < 0) {goto fail;}
+
+  // A socket left behind by a player that didn't exit cleanly. One still answering belongs
+  // to another running instance and is left alone
+  if(connect(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    close(listen_fd);
+    listen_fd = -1;
+    goto fail;
+  }
+  close(listen_fd);
+  unlink(path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(listen_fd < 0) {goto fail;}
+  if(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+    close(listen_fd);
+    listen_fd = -1;
+    goto fail;
+  }
+
+  socket_path = strdup(path);
+  return 0;
+
+fail:
+  trackjack_error(JACK_ERR_CONTROL_SOCKET, (LIB_ERROR)0);
+  return -1;
+}
+
+
+const char *control_socket_path(void) {
+  return socket_path;
+}
+
+
+
+static void drop_client(unsigned int index) {
+  close(clients[index].fd);
+  free(clients[index].out);
+
+  clients[index] = clients[client_count - 1];
+  client_count--;
+
+  return;
+}
+
+
+static void reply(struct client *c, const char *line) {
+  size_t length = strlen(line);
+
+  if(c->failed) {return;}
+
+  if(c->out_length + length + 1 > c->out_capacity) {
+    size_t capacity = (c->out_length + length + 1) * 2;
+    char *out = realloc(c->out, capacity);
+
+    if(out == NULL) {
+      c->failed = true;
+      return;
+    }
+    c->out = out;
+    c->out_capacity = capacity;
+  }
+
+  memcpy(c->out + c->out_length, line, length);
+  c->out_length += length;
+  c->out[c->out_length++] = '\n';
+
+  return;
+}
+
+
+static void format_status(char *buf, size_t size) {
+  struct playback_state state;
+  playback_read_state(&state);
+
+  snprintf(buf, size, "status state=%s pos=%d dur=%u track=%u path=%s", !state.active ? "stopped" : state.playing ? "playing" : "paused", state.active ? state.position : 0, state.active ? state.duration : 0, state.track_serial, state.active ? state.path : "");
+
+  return;
+}
+
+
+static void format_stats(char *buf, size_t size) {
+  struct prefetch_status prefetch;
+  size_t strings, string_bytes;
+
+  prefetch_read_status(&prefetch);
+  intern_stats(&strings, &string_bytes);
+
+  snprintf(buf, size, "stats queue=%u clients=%u meta_cached=%u strings=%zu string_bytes=%zu warmed_bytes=%lu warmed_files=%u memory_pressure=%d", queue_length(), client_count, meta_cache_count(), strings, string_bytes, prefetch.warmed_bytes, prefetch.tracked_files, prefetch.under_pressure);
+
+  return;
+}
+
+
+
+static bool usable_path(const char *path) {
+  return path[0] == '/' || strstr(path, "://");
+}
+
+
+static void run_command(struct client *c, char *line) {
+  char buf[STATE_PATH_SIZE + 128];
+  char *arg = strchr(line, ' ');
+  struct playback_state state;
+
+  if(arg) {*arg++ = 0;}
+  else {arg = line + strlen(line);}
+
+  playback_read_state(&state);
+
+  if(strcmp(line, "play") == 0) {
+    if(*arg && !usable_path(arg)) {reply(c, "err path must be absolute");}
+    else if(*arg) {
+      unsigned int serial = state.track_serial;
+      playback_start(arg);
+      reply(c, playback_track_serial() != serial ? "ok" : "err could not play file");
+    }
+    else if(!state.active) {reply(c, "err nothing to play");}
+    else {
+      if(!state.playing) {playback_unpause();}
+      reply(c, "ok");
+    }
+  }
+  else if(strcmp(line, "pause") == 0) {
+    if(!state.active) {reply(c, "err nothing playing");}
+    else {
+      if(state.playing) {playback_pause();}
+      reply(c, "ok");
+    }
+  }
+  else if(strcmp(line, "toggle") == 0) {
+    if(!state.active) {reply(c, "err nothing playing");}
+    else {
+      if(state.playing) {playback_pause();}
+      else {playback_unpause();}
+      reply(c, "ok");
+    }
+  }
+  else if(strcmp(line, "queue") == 0) {
+    if(*arg == 0) {reply(c, "err usage: queue <file>");}
+    else if(!usable_path(arg)) {reply(c, "err path must be absolute");}
+    else {
+      playback_queue(arg);
+      reply(c, "ok");
+    }
+  }
+  else if(strcmp(line, "seek") == 0) {
+    if(*arg == 0) {reply(c, "err usage: seek <seconds>");}
+    else if(playback_seek(strtoul(arg, NULL, 10)) != 0) {reply(c, "err nothing playing");}
+    else {reply(c, "ok");}
+  }
+  else if(strcmp(line, "status") == 0) {
+    format_status(buf, sizeof(buf));
+    reply(c, buf);
+  }
+  else if(strcmp(line, "stats") == 0) {
+    format_stats(buf, sizeof(buf));
+    reply(c, buf);
+  }
+  else if(strcmp(line, "subscribe") == 0) {
+    c->subscribed = true;
+    format_status(buf, sizeof(buf));
+    reply(c, buf);
+  }
+  else if(strcmp(line, "unsubscribe") == 0) {
+    c->subscribed = false;
+    reply(c, "ok");
+  }
+  else {reply(c, "err unknown command");}
+
+  return;
+}
+
+
+
+// Takes whatever the client has sent and runs every complete line. Returns false once the client is gone
+static bool read_client(struct client *c) {
+  char *line, *newline;
+  ssize_t got;
+
+  while((got = read(c->fd, c->in + c->in_length, sizeof(c->in) - c->in_length)) > 0) {
+    c->in_length += got;
+    line = c->in;
+
+    while((newline = memchr(line, '\n', c->in + c->in_length - line))) {
+      *newline = 0;
+      if(newline > line && newline[-1] == '\r') {newline[-1] = 0;}
+
+      // The tail of a line that was too long
+      if(c->discarding) {c->discarding = false;}
+      else if(*line) {run_command(c, line);}
+
+      line = newline + 1;
+    }
+
+    c->in_length -= line - c->in;
+    memmove(c->in, line, c->in_length);
+
+    if(c->in_length == sizeof(c->in)) {
+      if(!c->discarding) {reply(c, "err line too long");}
+      c->discarding = true;
+      c->in_length = 0;
+    }
+  }
+
+  if(got == 0 || c->failed) {return false;}
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+
+// Sends as much pending output as the socket takes. Returns false if the client has to go
+static bool flush_client(struct client *c) {
+  ssize_t sent;
+  size_t done = 0;
+
+  while(done < c->out_length) {
+    sent = send(c->fd, c->out + done, c->out_length - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(sent < 0) {
+      if(errno == EINTR) {continue;}
+      if(errno != EAGAIN && errno != EWOULDBLOCK) {return false;}
+      break;
+    }
+    done += sent;
+  }
+
+  c->out_length -= done;
+  memmove(c->out, c->out + done, c->out_length);
+
+  // A subscriber that stopped reading isn't worth buffering for forever
+  return c->out_length <= CONTROL_OUTPUT_MAX;
+}
+
+
+static void push_updates(void) {
+  struct playback_state state;
+  char buf[STATE_PATH_SIZE + 128];
+  size_t i;
+
+  playback_read_state(&state);
+  if(state.track_serial == pushed_serial && state.position == pushed_position && state.playing == pushed_playing && state.active == pushed_active) {return;}
+
+  pushed_serial = state.track_serial;
+  pushed_position = state.position;
+  pushed_playing = state.playing;
+  pushed_active = state.active;
+
+  format_status(buf, sizeof(buf));
+  for(i = 0; i < client_count; i++) {
+    if(clients[i].subscribed) {reply(&clients[i], buf);}
+  }
+
+  return;
+}
+
+
+static void accept_clients(void) {
+  int fd;
+
+  while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if(client_count == CONTROL_MAX_CLIENTS) {
+      send(fd, "err too many clients\n", 21, MSG_NOSIGNAL | MSG_DONTWAIT);
+      close(fd);
+      continue;
+    }
+
+    clients[client_count++] = (struct client){.fd = fd};
+  }
+
+  return;
+}
+
+
+
+// The sockets worth waking the main loop for, so commands don't wait out an idle frame
+unsigned int control_pollfds(struct pollfd *fds, unsigned int max) {
+  unsigned int count = 0;
+  size_t i;
+
+  if(listen_fd < 0 || max == 0) {return 0;}
+
+  fds[count++] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+  for(i = 0; i < client_count && count < max; i++) {
+    fds[count++] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN | (clients[i].out_length ? POLLOUT : 0)};
+  }
+
+  return count;
+}
+
+
+// Called every main loop tick. Never blocks: the poll() only asks which sockets have something
+void control_poll(void) {
+  struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+  unsigned int count;
+  size_t i;
+
+  if(listen_fd < 0) {return;}
+
+  fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+  for(i = 0; i < client_count; i++) {
+    fds[i + 1] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN | (clients[i].out_length ? POLLOUT : 0)};
+  }
+  count = client_count;
+
+  if(poll(fds, count + 1, 0) > 0) {
+    // Walked backwards, dropping a client moves the last one into its slot
+    for(i = count; i-- > 0;) {
+      if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        if(!read_client(&clients[i])) {
+          drop_client(i);
+          continue;
+        }
+      }
+    }
+
+    if(fds[0].revents & POLLIN) {accept_clients();}
+  }
+
+  push_updates();
+
+  for(i = client_count; i-- > 0;) {
+    if(clients[i].failed || (clients[i].out_length && !flush_client(&clients[i]))) {drop_client(i);}
+  }
+
+  return;
+}
+
+
+void control_cleanup(void) {
+  while(client_count > 0) {drop_client(client_count - 1);}
+
+  if(listen_fd >= 0) {
+    close(listen_fd);
+    unlink(socket_path);
+  }
+  listen_fd = -1;
+
+  free(socket_path);
+  socket_path = NULL;
+
+  return;
+}
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#include <demux.h>
+#include <mem.h>
+
+
+// Over the memory budget, read-ahead is cut back to this many packets before anything else has to give
+#define DEMUX_BUDGET_PACKETS 32
+
+
+// Reads a file's compressed packets on a thread of its own, keeping a bounded queue of them
+// ahead of the decoder. The decoder then only waits on the disk (or the network) when the
+// queue has run dry, rather than for every packet
+struct demuxer {
+  AVFormatContext *format_context;
+  int stream;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool stop;
+
+  AVPacket *packets[DEMUX_MAX_PACKETS];
+  unsigned int head;
+  unsigned int count;
+  unsigned long bytes;
+
+  // 0 while reading, AVERROR_EOF or the read error once the file is done
+  int status;
+};
+
+
+// Totals over every demuxer, for the io command
+static atomic_uint_fast64_t queued_bytes;
+static atomic_uint_fast64_t queued_packets;
+static atomic_uint_fast64_t waits;
+static atomic_uint_fast64_t wait_ns;
+
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static bool queue_full(DEMUXER *d) {
+  if(d->count >= DEMUX_BUDGET_PACKETS && mem_over_budget()) {return true;}
+  return d->count == DEMUX_MAX_PACKETS || d->bytes >= DEMUX_MAX_BYTES;
+}
+
+
+static void *demux_thread(void *arg) {
+  DEMUXER *d = arg;
+  AVPacket *packet;
+  int ret;
+
+  pthread_mutex_lock(&d->lock);
+  while(!d->stop) {
+    if(queue_full(d)) {
+      pthread_cond_wait(&d->cond, &d->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    // Cover art and other streams never reach the decoder, so they aren't queued either
+    packet = av_packet_alloc();
+    while((ret = av_read_frame(d->format_context, packet)) >= 0 && packet->stream_index != d->stream) {
+      av_packet_unref(packet);
+    }
+
+    pthread_mutex_lock(&d->lock);
+    if(ret < 0) {
+      av_packet_free(&packet);
+      d->status = ret;
+      pthread_cond_broadcast(&d->cond);
+      break;
+    }
+
+    d->packets[(d->head + d->count) % DEMUX_MAX_PACKETS] = packet;
+    d->count++;
+    d->bytes += packet->size;
+    atomic_fetch_add_explicit(&queued_bytes, packet->size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queued_packets, 1, memory_order_relaxed);
+    mem_account(MEM_READAHEAD, packet->size, 1);
+    pthread_cond_broadcast(&d->cond);
+  }
+  pthread_mutex_unlock(&d->lock);
+
+  return NULL;
+}
+
+
+
+// The demuxer owns format_context from here on: nothing else may read from or seek in it
+// until demux_stop(). NULL if the thread can't be started, the caller then reads directly
+DEMUXER *demux_start(AVFormatContext *format_context, int stream) {
+  DEMUXER *d = calloc(1, sizeof(DEMUXER));
+  if(d == NULL) {return NULL;}
+
+  d->format_context = format_context;
+  d->stream = stream;
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->cond, NULL);
+
+  if(pthread_create(&d->thread, NULL, demux_thread, d) != 0) {
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+    free(d);
+    return NULL;
+  }
+
+  return d;
+}
+
+
+// Moves the next packet into packet, waiting for the demuxer if it hasn't got that far.
+// Returns what av_read_frame() would have: 0, or AVERROR_EOF / an error at the end
+int demux_read(DEMUXER *d, AVPacket *packet) {
+  AVPacket *next;
+
+  pthread_mutex_lock(&d->lock);
+  if(d->count == 0 && d->status == 0) {
+    uint64_t start = now_ns();
+    while(d->count == 0 && d->status == 0) {pthread_cond_wait(&d->cond, &d->lock);}
+
+    atomic_fetch_add_explicit(&waits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&wait_ns, now_ns() - start, memory_order_relaxed);
+  }
+
+  if(d->count == 0) {
+    int status = d->status;
+    pthread_mutex_unlock(&d->lock);
+    return status;
+  }
+
+  next = d->packets[d->head];
+  d->head = (d->head + 1) % DEMUX_MAX_PACKETS;
+  d->count--;
+  d->bytes -= next->size;
+  atomic_fetch_sub_explicit(&queued_bytes, next->size, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&queued_packets, 1, memory_order_relaxed);
+  mem_account(MEM_READAHEAD, -next->size, -1);
+
+  // There's room again
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->lock);
+
+  av_packet_move_ref(packet, next);
+  av_packet_free(&next);
+  return 0;
+}
+
+
+void demux_stop(DEMUXER *d) {
+  pthread_mutex_lock(&d->lock);
+  d->stop = true;
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->lock);
+  pthread_join(d->thread, NULL);
+
+  while(d->count > 0) {
+    atomic_fetch_sub_explicit(&queued_bytes, d->packets[d->head]->size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&queued_packets, 1, memory_order_relaxed);
+    mem_account(MEM_READAHEAD, -d->packets[d->head]->size, -1);
+    av_packet_free(&d->packets[d->head]);
+    d->head = (d->head + 1) % DEMUX_MAX_PACKETS;
+    d->count--;
+  }
+
+  pthread_mutex_destroy(&d->lock);
+  pthread_cond_destroy(&d->cond);
+  free(d);
+  return;
+}
+
+
+void demux_read_stats(struct demux_stats *out) {
+  out->queued_bytes = atomic_load_explicit(&queued_bytes, memory_order_relaxed);
+  out->queued_packets = atomic_load_explicit(&queued_packets, memory_order_relaxed);
+  out->waits = atomic_load_explicit(&waits, memory_order_relaxed);
+  out->wait_ns = atomic_load_explicit(&wait_ns, memory_order_relaxed);
+  return;
+}
@@ -0,0 +1,847 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/tx.h>
+
+#include <audio_source.h>
+#include <dupes.h>
+#include <fs_util.h>
+#include <mem.h>
+#include <sort.h>
+#include <walk.h>
+#include <ui.h>
+
+
+// Everything is converted to this rate and mixed down to mono before looking at the spectrum,
+// so rips at different rates and channel counts come out the same
+#define DUPES_RATE 11025
+#define DUPES_FFT_SIZE 2048
+#define DUPES_HOP 512
+
+// Bands are spaced logarithmically over the range lossy codecs leave most alone
+#define DUPES_LOW_HZ 300
+#define DUPES_HIGH_HZ 3000
+
+// The decoded stretch is cut into DUPES_ROWS + 1 slices of time and the spectrum into DUPES_BANDS + 1 bands.
+// Each bit says whether the level difference between two neighbouring bands grew from one slice to the next,
+// which doesn't care about volume, bitrate or a few ms of encoder delay. One 32 bit word per row
+#define DUPES_ROWS 32
+#define DUPES_BANDS 32
+#define DUPES_BITS (DUPES_ROWS * DUPES_BANDS)
+
+// Two prints this many bits apart or fewer are the same recording. Unrelated tracks are around half apart
+#define DUPES_MAX_DISTANCE 160
+// Copies of one recording only differ in length by encoder padding, in seconds
+#define DUPES_MAX_LENGTH_GAP 2
+
+// The index: each table keys every print on its own fixed choice of DUPES_KEY_BITS bits, and only
+// prints sharing a key in at least one table are ever compared
+#define DUPES_TABLES 32
+#define DUPES_KEY_BITS 16
+// A key this many tracks share says nothing about any of them (near silence...), the other tables still see them
+#define DUPES_BUCKET_LIMIT 256
+
+#define DUPES_DEFAULT_SECONDS 30
+#define DUPES_MIN_SECONDS 5
+// Silence at the start is skipped, up to this many seconds of it, so a rip with a longer pregap still lines up
+#define DUPES_MAX_SILENCE 10
+// -50 dBFS
+#define DUPES_SILENCE 0.0032f
+
+#define DUPES_PROGRESS_SECONDS 10
+
+#define DUPES_MAGIC "TJFP"
+#define DUPES_VERSION 2
+#define DUPES_HEADER_SIZE 8
+
+#define PRINT_FAILED 0
+#define PRINT_NEW 1
+#define PRINT_CACHED 2
+
+
+// Also what the cache file holds per record, followed by the file's path
+struct dupes_print {
+  uint64_t identity;
+  uint16_t seconds;
+  uint16_t duration;
+  uint32_t kbps;
+  char codec[8];
+  uint32_t bits[DUPES_ROWS];
+};
+
+struct dupes_cache {
+  uint8_t *data;
+  struct dupes_print *records;
+  const char **paths;
+  uint8_t *used;
+  unsigned int count;
+  unsigned int *slots;
+  unsigned int mask;
+};
+
+// The walk appends to paths while the workers fingerprint what it has found so far. The lock
+// covers paths, prints and state growing, and the counts
+struct dupes_batch {
+  char **paths;
+  unsigned int count;
+  unsigned int capacity;
+  int seconds;
+
+  struct dupes_print *prints;
+  uint8_t *state;
+  struct dupes_cache cache;
+  unsigned int band_edges[DUPES_BANDS + 2];
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool listed;
+  unsigned int next;
+  unsigned int done;
+  unsigned int cached;
+};
+
+// What each worker thread decodes and transforms with
+struct fingerprinter {
+  AVTXContext *tx_context;
+  av_tx_fn tx_fn;
+  float *window;
+  float *tx_in;
+  AVComplexFloat *tx_out;
+  float *pcm;
+};
+
+struct bucket_entry {
+  uint32_t key;
+  uint32_t id;
+};
+
+
+static atomic_bool dupes_running = false;
+
+// Bit positions each index table keys on, picked once
+static uint16_t key_bits[DUPES_TABLES][DUPES_KEY_BITS];
+static bool key_bits_ready = false;
+
+
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+// Called by walk_tree() for each file it finds
+static void add_path(char *path, void *data) {
+  struct dupes_batch *batch = data;
+
+  pthread_mutex_lock(&batch->lock);
+
+  if(batch->count == batch->capacity) {
+    unsigned int capacity = batch->capacity ? batch->capacity * 2 : 256;
+    char **paths = realloc(batch->paths, capacity * sizeof(char *));
+    if(paths) {batch->paths = paths;}
+    struct dupes_print *prints = NULL;
+    if(paths) {prints = batch->prints ? mem_realloc(batch->prints, capacity * sizeof(struct dupes_print)) : mem_alloc(MEM_CACHE, capacity * sizeof(struct dupes_print));}
+    if(prints) {batch->prints = prints;}
+    uint8_t *state = NULL;
+    if(prints) {state = batch->state ? mem_realloc(batch->state, capacity) : mem_alloc(MEM_CACHE, capacity);}
+    if(state) {
+      batch->state = state;
+      batch->capacity = capacity;
+    }
+  }
+
+  if(batch->count == batch->capacity) {free(path);}
+  else {
+    batch->paths[batch->count] = path;
+    batch->state[batch->count] = PRINT_FAILED;
+    batch->count++;
+    pthread_cond_signal(&batch->cond);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
+  return;
+}
+
+
+
+// The cache is one file of records, each a struct dupes_print, the length of the path including
+// its terminator as 16 bits, and the path. It's read whole before a run and written back after it
+static void load_cache(struct dupes_cache *cache, const char *file) {
+  struct stat st;
+  unsigned int i, slot;
+  size_t position;
+  uint16_t length;
+
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return;}
+
+  if(fstat(fd, &st) != 0 || st.st_size < DUPES_HEADER_SIZE) {
+    close(fd);
+    return;
+  }
+
+  size_t size = st.st_size;
+  cache->data = mem_alloc(MEM_CACHE, size);
+  if(read(fd, cache->data, size) != (ssize_t)size || memcmp(cache->data, DUPES_MAGIC, 4) != 0 || cache->data[4] != DUPES_VERSION) {size = 0;}
+  close(fd);
+
+  // Once to count the records, once to pick them out. A cut off record ends the cache there
+  unsigned int count = 0;
+  for(position = DUPES_HEADER_SIZE; position + sizeof(struct dupes_print) + 2 <= size; position += sizeof(struct dupes_print) + 2 + length) {
+    memcpy(&length, cache->data + position + sizeof(struct dupes_print), 2);
+    if(length == 0 || position + sizeof(struct dupes_print) + 2 + length > size) {break;}
+    if(cache->data[position + sizeof(struct dupes_print) + 2 + length - 1] != 0) {break;}
+    count++;
+  }
+
+  cache->records = mem_alloc(MEM_CACHE, count * sizeof(struct dupes_print) + 1);
+  cache->paths = mem_alloc(MEM_CACHE, count * sizeof(char *) + 1);
+  cache->used = mem_calloc(MEM_CACHE, count + 1, 1);
+  cache->count = count;
+
+  position = DUPES_HEADER_SIZE;
+  for(i = 0; i < count; i++) {
+    memcpy(&cache->records[i], cache->data + position, sizeof(struct dupes_print));
+    memcpy(&length, cache->data + position + sizeof(struct dupes_print), 2);
+    cache->paths[i] = (const char *)cache->data + position + sizeof(struct dupes_print) + 2;
+    position += sizeof(struct dupes_print) + 2 + length;
+  }
+
+  unsigned int capacity = 16;
+  while(capacity < count * 2) {capacity *= 2;}
+  cache->mask = capacity - 1;
+  cache->slots = mem_calloc(MEM_CACHE, capacity, sizeof(unsigned int));
+
+  // Slots hold record index + 1, 0 is empty
+  for(i = 0; i < count; i++) {
+    slot = cache->records[i].identity & cache->mask;
+    while(cache->slots[slot]) {slot = (slot + 1) & cache->mask;}
+    cache->slots[slot] = i + 1;
+  }
+
+  return;
+}
+
+
+static void free_cache(struct dupes_cache *cache) {
+  if(cache->data == NULL) {return;}
+
+  mem_free(cache->data);
+  mem_free(cache->records);
+  mem_free(cache->paths);
+  mem_free(cache->used);
+  mem_free(cache->slots);
+
+  return;
+}
+
+
+// Only read once the workers are going, apart from marking the record used, so no locking
+static const struct dupes_print *cache_lookup(struct dupes_cache *cache, uint64_t identity, int seconds) {
+  if(cache->slots == NULL) {return NULL;}
+
+  unsigned int slot = identity & cache->mask;
+  while(cache->slots[slot]) {
+    unsigned int index = cache->slots[slot] - 1;
+    struct dupes_print *record = &cache->records[index];
+    if(record->identity == identity && record->seconds == seconds) {
+      cache->used[index] = 1;
+      return record;
+    }
+    slot = (slot + 1) & cache->mask;
+  }
+
+  return NULL;
+}
+
+
+static bool write_record(FILE *file, const struct dupes_print *print, const char *path) {
+  uint16_t length = strlen(path) + 1;
+
+  if(fwrite(print, sizeof(struct dupes_print), 1, file) != 1) {return false;}
+  if(fwrite(&length, 2, 1, file) != 1) {return false;}
+  return fwrite(path, length, 1, file) == 1;
+}
+
+
+// Writes back every print of this run, and of the records it didn't look at the ones whose file is still
+// there unchanged. The rest belong to files that were deleted, re-ripped or retagged, and are dropped
+static void save_cache(struct dupes_batch *batch, const char *file) {
+  uint8_t header[DUPES_HEADER_SIZE] = {0};
+  struct dupes_cache *cache = &batch->cache;
+  unsigned int i;
+  bool ok;
+
+  char *temp = malloc(strlen(file) + 5);
+  sprintf(temp, "%s.tmp", file);
+
+  FILE *out = fopen(temp, "we");
+  if(out == NULL) {
+    free(temp);
+    return;
+  }
+
+  memcpy(header, DUPES_MAGIC, 4);
+  header[4] = DUPES_VERSION;
+  ok = fwrite(header, DUPES_HEADER_SIZE, 1, out) == 1;
+
+  for(i = 0; ok && i < batch->count; i++) {
+    if(batch->state[i] == PRINT_FAILED || strlen(batch->paths[i]) >= UINT16_MAX) {continue;}
+    ok = write_record(out, &batch->prints[i], batch->paths[i]);
+  }
+
+  for(i = 0; ok && i < cache->count; i++) {
+    if(cache->used[i] || file_identity(cache->paths[i]) != cache->records[i].identity) {continue;}
+    ok = write_record(out, &cache->records[i], cache->paths[i]);
+  }
+
+  // Under a temporary name first, so a run that dies halfway leaves the old cache alone
+  if(fclose(out) != 0) {ok = false;}
+  if(ok) {rename(temp, file);}
+  else {unlink(temp);}
+
+  free(temp);
+  return;
+}
+
+
+
+static bool fingerprinter_init(struct fingerprinter *worker, int seconds) {
+  float scale = 1.0f;
+  int i;
+
+  memset(worker, 0, sizeof(struct fingerprinter));
+  if(av_tx_init(&worker->tx_context, &worker->tx_fn, AV_TX_FLOAT_RDFT, 0, DUPES_FFT_SIZE, &scale, 0) < 0) {return false;}
+
+  // av_malloc() so the SIMD versions of the transform get aligned buffers
+  worker->window = av_malloc(DUPES_FFT_SIZE * sizeof(float));
+  worker->tx_in = av_malloc((DUPES_FFT_SIZE + 2) * sizeof(float));
+  worker->tx_out = av_malloc((DUPES_FFT_SIZE / 2 + 1) * sizeof(AVComplexFloat));
+  worker->pcm = mem_alloc(MEM_DECODE, (size_t)seconds * DUPES_RATE * sizeof(float));
+
+  // Hann window
+  for(i = 0; i < DUPES_FFT_SIZE; i++) {
+    worker->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / (DUPES_FFT_SIZE - 1));
+  }
+
+  return true;
+}
+
+
+static void fingerprinter_free(struct fingerprinter *worker) {
+  if(worker->tx_context) {av_tx_uninit(&worker->tx_context);}
+  av_freep(&worker->window);
+  av_freep(&worker->tx_in);
+  av_freep(&worker->tx_out);
+  if(worker->pcm) {mem_free(worker->pcm);}
+  worker->pcm = NULL;
+
+  return;
+}
+
+
+// Decodes the first seconds of the file past any silence, through the same decoder and resampler as playback
+static unsigned int decode_start(struct fingerprinter *worker, const char *path, int seconds, struct dupes_print *print) {
+  unsigned int wanted = seconds * DUPES_RATE;
+  unsigned int silence_left = DUPES_MAX_SILENCE * DUPES_RATE;
+  unsigned int length = 0;
+  bool heard = false;
+  uint8_t *buf;
+  int buf_size;
+  int i, c;
+
+  AUDIO_SOURCE *song = new_audio_source(path);
+  if(song == NULL) {return 0;}
+
+  // Always the same preset, so the prints don't change with what playback is set to
+  if(prep_audio_source_quality(song, DUPES_RATE, RESAMPLE_STANDARD) < 0) {
+    free_audio_source(song);
+    return 0;
+  }
+
+  int channels = song->track_data.channels;
+
+  while(length < wanted && (buf = decode_chunk(song, &buf_size))) {
+    float *pcm = (float *)buf;
+    int frames = buf_size / (channels * sizeof(float));
+
+    for(i = 0; i < frames && length < wanted; i++) {
+      float value = 0;
+      for(c = 0; c < channels; c++) {value += pcm[i * channels + c];}
+      value /= channels;
+
+      if(!heard) {
+        if(fabsf(value) < DUPES_SILENCE && silence_left > 0) {
+          silence_left--;
+          continue;
+        }
+        heard = true;
+      }
+
+      worker->pcm[length++] = value;
+    }
+
+    mem_free(buf);
+  }
+
+  print->duration = song->track_data.duration;
+  print->kbps = song->format_context->bit_rate > 0 ? song->format_context->bit_rate / 1000 : 0;
+  snprintf(print->codec, sizeof(print->codec), "%s", song->codec ? song->codec->name : "?");
+
+  free_audio_source(song);
+  return length;
+}
+
+
+static bool fingerprint(struct dupes_batch *batch, struct fingerprinter *worker, const char *path, struct dupes_print *print) {
+  float levels[DUPES_ROWS + 1][DUPES_BANDS + 1] = {{0}};
+  unsigned int frame, i;
+  int row, band;
+
+  unsigned int length = decode_start(worker, path, batch->seconds, print);
+  if(length < DUPES_MIN_SECONDS * DUPES_RATE) {return false;}
+
+  unsigned int frames = (length - DUPES_FFT_SIZE) / DUPES_HOP + 1;
+
+  for(frame = 0; frame < frames; frame++) {
+    float *pcm = worker->pcm + frame * DUPES_HOP;
+    for(i = 0; i < DUPES_FFT_SIZE; i++) {
+      worker->tx_in[i] = pcm[i] * worker->window[i];
+    }
+    worker->tx_fn(worker->tx_context, worker->tx_out, worker->tx_in, sizeof(float));
+
+    row = (uint64_t)frame * (DUPES_ROWS + 1) / frames;
+    for(band = 0; band <= DUPES_BANDS; band++) {
+      float energy = 0;
+      for(i = batch->band_edges[band]; i < batch->band_edges[band + 1]; i++) {
+        energy += worker->tx_out[i].re * worker->tx_out[i].re + worker->tx_out[i].im * worker->tx_out[i].im;
+      }
+      levels[row][band] += energy;
+    }
+  }
+
+  for(row = 0; row <= DUPES_ROWS; row++) {
+    for(band = 0; band <= DUPES_BANDS; band++) {
+      levels[row][band] = logf(levels[row][band] + 1e-9f);
+    }
+  }
+
+  for(row = 0; row < DUPES_ROWS; row++) {
+    uint32_t word = 0;
+
+    for(band = 0; band < DUPES_BANDS; band++) {
+      float before = levels[row][band] - levels[row][band + 1];
+      float now = levels[row + 1][band] - levels[row + 1][band + 1];
+      if(now > before) {word |= 1u << band;}
+    }
+
+    print->bits[row] = word;
+  }
+
+  return true;
+}
+
+
+static void *dupes_worker(void *data) {
+  struct dupes_batch *batch = data;
+  struct fingerprinter worker;
+  unsigned int index;
+
+  // All cores are fair game, but playing comes first
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  if(!fingerprinter_init(&worker, batch->seconds)) {
+    fingerprinter_free(&worker);
+    return NULL;
+  }
+
+  // Files are taken as the walk finds them, until it has finished and they've all been taken
+  pthread_mutex_lock(&batch->lock);
+  while(true) {
+    if(batch->next == batch->count) {
+      if(batch->listed) {break;}
+      pthread_cond_wait(&batch->cond, &batch->lock);
+      continue;
+    }
+
+    index = batch->next++;
+    const char *path = batch->paths[index];
+    pthread_mutex_unlock(&batch->lock);
+
+    struct dupes_print print;
+    uint8_t state = PRINT_FAILED;
+    uint64_t identity = file_identity(path);
+    const struct dupes_print *cached = identity ? cache_lookup(&batch->cache, identity, batch->seconds) : NULL;
+
+    if(cached) {
+      print = *cached;
+      state = PRINT_CACHED;
+    }
+    else if(identity && fingerprint(batch, &worker, path, &print)) {
+      print.identity = identity;
+      print.seconds = batch->seconds;
+      state = PRINT_NEW;
+    }
+
+    // prints and state may have been moved by add_path() meanwhile
+    pthread_mutex_lock(&batch->lock);
+    if(state != PRINT_FAILED) {batch->prints[index] = print;}
+    batch->state[index] = state;
+    if(state == PRINT_CACHED) {batch->cached++;}
+    batch->done++;
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  fingerprinter_free(&worker);
+  return NULL;
+}
+
+
+
+static unsigned int find_root(uint32_t *parent, unsigned int id) {
+  while(parent[id] != id) {
+    parent[id] = parent[parent[id]];
+    id = parent[id];
+  }
+
+  return id;
+}
+
+
+static unsigned int print_distance(const struct dupes_print *a, const struct dupes_print *b) {
+  unsigned int distance = 0;
+  int i;
+
+  for(i = 0; i < DUPES_ROWS; i++) {
+    distance += __builtin_popcount(a->bits[i] ^ b->bits[i]);
+  }
+
+  return distance;
+}
+
+
+// Joins the groups of a and b if they are the same recording. The lower id stays the root,
+// so each group reads out in path order starting from its root
+static void try_pair(struct dupes_batch *batch, uint32_t *parent, unsigned int a, unsigned int b) {
+  unsigned int root_a = find_root(parent, a);
+  unsigned int root_b = find_root(parent, b);
+  if(root_a == root_b) {return;}
+
+  struct dupes_print *print_a = &batch->prints[a];
+  struct dupes_print *print_b = &batch->prints[b];
+  int gap = (int)print_a->duration - (int)print_b->duration;
+  if(gap > DUPES_MAX_LENGTH_GAP || gap < -DUPES_MAX_LENGTH_GAP) {return;}
+  if(print_distance(print_a, print_b) > DUPES_MAX_DISTANCE) {return;}
+
+  if(root_a < root_b) {parent[root_b] = root_a;}
+  else {parent[root_a] = root_b;}
+
+  return;
+}
+
+
+static void pick_key_bits(void) {
+  uint16_t positions[DUPES_BITS];
+  uint32_t state = 0x9E3779B9;
+  int table, i;
+
+  if(key_bits_ready) {return;}
+
+  // Fixed seed, so the same library always ends up in the same buckets
+  for(table = 0; table < DUPES_TABLES; table++) {
+    for(i = 0; i < DUPES_BITS; i++) {positions[i] = i;}
+
+    for(i = 0; i < DUPES_KEY_BITS; i++) {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+
+      int pick = i + state % (DUPES_BITS - i);
+      uint16_t swap = positions[i];
+      positions[i] = positions[pick];
+      positions[pick] = swap;
+      key_bits[table][i] = positions[i];
+    }
+  }
+
+  key_bits_ready = true;
+  return;
+}
+
+
+static uint32_t print_key(const struct dupes_print *print, int table) {
+  uint32_t key = 0;
+  int i;
+
+  for(i = 0; i < DUPES_KEY_BITS; i++) {
+    int bit = key_bits[table][i];
+    key = key << 1 | ((print->bits[bit / 32] >> (bit % 32)) & 1);
+  }
+
+  return key;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  const struct bucket_entry *x = a;
+  const struct bucket_entry *y = b;
+
+  if(x->key != y->key) {return x->key < y->key ? -1 : 1;}
+  return x->id < y->id ? -1 : x->id > y->id;
+}
+
+
+// Sorting each table's keys puts every bucket in one run, and only pairs within a run are compared
+static void group_prints(struct dupes_batch *batch, uint32_t *parent) {
+  struct bucket_entry *entries = mem_alloc(MEM_CACHE, batch->count * sizeof(struct bucket_entry) + 1);
+  unsigned int count, first, last, i, j;
+  int table;
+
+  pick_key_bits();
+
+  for(i = 0; i < batch->count; i++) {parent[i] = i;}
+
+  for(table = 0; table < DUPES_TABLES; table++) {
+    count = 0;
+    for(i = 0; i < batch->count; i++) {
+      if(batch->state[i] == PRINT_FAILED) {continue;}
+      entries[count].key = print_key(&batch->prints[i], table);
+      entries[count].id = i;
+      count++;
+    }
+
+    qsort(entries, count, sizeof(struct bucket_entry), compare_entries);
+
+    for(first = 0; first < count; first = last) {
+      for(last = first + 1; last < count && entries[last].key == entries[first].key; last++);
+      if(last - first > DUPES_BUCKET_LIMIT) {continue;}
+
+      for(i = first; i < last; i++) {
+        for(j = i + 1; j < last; j++) {
+          try_pair(batch, parent, entries[i].id, entries[j].id);
+        }
+      }
+    }
+  }
+
+  mem_free(entries);
+  return;
+}
+
+
+
+static void report_groups(struct dupes_batch *batch, uint32_t *parent, unsigned int *group_count, unsigned int *track_count) {
+  uint32_t *next = mem_alloc(MEM_CACHE, batch->count * sizeof(uint32_t) + 1);
+  uint32_t *size = mem_calloc(MEM_CACHE, batch->count + 1, sizeof(uint32_t));
+  char msg[PATH_MAX + 80];
+  unsigned int i, member;
+
+  // Members of each group chained in path order, UINT32_MAX ends a chain
+  memset(next, 0xFF, batch->count * sizeof(uint32_t));
+  for(i = batch->count; i-- > 0;) {
+    unsigned int root = find_root(parent, i);
+    if(root != i) {
+      next[i] = next[root];
+      next[root] = i;
+    }
+    size[root]++;
+  }
+
+  *group_count = 0;
+  *track_count = 0;
+
+  for(i = 0; i < batch->count; i++) {
+    if(parent[i] != i || size[i] < 2) {continue;}
+
+    (*group_count)++;
+    *track_count += size[i];
+
+    snprintf(msg, sizeof(msg), "Same recording, %u copies:", size[i]);
+    display_msg(msg);
+
+    for(member = i; member != UINT32_MAX; member = next[member]) {
+      struct dupes_print *print = &batch->prints[member];
+      snprintf(msg, sizeof(msg), "  %s  (%s, %u kbps, %u:%02u)", batch->paths[member], print->codec, print->kbps, print->duration / 60, print->duration % 60);
+      display_msg(msg);
+    }
+  }
+
+  mem_free(next);
+  mem_free(size);
+  return;
+}
+
+
+
+// dupes [dir] [seconds]
+// Fingerprints the first seconds of every audio file under dir on all cores, and reports
+// the files that hold the same recording
+void dupes_cmd(char *args) {
+  struct dupes_batch batch = {0};
+  struct timespec start, deadline;
+  char msg[200];
+  char *dir = args;
+  unsigned int i, group_count, track_count;
+
+  batch.seconds = DUPES_DEFAULT_SECONDS;
+
+  // A trailing number is how many seconds of each file to look at, the rest is the directory
+  char *last = strrchr(args, ' ');
+  char *number = last ? last + 1 : args;
+  if(*number && strspn(number, "0123456789") == strlen(number)) {
+    batch.seconds = atoi(number);
+    if(last) {*last = 0;}
+    else {dir = "";}
+  }
+  if(*dir == 0) {dir = ".";}
+
+  if(batch.seconds < DUPES_MIN_SECONDS || batch.seconds > 600) {
+    display_msg("Usage: dupes [dir] [seconds], with 5 to 600 seconds");
+    return;
+  }
+
+  if(atomic_exchange(&dupes_running, true)) {
+    display_msg("Already looking for duplicates.");
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  char *cache_file = cache_path("prints");
+  if(cache_file) {load_cache(&batch.cache, cache_file);}
+
+  for(i = 0; i <= DUPES_BANDS + 1; i++) {
+    double hz = DUPES_LOW_HZ * pow((double)DUPES_HIGH_HZ / DUPES_LOW_HZ, (double)i / (DUPES_BANDS + 1));
+    batch.band_edges[i] = lrint(hz * DUPES_FFT_SIZE / DUPES_RATE);
+  }
+
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int thread_count = cores > 0 ? cores : 1;
+
+  snprintf(msg, sizeof(msg), "Fingerprinting the files under %s on %u threads...", dir, thread_count);
+  display_msg(msg);
+
+  // The workers start on the first files while the walk is still finding the rest
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  unsigned int started = 0;
+
+  for(i = 0; i < thread_count; i++) {
+    if(pthread_create(&threads[started], NULL, dupes_worker, &batch) == 0) {started++;}
+  }
+
+  // Absolute, so a file is the same cache record whichever directory dupes was run from
+  char *full_dir = absolute_path(dir);
+  walk_tree(full_dir, SORT_NAME, NULL, add_path, &batch);
+  free(full_dir);
+
+  pthread_mutex_lock(&batch.lock);
+  batch.listed = true;
+  pthread_cond_broadcast(&batch.cond);
+  pthread_mutex_unlock(&batch.lock);
+
+  if(batch.count > 0 && started == 0) {dupes_worker(&batch);}
+
+  // Say how far along it is every so often, a big library takes minutes
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += DUPES_PROGRESS_SECONDS;
+  for(i = 0; i < started; i++) {
+    while(pthread_timedjoin_np(threads[i], NULL, &deadline) == ETIMEDOUT) {
+      pthread_mutex_lock(&batch.lock);
+      snprintf(msg, sizeof(msg), "Fingerprinted %u of %u files", batch.done, batch.count);
+      pthread_mutex_unlock(&batch.lock);
+      display_msg(msg);
+      deadline.tv_sec += DUPES_PROGRESS_SECONDS;
+    }
+  }
+  free(threads);
+
+  pthread_cond_destroy(&batch.cond);
+  pthread_mutex_destroy(&batch.lock);
+
+  if(batch.count == 0) {
+    display_msg("No audio files there.");
+    free_cache(&batch.cache);
+    free(cache_file);
+    atomic_store(&dupes_running, false);
+    return;
+  }
+
+  double print_seconds = elapsed_ms(&start) / 1000.0;
+  unsigned int failed = 0;
+  unsigned int fresh = 0;
+  for(i = 0; i < batch.count; i++) {
+    if(batch.state[i] == PRINT_FAILED) {failed++;}
+    if(batch.state[i] == PRINT_NEW) {fresh++;}
+  }
+
+  if(cache_file) {save_cache(&batch, cache_file);}
+
+  struct timespec index_start;
+  clock_gettime(CLOCK_MONOTONIC, &index_start);
+
+  uint32_t *parent = mem_alloc(MEM_CACHE, batch.count * sizeof(uint32_t));
+  group_prints(&batch, parent);
+  double index_ms = elapsed_ms(&index_start);
+
+  report_groups(&batch, parent, &group_count, &track_count);
+
+  snprintf(msg, sizeof(msg), "%u files: %u fingerprinted in %.1f s on %u threads, %u from the cache, %u unreadable or under %d s. %u duplicate groups, %u files, found in %.0f ms",
+           batch.count, fresh, print_seconds, started ? started : 1, batch.cached, failed, DUPES_MIN_SECONDS, group_count, track_count, index_ms);
+  display_msg(msg);
+
+  mem_free(parent);
+  mem_free(batch.prints);
+  mem_free(batch.state);
+  free_cache(&batch.cache);
+  free(cache_file);
+
+  for(i = 0; i < batch.count; i++) {
+    free(batch.paths[i]);
+  }
+  free(batch.paths);
+
+  atomic_store(&dupes_running, false);
+  return;
+}
@@ -24,7 +24,6 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <string.h>
 #include <AL/al.h>
 #include <libavutil/error.h>
-#include <ncurses.h>
 #include <errno.h>
 
 #include <error_codes.h>
@@ -44,7 +43,6 @@ void trackjack_error(int error, LIB_ERROR liberr) {
   switch(error) {
     case JACK_ERR_DECODER:
       display_msg("TJ_ERR: Failed to load file.");
-      move(0, 0);
       break;
     case JACK_ERR_BUFFERGEN:
       char msg[] = "TJ_ERR: Failed to create or fill audio buffer --- openAL message: ";
@@ -54,7 +52,6 @@ void trackjack_error(int error, LIB_ERROR liberr) {
       sprintf(final_msg, "%s%s", msg, al_msg);
       display_msg(final_msg);
       free(final_msg);
-      move(0, 0);
       break;
     case JACK_ERR_LIBAV_MSG:
       char msg2[] = "FFMPEG: ";
@@ -64,7 +61,6 @@ void trackjack_error(int error, LIB_ERROR liberr) {
       sprintf(final_msg, "%s%s", msg2, av_msg);
       display_msg(final_msg);
       free(final_msg);
-      move(0, 0);
       break;
     case JACK_ERR_OPENDIR:
       display_msg("TJ_ERR: Failed to open directory. --- errno: ");
@@ -74,6 +70,12 @@ void trackjack_error(int error, LIB_ERROR liberr) {
     case JACK_ERR_PLAYBACK_SOURCE_PREP:
       display_msg("TJ_ERR: Failed to prep audio source for playback.");
       break;
+    case JACK_ERR_AUDIO_DEVICE:
+      display_msg("TJ_ERR: Failed to open the audio device. Nothing can be played.");
+      break;
+    case JACK_ERR_CONTROL_SOCKET:
+      display_msg("TJ_ERR: Failed to open the control socket. Trackjack can only be used from this terminal.");
+      break;
   }
 
   return;
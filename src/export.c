@@ -0,0 +1,405 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <audio_source.h>
+#include <export.h>
+#include <fs_util.h>
+#include <mem.h>
+#include <ui.h>
+
+
+// PCM is collected in a buffer this big and written out in one go, so every write but the
+// last is a full, aligned megabyte at an aligned offset
+#define EXPORT_WRITE_BUFFER (1024 * 1024)
+#define EXPORT_ALIGNMENT 4096
+
+#define CONTAINER_WAV 0
+#define CONTAINER_RAW 1
+
+
+struct export_job {
+  char *src;
+  char *dst;
+};
+
+struct export_batch {
+  struct export_job *jobs;
+  unsigned int count;
+  unsigned int capacity;
+
+  int container;
+  int sample_format;
+  int rate;
+
+  atomic_uint next;
+  atomic_uint failed;
+  atomic_uint_fast64_t audio_us;
+};
+
+
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+static void make_parent_dirs(const char *path) {
+  char *copy = strdup(path);
+  char *slash = copy;
+
+  while((slash = strchr(slash + 1, '/'))) {
+    *slash = 0;
+    mkdir(copy, 0755);
+    *slash = '/';
+  }
+
+  free(copy);
+  return;
+}
+
+
+
+static void add_job(struct export_batch *batch, const char *src, const char *dst_base, const char *extension) {
+  if(batch->count == batch->capacity) {
+    batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+    batch->jobs = realloc(batch->jobs, batch->capacity * sizeof(struct export_job));
+  }
+
+  // Swap the source's extension for ours
+  const char *dot = strrchr(dst_base, '.');
+  const char *slash = strrchr(dst_base, '/');
+  size_t stem = (dot && (slash == NULL || dot > slash)) ? (size_t)(dot - dst_base) : strlen(dst_base);
+
+  char *dst = malloc(stem + strlen(extension) + 2);
+  sprintf(dst, "%.*s.%s", (int)stem, dst_base, extension);
+
+  batch->jobs[batch->count].src = strdup(src);
+  batch->jobs[batch->count].dst = dst;
+  batch->count++;
+
+  return;
+}
+
+
+// Mirrors the tree under src_dir into dst_dir
+static void collect_jobs(struct export_batch *batch, const char *src_dir, const char *dst_dir, const char *extension) {
+  DIR *handle = opendir(src_dir);
+  struct dirent *entry;
+
+  if(handle == NULL) {return;}
+
+  while((entry = readdir(handle))) {
+    if(entry->d_name[0] == '.') {continue;}
+    if(entry->d_type != DT_DIR && !is_audio_filename(entry->d_name)) {continue;}
+
+    char *src = malloc(strlen(src_dir) + strlen(entry->d_name) + 2);
+    char *dst = malloc(strlen(dst_dir) + strlen(entry->d_name) + 2);
+    sprintf(src, "%s/%s", src_dir, entry->d_name);
+    sprintf(dst, "%s/%s", dst_dir, entry->d_name);
+
+    if(entry->d_type == DT_DIR) {collect_jobs(batch, src, dst, extension);}
+    else {add_job(batch, src, dst, extension);}
+
+    free(src);
+    free(dst);
+  }
+
+  closedir(handle);
+  return;
+}
+
+
+
+// Also used by the loopback renderer, which writes the same kind of file
+void write_wav_header(int fd, int sample_format, uint32_t rate, int channels, uint64_t data_bytes) {
+  uint8_t header[WAV_HEADER_SIZE];
+  int bytes_per_sample = sample_format == SAMPLE_S16 ? 2 : 4;
+  uint32_t byte_rate = rate * channels * bytes_per_sample;
+  uint16_t block_align = channels * bytes_per_sample;
+  uint16_t bits = bytes_per_sample * 8;
+  uint16_t format_tag = sample_format == SAMPLE_S16 ? 1 : 3;
+  uint16_t channel_count = channels;
+  uint32_t fmt_size = 16;
+  uint32_t data_size = data_bytes > UINT32_MAX - WAV_HEADER_SIZE ? UINT32_MAX - WAV_HEADER_SIZE : data_bytes;
+  uint32_t riff_size = data_size + WAV_HEADER_SIZE - 8;
+
+  // WAV is little endian, as is everything this runs on
+  memcpy(header, "RIFF", 4);
+  memcpy(header + 4, &riff_size, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  memcpy(header + 16, &fmt_size, 4);
+  memcpy(header + 20, &format_tag, 2);
+  memcpy(header + 22, &channel_count, 2);
+  memcpy(header + 24, &rate, 4);
+  memcpy(header + 28, &byte_rate, 4);
+  memcpy(header + 32, &block_align, 2);
+  memcpy(header + 34, &bits, 2);
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &data_size, 4);
+
+  pwrite(fd, header, WAV_HEADER_SIZE, 0);
+  return;
+}
+
+
+static int flush_buffer(int fd, uint8_t *buffer, size_t length) {
+  size_t written = 0;
+  ssize_t ret;
+
+  while(written < length) {
+    ret = write(fd, buffer + written, length - written);
+    if(ret < 0) {
+      if(errno == EINTR) {continue;}
+      return -1;
+    }
+    written += ret;
+  }
+
+  return 0;
+}
+
+
+static int export_one(struct export_batch *batch, struct export_job *job, uint8_t *buffer) {
+  AUDIO_SOURCE *song = new_audio_source(job->src);
+  if(song == NULL) {return -1;}
+
+  if(prep_audio_source_rate(song, batch->rate) < 0) {
+    free_audio_source(song);
+    return -1;
+  }
+
+  make_parent_dirs(job->dst);
+  int fd = open(job->dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd < 0) {
+    free_audio_source(song);
+    return -1;
+  }
+
+  int channels = song->track_data.channels;
+  int rate = song->track_data.output_rate;
+  size_t fill = 0;
+  uint64_t data_bytes = 0;
+  uint8_t *chunk;
+  int chunk_size;
+  bool flushed = false;
+  int ret = 0;
+
+  // Room for the header is left at the front and filled in once the length is known
+  if(batch->container == CONTAINER_WAV) {
+    memset(buffer, 0, WAV_HEADER_SIZE);
+    fill = WAV_HEADER_SIZE;
+  }
+
+  while(ret == 0) {
+    if((chunk = decode_chunk(song, &chunk_size)) == NULL) {
+      if(flushed || (chunk = flush_chunk(song, &chunk_size)) == NULL) {break;}
+      flushed = true;
+    }
+
+    float *pcm = (float *)chunk;
+    int samples = chunk_size / sizeof(float);
+    int i = 0;
+
+    while(i < samples) {
+      if(batch->sample_format == SAMPLE_S16) {
+        int16_t *out = (int16_t *)(buffer + fill);
+        int room = (EXPORT_WRITE_BUFFER - fill) / sizeof(int16_t);
+        int n = samples - i < room ? samples - i : room;
+        int j;
+
+        for(j = 0; j < n; j++) {
+          float value = pcm[i + j] * 32767.0f;
+          if(value > 32767.0f) {value = 32767.0f;}
+          if(value < -32768.0f) {value = -32768.0f;}
+          out[j] = lrintf(value);
+        }
+
+        i += n;
+        fill += n * sizeof(int16_t);
+        data_bytes += n * sizeof(int16_t);
+      }
+      else {
+        int room = (EXPORT_WRITE_BUFFER - fill) / sizeof(float);
+        int n = samples - i < room ? samples - i : room;
+
+        memcpy(buffer + fill, pcm + i, n * sizeof(float));
+
+        i += n;
+        fill += n * sizeof(float);
+        data_bytes += n * sizeof(float);
+      }
+
+      if(fill == EXPORT_WRITE_BUFFER) {
+        if(flush_buffer(fd, buffer, fill) != 0) {
+          ret = -1;
+          break;
+        }
+        fill = 0;
+      }
+    }
+
+    mem_free(chunk);
+  }
+
+  if(ret == 0 && fill > 0) {ret = flush_buffer(fd, buffer, fill);}
+  if(ret == 0 && batch->container == CONTAINER_WAV) {
+    // Going back for the header once at the end doesn't break up the sequential run
+    write_wav_header(fd, batch->sample_format, rate, channels, data_bytes);
+  }
+
+  close(fd);
+
+  int bytes_per_frame = channels * (batch->sample_format == SAMPLE_S16 ? 2 : 4);
+  atomic_fetch_add(&batch->audio_us, (data_bytes / bytes_per_frame) * 1000000 / rate);
+
+  free_audio_source(song);
+  return ret;
+}
+
+
+static void *export_worker(void *data) {
+  struct export_batch *batch = data;
+  uint8_t *buffer;
+  unsigned int index;
+
+  if(posix_memalign((void **)&buffer, EXPORT_ALIGNMENT, EXPORT_WRITE_BUFFER) != 0) {return NULL;}
+
+  while((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+    if(export_one(batch, &batch->jobs[index], buffer) != 0) {
+      atomic_fetch_add(&batch->failed, 1);
+    }
+  }
+
+  free(buffer);
+  return NULL;
+}
+
+
+
+// export <src> <dst> [wav|raw] [rate] [f32|s16]
+// Decodes src (a file, or every audio file under a directory) to PCM in dst on one thread per core
+void export_cmd(char *args) {
+  struct export_batch batch = {0};
+  struct timespec start;
+  struct stat st;
+  char msg[160];
+  char *arg;
+  size_t i;
+
+  char *src = next_arg(&args);
+  char *dst = next_arg(&args);
+  if(src == NULL || dst == NULL) {
+    display_msg("Usage: export <src> <dst> [wav|raw] [rate] [f32|s16]");
+    return;
+  }
+
+  batch.container = CONTAINER_WAV;
+  batch.sample_format = SAMPLE_F32;
+  batch.rate = 0;
+
+  while((arg = next_arg(&args))) {
+    if(strcmp(arg, "wav") == 0) {batch.container = CONTAINER_WAV;}
+    else if(strcmp(arg, "raw") == 0) {batch.container = CONTAINER_RAW;}
+    else if(strcmp(arg, "f32") == 0) {batch.sample_format = SAMPLE_F32;}
+    else if(strcmp(arg, "s16") == 0) {batch.sample_format = SAMPLE_S16;}
+    else if(atoi(arg) > 0) {batch.rate = atoi(arg);}
+    else {
+      snprintf(msg, sizeof(msg), "Unknown export option '%s'", arg);
+      display_msg(msg);
+      return;
+    }
+  }
+
+  const char *extension = batch.container == CONTAINER_WAV ? "wav" : "raw";
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if(stat(src, &st) != 0) {
+    display_msg("TJ_ERR: Export source does not exist.");
+    return;
+  }
+
+  if(S_ISDIR(st.st_mode)) {
+    collect_jobs(&batch, src, dst, extension);
+  }
+  else if(stat(dst, &st) == 0 && S_ISDIR(st.st_mode)) {
+    const char *name = strrchr(src, '/');
+    char *dst_file = malloc(strlen(dst) + strlen(src) + 2);
+    sprintf(dst_file, "%s/%s", dst, name ? name + 1 : src);
+    add_job(&batch, src, dst_file, extension);
+    free(dst_file);
+  }
+  else {
+    add_job(&batch, src, dst, extension);
+  }
+
+  if(batch.count == 0) {
+    display_msg("Nothing to export.");
+    return;
+  }
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int thread_count = cores > 0 ? cores : 1;
+  if(thread_count > batch.count) {thread_count = batch.count;}
+
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  unsigned int started = 0;
+
+  for(i = 0; i < thread_count; i++) {
+    if(pthread_create(&threads[started], NULL, export_worker, &batch) == 0) {started++;}
+  }
+  if(started == 0) {export_worker(&batch);}
+
+  for(i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  double seconds = elapsed_ms(&start) / 1000.0;
+  double audio_seconds = atomic_load(&batch.audio_us) / 1000000.0;
+  unsigned int failed = atomic_load(&batch.failed);
+
+  snprintf(msg, sizeof(msg), "Exported %u of %u files, %.1f min of audio in %.1f s on %u threads, %.0fx realtime", batch.count - failed, batch.count, audio_seconds / 60, seconds, started ? started : 1, seconds > 0 ? audio_seconds / seconds : 0);
+  display_msg(msg);
+
+  for(i = 0; i < batch.count; i++) {
+    free(batch.jobs[i].src);
+    free(batch.jobs[i].dst);
+  }
+  free(batch.jobs);
+
+  return;
+}
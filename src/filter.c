@@ -0,0 +1,201 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <filter.h>
+#include <mem.h>
+
+
+// Fuzzy matching: a name matches if it contains the query's characters in order, ignoring case.
+//
+// Candidates are folded to lower case once and packed back to back, each with a bitmask of which
+// letters and digits it contains. A query character the mask doesn't have rejects the name with
+// a single AND, and the rest is a chain of memchr() calls, which glibc does with SIMD.
+// Results are kept per query length, so typing a character only rescans the previous matches
+// and backspace is free
+
+
+struct candidate {
+  uint32_t offset;
+  uint32_t length;
+  uint64_t mask;
+};
+
+// A matching candidate and the offset just past the matched characters. Taking the leftmost
+// occurrence of each character never rules out a match later on
+struct match {
+  uint32_t index;
+  uint32_t end;
+};
+
+
+static char *folded = NULL;
+static struct candidate *candidates = NULL;
+static unsigned int candidate_count = 0;
+
+// results[n] holds the matches for the first n characters of query, results[0] being everything
+static struct match *results[FILTER_MAX_QUERY + 1];
+static unsigned int result_counts[FILTER_MAX_QUERY + 1];
+static char query[FILTER_MAX_QUERY + 1];
+static int query_length = 0;
+
+
+
+static uint64_t char_bit(unsigned char c) {
+  if(c >= 'a' && c <= 'z') {return 1ULL << (c - 'a');}
+  if(c >= '0' && c <= '9') {return 1ULL << (26 + c - '0');}
+  if(c >= 0x80) {return 1ULL << 36;}
+  return 1ULL << (37 + c % 27);
+}
+
+
+void filter_clear(void) {
+  int i;
+
+  mem_free(folded);
+  mem_free(candidates);
+  folded = NULL;
+  candidates = NULL;
+  candidate_count = 0;
+
+  for(i = 0; i <= FILTER_MAX_QUERY; i++) {
+    mem_free(results[i]);
+    results[i] = NULL;
+    result_counts[i] = 0;
+  }
+  query_length = 0;
+
+  return;
+}
+
+
+// names only have to stay valid for the duration of this call
+void filter_set_candidates(const char **names, unsigned int count) {
+  size_t total = 0;
+  unsigned int i, j;
+
+  filter_clear();
+
+  for(i = 0; i < count; i++) {total += strlen(names[i]) + 1;}
+
+  folded = mem_alloc(MEM_LISTING, total ? total : 1);
+  candidates = mem_alloc(MEM_LISTING, (count ? count : 1) * sizeof(struct candidate));
+  results[0] = mem_alloc(MEM_LISTING, (count ? count : 1) * sizeof(struct match));
+
+  total = 0;
+  for(i = 0; i < count; i++) {
+    struct candidate *c = &candidates[i];
+    c->offset = total;
+    c->length = strlen(names[i]);
+    c->mask = 0;
+
+    for(j = 0; j < c->length; j++) {
+      unsigned char ch = tolower((unsigned char)names[i][j]);
+      folded[total + j] = ch;
+      c->mask |= char_bit(ch);
+    }
+    folded[total + c->length] = 0;
+    total += c->length + 1;
+
+    results[0][i].index = i;
+    results[0][i].end = 0;
+  }
+
+  candidate_count = count;
+  result_counts[0] = count;
+  return;
+}
+
+
+
+// Brings the result set up to date with new_query and returns how many candidates match
+unsigned int filter_update(const char *new_query) {
+  char q[FILTER_MAX_QUERY + 1];
+  int length = strlen(new_query);
+  size_t i;
+  int k;
+
+  if(length > FILTER_MAX_QUERY) {length = FILTER_MAX_QUERY;}
+  for(k = 0; k < length; k++) {q[k] = tolower((unsigned char)new_query[k]);}
+
+  // Everything up to the first changed character is still valid
+  int common = 0;
+  while(common < length && common < query_length && q[common] == query[common]) {common++;}
+
+  for(k = common + 1; k <= length; k++) {
+    uint64_t need = char_bit(q[k - 1]);
+    struct match *previous = results[k - 1];
+    unsigned int count = 0;
+
+    size_t size = (result_counts[k - 1] ? result_counts[k - 1] : 1) * sizeof(struct match);
+    results[k] = results[k] ? mem_realloc(results[k], size) : mem_alloc(MEM_LISTING, size);
+    struct match *current = results[k];
+
+    for(i = 0; i < result_counts[k - 1]; i++) {
+      struct candidate *c = &candidates[previous[i].index];
+      if((c->mask & need) == 0) {continue;}
+
+      const char *start = folded + c->offset;
+      const char *p = memchr(start + previous[i].end, q[k - 1], c->length - previous[i].end);
+      if(p == NULL) {continue;}
+
+      current[count].index = previous[i].index;
+      current[count].end = p - start + 1;
+      count++;
+    }
+
+    result_counts[k] = count;
+  }
+
+  memcpy(query, q, length);
+  query_length = length;
+
+  return result_counts[length];
+}
+
+
+unsigned int filter_result(unsigned int index) {
+  return results[query_length][index].index;
+}
+
+
+// Offsets of the characters in the candidate that the query matched, for highlighting.
+// positions needs room for strlen(q) entries, returns how many were filled
+int filter_positions(unsigned int index, const char *q, int *positions) {
+  struct candidate *c = &candidates[index];
+  const char *start = folded + c->offset;
+  const char *p = start;
+  const char *end = p + c->length;
+  int i;
+
+  for(i = 0; q[i] && i < FILTER_MAX_QUERY; i++) {
+    p = memchr(p, tolower((unsigned char)q[i]), end - p);
+    if(p == NULL) {break;}
+    positions[i] = p - start;
+    p++;
+  }
+
+  return i;
+}
@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+// Extensions worth handing to libavformat when picking files out of a directory by name
+static const char *audio_extensions[] = {
+  "flac", "mp3", "ogg", "oga", "opus", "wav", "m4a", "aac", "alac", "aif", "aiff", "wv", "ape", "mpc", "wma", NULL
+};
+
+
+// Paths that outlive the current directory are made absolute, because the file window chdir()s around.
+// Returns a malloc'd string
+char *absolute_path(const char *path) {
+  // URLs from playlists are handed to libavformat as they are
+  if(path[0] == '/' || strstr(path, "://")) {return strdup(path);}
+
+  char *cwd = getcwd(NULL, 0);
+  if(cwd == NULL) {return strdup(path);}
+  if(strcmp(path, ".") == 0) {return cwd;}
+
+  // "./name" is common enough from ui_open_dir(".") to be worth tidying up
+  if(path[0] == '.' && path[1] == '/') {path += 2;}
+
+  char *ret = malloc(strlen(cwd) + strlen(path) + 2);
+  sprintf(ret, "%s/%s", cwd, path);
+  free(cwd);
+
+  return ret;
+}
+
+
+bool is_audio_filename(const char *name) {
+  const char *extension = strrchr(name, '.');
+  int i;
+
+  if(extension == NULL) {return false;}
+  extension++;
+
+  for(i = 0; audio_extensions[i]; i++) {
+    if(strcasecmp(extension, audio_extensions[i]) == 0) {return true;}
+  }
+
+  return false;
+}
+
+
+// Where caches that outlive a run go: name under $XDG_CACHE_HOME/trackjack, or ~/.cache/trackjack.
+// The trackjack directory is created if needed, name itself isn't. Returns a malloc'd string, or NULL without a home
+char *cache_path(const char *name) {
+  const char *base = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char *ret;
+
+  if(base && *base) {
+    ret = malloc(strlen(base) + strlen(name) + 12);
+    mkdir(base, 0755);
+    sprintf(ret, "%s/trackjack", base);
+  }
+  else if(home) {
+    ret = malloc(strlen(home) + strlen(name) + 20);
+    sprintf(ret, "%s/.cache", home);
+    mkdir(ret, 0755);
+    sprintf(ret, "%s/.cache/trackjack", home);
+  }
+  else {return NULL;}
+
+  mkdir(ret, 0755);
+  strcat(ret, "/");
+  strcat(ret, name);
+
+  return ret;
+}
+
+
+// A hash of the path, size and modification time, so whatever is cached for a file
+// goes stale when it's re-ripped or retagged. 0 if the file can't be stat()ed
+uint64_t file_identity(const char *path) {
+  struct stat st;
+  uint64_t hash = 14695981039346656037ULL;
+  const uint8_t *p;
+  size_t i;
+
+  if(stat(path, &st) != 0) {return 0;}
+
+  for(p = (const uint8_t *)path; *p; p++) {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+
+  uint64_t extra[3] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+  for(i = 0; i < sizeof(extra); i++) {
+    hash = (hash ^ ((uint8_t *)extra)[i]) * 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+
+// Splits off the next space separated word of *args, which may be "quoted" to keep spaces in paths.
+// Commands that take several paths read their arguments with this, returns NULL when there are none left
+char *next_arg(char **args) {
+  char *p = *args;
+  char *ret;
+
+  while(*p == ' ') {p++;}
+  if(*p == 0) {return NULL;}
+
+  if(*p == '"') {
+    ret = ++p;
+    while(*p && *p != '"') {p++;}
+  }
+  else {
+    ret = p;
+    while(*p && *p != ' ') {p++;}
+  }
+
+  if(*p) {*p++ = 0;}
+  *args = p;
+
+  return ret;
+}
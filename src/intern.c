@@ -0,0 +1,211 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <intern.h>
+#include <mem.h>
+
+
+// Strings are packed back to back into blocks of this size, longer ones get a block to themselves
+#define INTERN_BLOCK_SIZE (64 * 1024)
+#define INTERN_MIN_SLOTS 1024
+
+
+struct intern_block {
+  struct intern_block *next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+struct intern_slot {
+  const char *string;
+  uint32_t hash;
+  uint32_t length;
+};
+
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct intern_block *blocks = NULL;
+static size_t block_bytes = 0;
+
+// Open addressing with linear probing, never more than half full
+static struct intern_slot *slots = NULL;
+static size_t slot_count = 0;
+static size_t string_count = 0;
+
+
+
+static uint32_t hash_string(const char *s, size_t length) {
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for(i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)s[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+static struct intern_slot *find_slot(const char *s, size_t length, uint32_t hash) {
+  size_t mask = slot_count - 1;
+  size_t i = hash & mask;
+
+  while(slots[i].string) {
+    if(slots[i].hash == hash && slots[i].length == length && memcmp(slots[i].string, s, length) == 0) {break;}
+    i = (i + 1) & mask;
+  }
+
+  return &slots[i];
+}
+
+
+static void grow_table(void) {
+  struct intern_slot *old = slots;
+  size_t old_count = slot_count;
+  size_t i;
+
+  slot_count = slot_count ? slot_count * 2 : INTERN_MIN_SLOTS;
+  slots = mem_calloc(MEM_META, slot_count, sizeof(struct intern_slot));
+
+  for(i = 0; i < old_count; i++) {
+    if(old[i].string == NULL) {continue;}
+
+    size_t j = old[i].hash & (slot_count - 1);
+    while(slots[j].string) {j = (j + 1) & (slot_count - 1);}
+    slots[j] = old[i];
+  }
+
+  mem_free(old);
+  return;
+}
+
+
+static char *store(const char *s, size_t length) {
+  struct intern_block *block = blocks;
+
+  if(block == NULL || block->size - block->used < length + 1) {
+    size_t size = length + 1 > INTERN_BLOCK_SIZE ? length + 1 : INTERN_BLOCK_SIZE;
+    block = mem_alloc(MEM_META, sizeof(struct intern_block) + size);
+    block->used = 0;
+    block->size = size;
+
+    // An oversized block goes behind the current one, which may still have room
+    if(blocks && size > INTERN_BLOCK_SIZE) {
+      block->next = blocks->next;
+      blocks->next = block;
+    }
+    else {
+      block->next = blocks;
+      blocks = block;
+    }
+    block_bytes += sizeof(struct intern_block) + size;
+  }
+
+  char *ret = block->data + block->used;
+  memcpy(ret, s, length);
+  ret[length] = 0;
+  block->used += length + 1;
+
+  return ret;
+}
+
+
+
+const char *intern_n(const char *s, size_t length) {
+  if(s == NULL) {return NULL;}
+
+  uint32_t hash = hash_string(s, length);
+
+  pthread_mutex_lock(&intern_lock);
+  if((string_count + 1) * 2 > slot_count) {grow_table();}
+
+  struct intern_slot *slot = find_slot(s, length, hash);
+  if(slot->string == NULL) {
+    slot->string = store(s, length);
+    slot->hash = hash;
+    slot->length = length;
+    string_count++;
+  }
+
+  const char *ret = slot->string;
+  pthread_mutex_unlock(&intern_lock);
+
+  return ret;
+}
+
+
+const char *intern(const char *s) {
+  if(s == NULL) {return NULL;}
+  return intern_n(s, strlen(s));
+}
+
+
+// Like intern(), but never adds the string. NULL if it was never interned
+const char *intern_find(const char *s) {
+  const char *ret = NULL;
+  if(s == NULL) {return NULL;}
+
+  size_t length = strlen(s);
+  uint32_t hash = hash_string(s, length);
+
+  pthread_mutex_lock(&intern_lock);
+  if(slot_count > 0) {ret = find_slot(s, length, hash)->string;}
+  pthread_mutex_unlock(&intern_lock);
+
+  return ret;
+}
+
+
+
+void intern_stats(size_t *strings, size_t *bytes) {
+  pthread_mutex_lock(&intern_lock);
+  *strings = string_count;
+  *bytes = block_bytes + slot_count * sizeof(struct intern_slot);
+  pthread_mutex_unlock(&intern_lock);
+  return;
+}
+
+
+// Only once nothing holds on to an interned string any more
+void intern_cleanup(void) {
+  pthread_mutex_lock(&intern_lock);
+
+  while(blocks) {
+    struct intern_block *next = blocks->next;
+    mem_free(blocks);
+    blocks = next;
+  }
+
+  mem_free(slots);
+  slots = NULL;
+  slot_count = 0;
+  string_count = 0;
+  block_bytes = 0;
+
+  pthread_mutex_unlock(&intern_lock);
+  return;
+}
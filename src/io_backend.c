@@ -0,0 +1,460 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <liburing.h>
+
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+#include <io_backend.h>
+
+
+// Size of the buffer libavformat reads into through our callbacks
+#define AVIO_BUFFER_SIZE 65536
+
+// How far ahead of the read position the mmap backend asks the kernel to page in
+#define MMAP_WILLNEED_WINDOW (2 * 1024 * 1024)
+
+// A file changed this recently may still be being written, a download or a rip in progress.
+// The mmap backend leaves those to libavformat's own reader, see mmap_setup()
+#define MMAP_SETTLE_SECONDS 10
+
+// io_uring keeps this many blocks in flight ahead of the read position
+#define URING_QUEUE_DEPTH 8
+#define URING_BLOCK_SIZE (128 * 1024)
+
+
+struct uring_block {
+  int64_t offset;
+  int length;
+  bool in_flight;
+  uint8_t *data;
+};
+
+struct io_handle {
+  int backend;
+  int fd;
+  int64_t size;
+  int64_t pos;
+  AVIOContext *avio;
+
+  // mmap backend
+  uint8_t *map;
+  int64_t advised_to;
+
+  // io_uring backend
+  // blocks[head] always covers window_start, the following blocks cover the rest of the window in order
+  struct io_uring ring;
+  struct uring_block blocks[URING_QUEUE_DEPTH];
+  uint8_t *block_memory;
+  unsigned int head;
+  int64_t window_start;
+};
+
+
+static struct {
+  atomic_uint_fast64_t bytes;
+  atomic_uint_fast64_t reads;
+  atomic_uint_fast64_t wait_ns;
+} backend_stats[MAX_IO_BACKEND + 1];
+
+static const char *backend_names[] = {"libav", "mmap", "uring"};
+
+static volatile int selected_backend = IO_BACKEND_MMAP;
+
+static long page_size = 0;
+
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void account_read(int backend, int bytes, uint64_t wait_ns) {
+  atomic_fetch_add_explicit(&backend_stats[backend].bytes, bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&backend_stats[backend].reads, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&backend_stats[backend].wait_ns, wait_ns, memory_order_relaxed);
+  return;
+}
+
+
+
+static int mmap_read(void *opaque, uint8_t *buf, int buf_size) {
+  IO_HANDLE *io = opaque;
+  int64_t remaining = io->size - io->pos;
+
+  if(remaining <= 0) {return AVERROR_EOF;}
+  if(buf_size > remaining) {buf_size = remaining;}
+
+  // Start paging in the next window before the copy gets there,
+  // so on cold storage the copy below mostly hits pages that are already on their way
+  if(io->pos + buf_size > io->advised_to && io->advised_to < io->size) {
+    int64_t length = MMAP_WILLNEED_WINDOW;
+    if(io->advised_to + length > io->size) {length = io->size - io->advised_to;}
+
+    madvise(io->map + io->advised_to, length, MADV_WILLNEED);
+    io->advised_to += length;
+  }
+
+  // Any page fault stalls happen inside the copy, so timing it gives us the wait
+  uint64_t start = now_ns();
+  memcpy(buf, io->map + io->pos, buf_size);
+  account_read(IO_BACKEND_MMAP, buf_size, now_ns() - start);
+
+  io->pos += buf_size;
+  return buf_size;
+}
+
+
+// Known limitation: the mapping is only as long as the file was when it was opened. If the file
+// is truncated while playing, touching the pages past its new end raises SIGBUS. Files that
+// look like they're still being written are refused for that reason, but a file cut short
+// long after it was finished will still take the player down
+static int mmap_setup(IO_HANDLE *io, const struct stat *st) {
+  if(io->size == 0) {return -1;}
+  if(time(NULL) - st->st_mtime < MMAP_SETTLE_SECONDS) {return -1;}
+
+  io->map = mmap(NULL, io->size, PROT_READ, MAP_PRIVATE, io->fd, 0);
+  if(io->map == MAP_FAILED) {
+    io->map = NULL;
+    return -1;
+  }
+
+  madvise(io->map, io->size, MADV_SEQUENTIAL);
+  io->advised_to = 0;
+
+  return 0;
+}
+
+
+
+static void uring_wait_block(IO_HANDLE *io, struct uring_block *block) {
+  struct io_uring_cqe *cqe;
+  int ret;
+
+  while(block->in_flight) {
+    ret = io_uring_wait_cqe(&io->ring, &cqe);
+    if(ret == -EINTR) {continue;}
+    if(ret < 0) {
+      block->in_flight = false;
+      block->length = ret;
+      return;
+    }
+
+    // Completions arrive in any order, so whichever block this is gets marked done
+    struct uring_block *done = io_uring_cqe_get_data(cqe);
+    done->length = cqe->res;
+    done->in_flight = false;
+    io_uring_cqe_seen(&io->ring, cqe);
+  }
+
+  return;
+}
+
+
+static void uring_queue_block(IO_HANDLE *io, struct uring_block *block, int64_t offset) {
+  block->offset = offset;
+  block->length = 0;
+
+  if(offset >= io->size) {return;}
+
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&io->ring);
+  if(sqe == NULL) {
+    // Ring is full, which shouldn't happen since it is sized to the queue depth.
+    // Read synchronously rather than stall
+    block->length = pread(io->fd, block->data, URING_BLOCK_SIZE, offset);
+    if(block->length < 0) {block->length = -errno;}
+    return;
+  }
+
+  io_uring_prep_read(sqe, io->fd, block->data, URING_BLOCK_SIZE, offset);
+  io_uring_sqe_set_data(sqe, block);
+  block->in_flight = true;
+
+  return;
+}
+
+
+static void uring_reset_window(IO_HANDLE *io) {
+  int i;
+
+  // Buffers can't be reused while the kernel may still be writing into them
+  for(i = 0; i < URING_QUEUE_DEPTH; i++) {
+    uring_wait_block(io, &io->blocks[i]);
+  }
+
+  io->head = 0;
+  io->window_start = io->pos - (io->pos % URING_BLOCK_SIZE);
+
+  for(i = 0; i < URING_QUEUE_DEPTH; i++) {
+    uring_queue_block(io, &io->blocks[i], io->window_start + (int64_t)i * URING_BLOCK_SIZE);
+  }
+  io_uring_submit(&io->ring);
+
+  return;
+}
+
+
+static void uring_advance_window(IO_HANDLE *io) {
+  struct uring_block *block = &io->blocks[io->head];
+
+  uring_wait_block(io, block);
+  uring_queue_block(io, block, io->window_start + (int64_t)URING_QUEUE_DEPTH * URING_BLOCK_SIZE);
+  io_uring_submit(&io->ring);
+
+  io->window_start += URING_BLOCK_SIZE;
+  io->head = (io->head + 1) % URING_QUEUE_DEPTH;
+
+  return;
+}
+
+
+static int uring_read(void *opaque, uint8_t *buf, int buf_size) {
+  IO_HANDLE *io = opaque;
+
+  if(io->pos >= io->size) {return AVERROR_EOF;}
+
+  if(io->pos < io->window_start || io->pos >= io->window_start + (int64_t)URING_QUEUE_DEPTH * URING_BLOCK_SIZE) {
+    uring_reset_window(io);
+  }
+
+  // Recycle every block that is fully behind the read position for the far end of the window
+  while(io->pos >= io->window_start + URING_BLOCK_SIZE) {
+    uring_advance_window(io);
+  }
+
+  struct uring_block *block = &io->blocks[io->head];
+  uint64_t wait = 0;
+
+  if(block->in_flight) {
+    uint64_t start = now_ns();
+    uring_wait_block(io, block);
+    wait = now_ns() - start;
+  }
+
+  int64_t block_pos = io->pos - block->offset;
+
+  while(block->length >= 0 && block_pos >= block->length) {
+    // Short read in the middle of the file. Rare on regular files, just finish it synchronously
+    uint64_t start = now_ns();
+    int ret = pread(io->fd, block->data + block->length, URING_BLOCK_SIZE - block->length, block->offset + block->length);
+    wait += now_ns() - start;
+    if(ret <= 0) {return ret == 0 ? AVERROR_EOF : AVERROR(errno);}
+    block->length += ret;
+  }
+
+  if(block->length < 0) {return AVERROR(-block->length);}
+
+  int available = block->length - block_pos;
+  if(buf_size > available) {buf_size = available;}
+
+  memcpy(buf, block->data + block_pos, buf_size);
+  account_read(IO_BACKEND_URING, buf_size, wait);
+
+  io->pos += buf_size;
+  return buf_size;
+}
+
+
+static int uring_setup(IO_HANDLE *io) {
+  int i;
+
+  if(io_uring_queue_init(URING_QUEUE_DEPTH, &io->ring, 0) < 0) {return -1;}
+
+  if(posix_memalign((void **)&io->block_memory, 4096, (size_t)URING_QUEUE_DEPTH * URING_BLOCK_SIZE) != 0) {
+    io_uring_queue_exit(&io->ring);
+    return -1;
+  }
+
+  for(i = 0; i < URING_QUEUE_DEPTH; i++) {
+    io->blocks[i].data = io->block_memory + (size_t)i * URING_BLOCK_SIZE;
+    io->blocks[i].in_flight = false;
+  }
+
+  uring_reset_window(io);
+
+  return 0;
+}
+
+
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence) {
+  IO_HANDLE *io = opaque;
+  int64_t new_pos;
+
+  if(whence & AVSEEK_SIZE) {return io->size;}
+
+  switch(whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      new_pos = offset;
+      break;
+    case SEEK_CUR:
+      new_pos = io->pos + offset;
+      break;
+    case SEEK_END:
+      new_pos = io->size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+
+  if(new_pos < 0) {return AVERROR(EINVAL);}
+  io->pos = new_pos;
+
+  // The io_uring window moves itself on the next read.
+  // The mmap readahead window has to be pulled along here
+  if(io->backend == IO_BACKEND_MMAP && (new_pos > io->advised_to || new_pos + MMAP_WILLNEED_WINDOW < io->advised_to)) {
+    io->advised_to = new_pos - (new_pos % page_size);
+  }
+
+  return new_pos;
+}
+
+
+
+
+IO_HANDLE *io_open(const char *filename, int backend) {
+  struct stat st;
+
+  if(backend == IO_BACKEND_LIBAV || backend > MAX_IO_BACKEND) {return NULL;}
+  if(page_size == 0) {page_size = sysconf(_SC_PAGESIZE);}
+
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return NULL;}
+
+  // Pipes, devices and the like are left to libavformat
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+
+  IO_HANDLE *io = calloc(1, sizeof(IO_HANDLE));
+  if(io == NULL) {
+    close(fd);
+    return NULL;
+  }
+  io->fd = fd;
+  io->size = st.st_size;
+
+  int (*read_fn)(void *, uint8_t *, int) = mmap_read;
+  io->backend = IO_BACKEND_MMAP;
+
+  // Kernels without io_uring (or with it disabled) fall back to mmap
+  if(backend == IO_BACKEND_URING && uring_setup(io) == 0) {
+    io->backend = IO_BACKEND_URING;
+    read_fn = uring_read;
+  }
+  else if(mmap_setup(io, &st) != 0) {
+    close(fd);
+    free(io);
+    return NULL;
+  }
+
+  unsigned char *avio_buffer = av_malloc(AVIO_BUFFER_SIZE);
+  if(avio_buffer) {io->avio = avio_alloc_context(avio_buffer, AVIO_BUFFER_SIZE, 0, io, read_fn, NULL, io_seek);}
+
+  if(io->avio == NULL) {
+    av_free(avio_buffer);
+    io_close(io);
+    return NULL;
+  }
+
+  return io;
+}
+
+
+struct AVIOContext *io_avio_context(IO_HANDLE *io) {
+  return io->avio;
+}
+
+
+void io_close(IO_HANDLE *io) {
+  int i;
+
+  if(io->avio) {
+    // libavformat may have swapped the buffer out for one of its own, so free whatever is there now
+    av_freep(&io->avio->buffer);
+    avio_context_free(&io->avio);
+  }
+
+  if(io->backend == IO_BACKEND_URING) {
+    for(i = 0; i < URING_QUEUE_DEPTH; i++) {
+      uring_wait_block(io, &io->blocks[i]);
+    }
+    io_uring_queue_exit(&io->ring);
+    free(io->block_memory);
+  }
+
+  if(io->map) {munmap(io->map, io->size);}
+  close(io->fd);
+
+  free(io);
+  return;
+}
+
+
+
+int io_set_backend(int backend) {
+  if(backend < 0 || backend > MAX_IO_BACKEND) {return 1;}
+  selected_backend = backend;
+  return 0;
+}
+
+int io_get_backend(void) {
+  return selected_backend;
+}
+
+
+int io_backend_from_name(const char *name) {
+  int i;
+  for(i = 0; i <= MAX_IO_BACKEND; i++) {
+    if(strcmp(name, backend_names[i]) == 0) {return i;}
+  }
+
+  return -1;
+}
+
+const char *io_backend_name(int backend) {
+  if(backend < 0 || backend > MAX_IO_BACKEND) {return "unknown";}
+  return backend_names[backend];
+}
+
+
+void io_read_stats(int backend, struct io_stats *out) {
+  out->bytes = atomic_load_explicit(&backend_stats[backend].bytes, memory_order_relaxed);
+  out->reads = atomic_load_explicit(&backend_stats[backend].reads, memory_order_relaxed);
+  out->wait_ns = atomic_load_explicit(&backend_stats[backend].wait_ns, memory_order_relaxed);
+  return;
+}
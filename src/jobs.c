@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <jobs.h>
+#include <ui.h>
+
+
+void parse_cmd(char *command);
+
+
+struct job {
+  void (*fn)(char *);
+  char *arg;
+};
+
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_done = PTHREAD_COND_INITIALIZER;
+static int running_jobs = 0;
+
+// Set on job threads, so work started from inside a job runs inline instead of spawning again
+static __thread bool in_job = false;
+
+
+
+static void *job_thread(void *data) {
+  struct job *job = data;
+
+  in_job = true;
+  job->fn(job->arg);
+
+  free(job->arg);
+  free(job);
+
+  pthread_mutex_lock(&jobs_lock);
+  running_jobs--;
+  pthread_cond_broadcast(&jobs_done);
+  pthread_mutex_unlock(&jobs_lock);
+
+  return NULL;
+}
+
+
+static void spawn(void (*fn)(char *), const char *arg) {
+  pthread_t thread;
+  struct job *job = malloc(sizeof(struct job));
+  job->fn = fn;
+  job->arg = strdup(arg);
+
+  pthread_mutex_lock(&jobs_lock);
+  running_jobs++;
+  pthread_mutex_unlock(&jobs_lock);
+
+  if(pthread_create(&thread, NULL, job_thread, job) != 0) {
+    // Couldn't get a thread, do the work here instead
+    pthread_mutex_lock(&jobs_lock);
+    running_jobs--;
+    pthread_mutex_unlock(&jobs_lock);
+
+    fn(job->arg);
+    free(job->arg);
+    free(job);
+    return;
+  }
+
+  pthread_detach(thread);
+  return;
+}
+
+
+// Long running commands (scans, exports...) go through here.
+// With the terminal UI they get their own thread so the UI keeps going.
+// Headless they run inline, and a script backgrounds them explicitly with job_run_cmd() instead
+void job_run(void (*fn)(char *), const char *arg) {
+  if(in_job || ui_is_headless()) {
+    char *copy = strdup(arg);
+    fn(copy);
+    free(copy);
+    return;
+  }
+
+  spawn(fn, arg);
+  return;
+}
+
+
+// Runs a whole command line on its own thread
+void job_run_cmd(const char *command) {
+  spawn(parse_cmd, command);
+  return;
+}
+
+
+void jobs_wait(void) {
+  pthread_mutex_lock(&jobs_lock);
+  while(running_jobs > 0) {
+    pthread_cond_wait(&jobs_done, &jobs_lock);
+  }
+  pthread_mutex_unlock(&jobs_lock);
+
+  return;
+}
+
+
+int jobs_running(void) {
+  return running_jobs;
+}
@@ -0,0 +1,344 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <library.h>
+#include <track_meta.h>
+#include <sort.h>
+#include <queue.h>
+#include <mem.h>
+
+
+// An index of the tag cache for the tag browser. Every level is a slice of a sorted id array,
+// so listing the albums of an artist or the tracks of an album is a lookup, not a search
+struct library_track {
+  const char *path;
+  struct track_meta meta;
+  uint32_t artist_rank;
+  uint32_t album_rank;
+};
+
+struct library_album {
+  const char *name;
+  uint16_t year;
+  uint32_t first;
+  uint32_t count;
+};
+
+struct library_artist {
+  const char *name;
+  uint32_t first;
+  uint32_t count;
+};
+
+struct ranked_string {
+  const char *string;
+  unsigned char *key;
+  size_t key_length;
+  uint32_t rank;
+};
+
+
+static struct library_track *tracks = NULL;
+static unsigned int track_count = 0;
+
+// Track ids grouped by album, each album's in disc and track order. Albums point into it
+static uint32_t *track_order = NULL;
+
+static struct library_album *albums = NULL;
+static unsigned int album_count = 0;
+
+// Album ids grouped by artist, each artist's by year. Artists point into it
+static uint32_t *album_order = NULL;
+
+// In name order, so an artist's id is also its row
+static struct library_artist *artists = NULL;
+static unsigned int artist_count = 0;
+
+
+
+static int compare_pointers(const void *a, const void *b) {
+  const struct ranked_string *x = a;
+  const struct ranked_string *y = b;
+
+  if(x->string == y->string) {return 0;}
+  return (uintptr_t)x->string < (uintptr_t)y->string ? -1 : 1;
+}
+
+
+// Missing tags (NULL) go last
+static int compare_keys(const void *a, const void *b) {
+  const struct ranked_string *x = a;
+  const struct ranked_string *y = b;
+
+  if(x->key == NULL || y->key == NULL) {return (x->key == NULL) - (y->key == NULL);}
+
+  size_t length = x->key_length < y->key_length ? x->key_length : y->key_length;
+  int ret = memcmp(x->key, y->key, length);
+  if(ret != 0) {return ret;}
+  if(x->key_length != y->key_length) {return x->key_length < y->key_length ? -1 : 1;}
+
+  return strcmp(x->string, y->string);
+}
+
+
+// Turns count interned strings into their positions in natural sort order, ranks[i] for strings[i].
+// Strings are interned, so equal ones are the same pointer and each only needs one collation key
+static void rank_strings(const char **strings, unsigned int count, uint32_t *ranks) {
+  struct ranked_string *sorted = mem_alloc(MEM_CACHE, (count ? count : 1) * sizeof(struct ranked_string));
+  unsigned int i, distinct = 0;
+
+  for(i = 0; i < count; i++) {sorted[i].string = strings[i];}
+  qsort(sorted, count, sizeof(struct ranked_string), compare_pointers);
+
+  for(i = 0; i < count; i++) {
+    if(distinct > 0 && sorted[distinct - 1].string == sorted[i].string) {continue;}
+    sorted[distinct++].string = sorted[i].string;
+  }
+
+  for(i = 0; i < distinct; i++) {
+    sorted[i].key = sorted[i].string ? collation_key(sorted[i].string, &sorted[i].key_length) : NULL;
+  }
+  qsort(sorted, distinct, sizeof(struct ranked_string), compare_keys);
+
+  for(i = 0; i < distinct; i++) {
+    sorted[i].rank = i;
+    free(sorted[i].key);
+  }
+
+  // Back in pointer order, for the lookups
+  qsort(sorted, distinct, sizeof(struct ranked_string), compare_pointers);
+
+  for(i = 0; i < count; i++) {
+    struct ranked_string wanted = {.string = strings[i]};
+    struct ranked_string *found = bsearch(&wanted, sorted, distinct, sizeof(struct ranked_string), compare_pointers);
+    ranks[i] = found->rank;
+  }
+
+  mem_free(sorted);
+  return;
+}
+
+
+static int compare_tracks(const void *a, const void *b) {
+  const struct library_track *x = &tracks[*(const uint32_t *)a];
+  const struct library_track *y = &tracks[*(const uint32_t *)b];
+
+  if(x->artist_rank != y->artist_rank) {return x->artist_rank < y->artist_rank ? -1 : 1;}
+  if(x->album_rank != y->album_rank) {return x->album_rank < y->album_rank ? -1 : 1;}
+  if(x->meta.disc != y->meta.disc) {return x->meta.disc < y->meta.disc ? -1 : 1;}
+  if(x->meta.track != y->meta.track) {return x->meta.track < y->meta.track ? -1 : 1;}
+
+  return strcmp(x->path, y->path);
+}
+
+
+// Albums without a year go after those with one. Ids are in name order already
+static int compare_albums(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  unsigned int x_year = albums[x].year ? albums[x].year : UINT16_MAX + 1;
+  unsigned int y_year = albums[y].year ? albums[y].year : UINT16_MAX + 1;
+
+  if(x_year != y_year) {return x_year < y_year ? -1 : 1;}
+  return x < y ? -1 : x > y;
+}
+
+
+
+void library_cleanup(void) {
+  mem_free(tracks);
+  mem_free(track_order);
+  mem_free(albums);
+  mem_free(album_order);
+  mem_free(artists);
+
+  tracks = NULL;
+  track_order = NULL;
+  albums = NULL;
+  album_order = NULL;
+  artists = NULL;
+  track_count = album_count = artist_count = 0;
+
+  return;
+}
+
+
+// Indexes whatever the tag cache holds right now, replacing the last index. Returns how many tracks
+// it covers. Everything after this is slicing the arrays built here
+unsigned int library_build(void) {
+  unsigned int i;
+
+  library_cleanup();
+
+  unsigned int wanted = meta_cache_count();
+  if(wanted == 0) {return 0;}
+
+  const char **paths = mem_alloc(MEM_CACHE, wanted * sizeof(char *));
+  struct track_meta *metas = mem_alloc(MEM_CACHE, wanted * sizeof(struct track_meta));
+  track_count = meta_cache_copy(paths, metas, wanted);
+
+  tracks = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(struct library_track));
+  track_order = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(uint32_t));
+  uint32_t *ranks = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(uint32_t));
+
+  // Compilations are filed under their album artist, everything else under its artist
+  for(i = 0; i < track_count; i++) {
+    tracks[i].path = paths[i];
+    tracks[i].meta = metas[i];
+    paths[i] = metas[i].album_artist ? metas[i].album_artist : metas[i].artist;
+  }
+  rank_strings(paths, track_count, ranks);
+  for(i = 0; i < track_count; i++) {tracks[i].artist_rank = ranks[i];}
+
+  for(i = 0; i < track_count; i++) {paths[i] = tracks[i].meta.album;}
+  rank_strings(paths, track_count, ranks);
+  for(i = 0; i < track_count; i++) {
+    tracks[i].album_rank = ranks[i];
+    track_order[i] = i;
+  }
+
+  mem_free(ranks);
+  mem_free(paths);
+  mem_free(metas);
+
+  qsort(track_order, track_count, sizeof(uint32_t), compare_tracks);
+
+  // One pass over the sorted tracks finds where every artist and album starts. Sized for the worst case
+  albums = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(struct library_album));
+  album_order = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(uint32_t));
+  artists = mem_alloc(MEM_CACHE, (track_count ? track_count : 1) * sizeof(struct library_artist));
+
+  struct library_track *previous = NULL;
+  for(i = 0; i < track_count; i++) {
+    struct library_track *track = &tracks[track_order[i]];
+    bool new_artist = previous == NULL || track->artist_rank != previous->artist_rank;
+
+    if(new_artist) {
+      artists[artist_count].name = track->meta.album_artist ? track->meta.album_artist : track->meta.artist;
+      artists[artist_count].first = album_count;
+      artists[artist_count].count = 0;
+      artist_count++;
+    }
+
+    if(new_artist || track->album_rank != previous->album_rank) {
+      albums[album_count] = (struct library_album){.name = track->meta.album, .first = i};
+      album_order[album_count] = album_count;
+      artists[artist_count - 1].count++;
+      album_count++;
+    }
+
+    // An album's year is its earliest track's, reissues tend to tag only some tracks
+    struct library_album *album = &albums[album_count - 1];
+    if(track->meta.year && (album->year == 0 || track->meta.year < album->year)) {album->year = track->meta.year;}
+    album->count++;
+
+    previous = track;
+  }
+
+  for(i = 0; i < artist_count; i++) {
+    qsort(album_order + artists[i].first, artists[i].count, sizeof(uint32_t), compare_albums);
+  }
+
+  // Give back what the worst case didn't need
+  if(album_count < track_count) {
+    albums = mem_realloc(albums, album_count * sizeof(struct library_album));
+    album_order = mem_realloc(album_order, album_count * sizeof(uint32_t));
+  }
+  if(artist_count < track_count) {artists = mem_realloc(artists, artist_count * sizeof(struct library_artist));}
+
+  return track_count;
+}
+
+
+
+// Rows at level. parent is the artist id for LIBRARY_ALBUMS, the album id for LIBRARY_TRACKS
+unsigned int library_count(int level, unsigned int parent) {
+  switch(level) {
+    case LIBRARY_ARTISTS: return artist_count;
+    case LIBRARY_ALBUMS: return parent < artist_count ? artists[parent].count : 0;
+    case LIBRARY_TRACKS: return parent < album_count ? albums[parent].count : 0;
+  }
+
+  return 0;
+}
+
+
+// Id of the entry in row of level, row counting from 0 and below library_count()
+unsigned int library_child(int level, unsigned int parent, unsigned int row) {
+  switch(level) {
+    case LIBRARY_ALBUMS: return album_order[artists[parent].first + row];
+    case LIBRARY_TRACKS: return track_order[albums[parent].first + row];
+  }
+
+  return row;
+}
+
+
+void library_label(int level, unsigned int id, char *buffer, size_t size) {
+  if(level == LIBRARY_ARTISTS) {
+    snprintf(buffer, size, "%s/", artists[id].name ? artists[id].name : "Unknown artist");
+  }
+  else if(level == LIBRARY_ALBUMS) {
+    if(albums[id].year) {snprintf(buffer, size, "%s (%u)/", albums[id].name ? albums[id].name : "Unknown album", albums[id].year);}
+    else {snprintf(buffer, size, "%s/", albums[id].name ? albums[id].name : "Unknown album");}
+  }
+  else {
+    const struct track_meta *meta = &tracks[id].meta;
+    const char *name = strrchr(tracks[id].path, '/');
+    name = meta->title ? meta->title : name ? name + 1 : tracks[id].path;
+
+    if(meta->track) {snprintf(buffer, size, "%02u. %s", meta->track, name);}
+    else {snprintf(buffer, size, "%s", name);}
+  }
+
+  return;
+}
+
+
+const char *library_track_path(unsigned int id) {
+  return id < track_count ? tracks[id].path : NULL;
+}
+
+
+// Appends everything under an artist or album, or a single track, to the play queue in the order
+// the browser lists it. Returns how many tracks that was
+unsigned int library_queue(int level, unsigned int id) {
+  unsigned int i, queued = 0;
+
+  if(level == LIBRARY_TRACKS) {
+    queue_push(tracks[id].path);
+    return 1;
+  }
+
+  for(i = 0; i < library_count(level + 1, id); i++) {
+    queued += library_queue(level + 1, library_child(level + 1, id, i));
+  }
+
+  return queued;
+}
@@ -0,0 +1,195 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <mem.h>
+
+
+// Tracked blocks carry their size and pool in front of them, so mem_free() and mem_realloc()
+// don't need to be told either. Padded so what follows is aligned like malloc()'s memory
+union mem_header {
+  struct {
+    size_t size;
+    int pool;
+  };
+  max_align_t align;
+};
+
+struct pool_counters {
+  atomic_uint_fast64_t current;
+  atomic_uint_fast64_t peak;
+  atomic_uint_fast64_t count;
+};
+
+
+static const char *pool_names[MAX_MEM_POOL + 1] = {"listing", "messages", "decode", "readahead", "cache", "metadata"};
+
+static struct pool_counters pools[MAX_MEM_POOL + 1];
+static atomic_uint_fast64_t total = 0;
+
+// 0 is no budget
+static atomic_uint_fast64_t budget_bytes = 0;
+
+// What mem_release() asks to give memory back, in the order they were added
+#define MEM_MAX_RELEASE_HOOKS 8
+static void (*release_hooks[MEM_MAX_RELEASE_HOOKS])(void);
+static int release_hook_count = 0;
+
+
+
+// For memory allocated elsewhere, libav's packets for one. bytes and blocks are negative
+// when it is given back
+void mem_account(int pool, long bytes, int blocks) {
+  struct pool_counters *counters = &pools[pool];
+
+  atomic_fetch_add_explicit(&counters->count, blocks, memory_order_relaxed);
+
+  uint64_t now = atomic_fetch_add_explicit(&counters->current, bytes, memory_order_relaxed) + bytes;
+  atomic_fetch_add_explicit(&total, bytes, memory_order_relaxed);
+
+  uint64_t peak = atomic_load_explicit(&counters->peak, memory_order_relaxed);
+  while(bytes > 0 && now > peak && !atomic_compare_exchange_weak_explicit(&counters->peak, &peak, now, memory_order_relaxed, memory_order_relaxed));
+
+  return;
+}
+
+
+static void *track(union mem_header *header, int pool, size_t size) {
+  if(header == NULL) {return NULL;}
+
+  header->size = size;
+  header->pool = pool;
+  mem_account(pool, size, 1);
+
+  return header + 1;
+}
+
+
+void *mem_alloc(int pool, size_t size) {
+  return track(malloc(sizeof(union mem_header) + size), pool, size);
+}
+
+
+void *mem_calloc(int pool, size_t count, size_t size) {
+  return track(calloc(1, sizeof(union mem_header) + count * size), pool, count * size);
+}
+
+
+// Stays in the pool it was allocated from, so p can't be NULL here
+void *mem_realloc(void *p, size_t size) {
+  union mem_header *header = (union mem_header *)p - 1;
+  int pool = header->pool;
+  long change = (long)size - (long)header->size;
+
+  header = realloc(header, sizeof(union mem_header) + size);
+  if(header == NULL) {return NULL;}
+
+  header->size = size;
+  mem_account(pool, change, 0);
+  return header + 1;
+}
+
+
+char *mem_strdup(int pool, const char *s) {
+  size_t length = strlen(s) + 1;
+  char *ret = mem_alloc(pool, length);
+
+  if(ret) {memcpy(ret, s, length);}
+  return ret;
+}
+
+
+void mem_free(void *p) {
+  if(p == NULL) {return;}
+
+  union mem_header *header = (union mem_header *)p - 1;
+  mem_account(header->pool, -(long)header->size, -1);
+
+  free(header);
+  return;
+}
+
+
+
+void mem_read_stats(int pool, struct mem_pool_stats *out) {
+  out->current = atomic_load_explicit(&pools[pool].current, memory_order_relaxed);
+  out->peak = atomic_load_explicit(&pools[pool].peak, memory_order_relaxed);
+  out->count = atomic_load_explicit(&pools[pool].count, memory_order_relaxed);
+  return;
+}
+
+
+const char *mem_pool_name(int pool) {
+  if(pool < 0 || pool > MAX_MEM_POOL) {return "?";}
+  return pool_names[pool];
+}
+
+
+uint64_t mem_total(void) {
+  return atomic_load_explicit(&total, memory_order_relaxed);
+}
+
+
+
+void mem_set_budget(unsigned int mb) {
+  atomic_store_explicit(&budget_bytes, (uint64_t)mb * 1024 * 1024, memory_order_relaxed);
+  return;
+}
+
+unsigned int mem_get_budget(void) {
+  return atomic_load_explicit(&budget_bytes, memory_order_relaxed) / (1024 * 1024);
+}
+
+
+// Checked by whatever can hold back or let go of memory: read-ahead, prefetching and the caches
+bool mem_over_budget(void) {
+  uint64_t budget = atomic_load_explicit(&budget_bytes, memory_order_relaxed);
+  return budget && mem_total() > budget;
+}
+
+
+// Added at startup, before mem_release() is first called. A hook gives back what its owner can
+// rebuild later, a little more every time it's called
+void mem_add_release_hook(void (*release)(void)) {
+  if(release_hook_count < MEM_MAX_RELEASE_HOOKS) {release_hooks[release_hook_count++] = release;}
+  return;
+}
+
+
+// Called from the main loop rather than from allocations, so the hooks can take their own locks.
+// Over the budget, caches are shrunk one after the other until it's met again
+void mem_release(void) {
+  int i;
+
+  for(i = 0; i < release_hook_count && mem_over_budget(); i++) {
+    release_hooks[i]();
+  }
+
+  return;
+}
@@ -25,6 +25,7 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <libavutil/error.h>
 #include <libavformat/avformat.h>
@@ -33,6 +34,7 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 #include <libavutil/dict.h>
+#include <libavutil/opt.h>
 
 #include <AL/al.h>
 #include <AL/alext.h>
@@ -40,54 +42,101 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <error_codes.h>
 #include <error.h>
 #include <ui.h>
+#include <playback.h>
+#include <io_backend.h>
+#include <audio_source.h>
+#include <prefetch.h>
+#include <queue.h>
+#include <waveform.h>
+#include <spectrum.h>
+#include <audio_device.h>
+#include <demux.h>
+#include <mem.h>
+#include <fs_util.h>
 
 
 
-#define BASE_TEN 10
 
 
+// Only ever touched by whoever is driving playback: the playback thread,
+// or the UI thread while the playback thread is stopped
+static AUDIO_SOURCE *active_sources[2] = {NULL, NULL};
 
-struct track_data {
-  uint16_t duration;
-  uint16_t channels;
-  unsigned int samplerate;
-};
-
-typedef struct {
-  AVFormatContext *format_context;
-  AVCodecParameters *codec_param;
-  const AVCodec *codec;
-  AVCodecContext *codec_context;
-  SwrContext *swr_context;
-  struct track_data track_data;
-} AUDIO_SOURCE;
-
-#define META_TRACK_TITLE 0
-#define META_ALBUM_TITLE 1
-#define META_ALBUM_ARTIST 2
-#define META_TRACK_ARTISTS 3
-#define MAX_META_TYPE_STR 3
-
-#define META_TRACK_DURATION 4
-#define META_YEAR 5
-#define MAX_META_TYPE 5
-
+// Set once the track after the current one has been handed to the prefetcher in full
+static bool tail_prefetched = false;
 
-#define MAX_VOLUME 180
 
-static char *metadata[4] = {NULL, NULL, NULL, NULL};
-static unsigned int meta_duration = 0;
-static unsigned int meta_year = 0;
+// What the UI gets to see, behind a seqlock. Writers take publish_lock and make the sequence
+// odd while they change the state, readers copy it out and retry if the sequence moved meanwhile.
+// The UI never blocks the playback thread and never sees a source that is being freed
+static struct playback_state published;
+static atomic_uint publish_seq = 0;
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
-static AUDIO_SOURCE *active_sources[2] = {NULL, NULL};
+static ALuint source;
 
-static AVPacket *pPacket = NULL;
-static AVFrame *pFrame = NULL;
+// Every buffer created for the source, in the order they were queued on it. The one at
+// queue_head is the one OpenAL is playing from
+static ALuint buffers[PLAYBACK_MAX_BUFFERS];
+static unsigned int buffer_count = 0;
+static unsigned int queue_head = 0;
+
+// How many buffers, of at least how many frames each, the next start sets up. Fewer and smaller
+// buffers get pauses and seeks heard sooner, more and bigger ones ride out slow disks and busy CPUs
+static unsigned int wanted_buffers = PLAYBACK_DEFAULT_BUFFERS;
+static unsigned int buffer_frames = PLAYBACK_DEFAULT_FRAMES;
+
+// Listener gain, applied again whenever the context is replaced
+static float master_gain = 1.0f;
+
+// Set by 'device rate auto': tracks started by hand get the device's mixing rate switched to theirs
+static bool match_rate = false;
+
+// How tracks are converted to the device's rate while decoding. RESAMPLE_OFF leaves it to OpenAL
+static int resample_quality = RESAMPLE_STANDARD;
+
+// AL_SEC_OFFSET only counts from the oldest buffer still queued, and buffers are unqueued as they
+// finish, so the position in the track is kept here: frames of the current track OpenAL has
+// finished with, starting from wherever playback was started or seeked to
+static uint64_t played_frames = 0;
+
+// Which source each queued buffer was filled from, and with how many frames
+struct chunk_owner {
+  ALuint buffer;
+  AUDIO_SOURCE *song;
+  int frames;
+  uint64_t stream_start;
+};
+static struct chunk_owner chunk_owners[PLAYBACK_MAX_BUFFERS];
+
+// Frames handed to OpenAL since startup, across tracks, seeks and restarts. Each chunk's first frame
+// is numbered with the count when it was bound, which is how the analyser finds the audible part of its tap
+static uint64_t stream_frames = 0;
+
+// Everything playback_start_at() can do without OpenAL, so it can be done ahead on another thread
+struct start_request {
+  AUDIO_SOURCE *song;
+  uint8_t *buf[PLAYBACK_MAX_BUFFERS];
+  int size[PLAYBACK_MAX_BUFFERS];
+  unsigned int count;
+  unsigned int frames;
+  uint64_t start_frames;
+};
 
+// A track being opened and pre-rolled in the background by playback_resume_async()
+static pthread_t resume_thread;
+static bool resume_threaded = false;
+static atomic_int resume_state = 0;
+static struct start_request resume_request;
+static unsigned int resume_seconds;
+static bool resume_paused;
+static char *resume_path = NULL;
 
-static ALuint source;
-static ALuint buffers[3];
+#define RESUME_NONE 0
+#define RESUME_PREPARING 1
+#define RESUME_READY 2
+#define RESUME_FAILED 3
 
 extern volatile bool stop_thread;
 
@@ -96,50 +145,153 @@ volatile int sleep_time = 90000;
 
 
 static pthread_t thread;
+static bool thread_running = false;
+
+// Set when rendering offline: no playback thread is started, whoever renders calls playback_update()
+static bool driven = false;
 
 void *playback_thread(void *);
 
+// The playback thread only exists while something is playing, playback_start() creates it
 void playback_init(void) {
   // Tell ffmpeg to shut up
   av_log_set_level(AV_LOG_QUIET);
-  pPacket = av_packet_alloc();
-  pFrame = av_frame_alloc();
 
-  pthread_create(&thread, NULL, playback_thread, NULL);
+  return;
+}
+
+
+static void stop_playback_thread(void) {
+  if(!thread_running) {return;}
+
+  stop_thread = true;
+  pthread_join(thread, NULL);
+  thread_running = false;
+
+  return;
+}
+
+
+static void begin_publish(void) {
+  pthread_mutex_lock(&publish_lock);
+  atomic_fetch_add_explicit(&publish_seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  return;
+}
 
+static void end_publish(void) {
+  atomic_fetch_add_explicit(&publish_seq, 1, memory_order_release);
+  pthread_mutex_unlock(&publish_lock);
   return;
 }
 
 
-char *metadata_retrieve_str(int meta_type) {
-  if(active_sources[0] == NULL) {return NULL;}
-  if(meta_type > MAX_META_TYPE_STR) {return NULL;}
+void playback_read_state(struct playback_state *out) {
+  unsigned int seq;
 
-  return metadata[meta_type];
+  do {
+    while((seq = atomic_load_explicit(&publish_seq, memory_order_acquire)) & 1) {}
+    memcpy(out, &published, sizeof(struct playback_state));
+    atomic_thread_fence(memory_order_acquire);
+  } while(atomic_load_explicit(&publish_seq, memory_order_relaxed) != seq);
 
-  return NULL;
+  return;
 }
 
 
-int metadata_retrieve_int(int meta_type) {
-  if(active_sources[0] == NULL) {return 0;}
-  if(meta_type <= MAX_META_TYPE_STR || meta_type > MAX_META_TYPE) {return 0;}
+static void publish_next_path(void) {
+  begin_publish();
+  snprintf(published.next_path, STATE_PATH_SIZE, "%s", active_sources[1] ? active_sources[1]->filename : "");
+  end_publish();
+  return;
+}
 
-  switch(meta_type) {
-    case META_TRACK_DURATION:
-      return meta_duration;
-    case META_YEAR:
-      return meta_year;
+
+static void publish_stopped(void) {
+  begin_publish();
+  published.active = false;
+  published.playing = false;
+  published.position = 0;
+  published.next_path[0] = 0;
+  published.track_serial++;
+  end_publish();
+  return;
+}
+
+
+// Publishes a pause or resume, which only counts while a track is loaded
+static void publish_playing(bool playing) {
+  begin_publish();
+  published.playing = playing && published.active;
+  end_publish();
+  return;
+}
+
+
+static struct chunk_owner *find_chunk_owner(ALuint buffer) {
+  size_t i;
+  for(i = 0; i < buffer_count; i++) {
+    if(chunk_owners[i].buffer == buffer) {return &chunk_owners[i];}
   }
+  return NULL;
+}
 
-  return 0;
+
+// Seconds into the current track
+static int track_position(void) {
+  ALint offset = 0;
+  struct chunk_owner *head = buffer_count ? find_chunk_owner(buffers[queue_head]) : NULL;
+
+  if(active_sources[0] == NULL || active_sources[0]->track_data.output_rate == 0) {return 0;}
+
+  // Straight after a track change the head buffer can still be the last one of the previous track
+  if(head && head->song == active_sources[0]) {alGetSourcei(source, AL_SAMPLE_OFFSET, &offset);}
+
+  return (played_frames + offset) / active_sources[0]->track_data.output_rate;
 }
 
 
+// Tells the analyser which frame of the stream is being heard, for it to line its window up with
+static void clock_spectrum(ALint state) {
+  ALint offset = 0;
+  struct chunk_owner *head = buffer_count ? find_chunk_owner(buffers[queue_head]) : NULL;
+
+  if(head == NULL) {return;}
+
+  alGetSourcei(source, AL_SAMPLE_OFFSET, &offset);
+  spectrum_clock(head->stream_start + offset, state == AL_PLAYING);
+  return;
+}
+
+
+// Called on every playback_update(), only publishes when the shown second or the AL state changed
+static void publish_position(void) {
+  ALint state;
+  int position = track_position();
+
+  alGetSourcei(source, AL_SOURCE_STATE, &state);
+  clock_spectrum(state);
+
+  // The UI thread publishes pauses, so even the comparison needs the lock
+  pthread_mutex_lock(&publish_lock);
+  bool changed = position != published.position || (state == AL_PLAYING) != published.playing;
+  pthread_mutex_unlock(&publish_lock);
+  if(!changed) {return;}
+
+  begin_publish();
+  published.position = position;
+  published.playing = state == AL_PLAYING;
+  end_publish();
+  return;
+}
+
+
+
 void kill_openal_source(void) {
   alDeleteSources(1, &source);
-  alDeleteBuffers(1, buffers);
-  alDeleteBuffers(1, &buffers[1]);
+  if(buffer_count) {alDeleteBuffers(buffer_count, buffers);}
+  buffer_count = 0;
+  queue_head = 0;
 
   // Any errors in the above function calls should be ignored
   // The openal error buffer is cleared here to prevent it accidentally being read later
@@ -149,11 +301,9 @@ void kill_openal_source(void) {
 
 
 int playback_read_clock(void) {
-  ALint val;
-  if(alIsSource(source) != AL_TRUE) {return 0;}
-  alGetSourcei(source, AL_SEC_OFFSET, &val);
-
-  return val;
+  struct playback_state state;
+  playback_read_state(&state);
+  return state.position;
 }
 
 
@@ -169,8 +319,23 @@ void bind_chunk(AUDIO_SOURCE *song, uint8_t *data, int size, ALuint buffer) {
     format = AL_FORMAT_STEREO_FLOAT32;
   }
 
-  alBufferData(buffer, format, data, size, song->track_data.samplerate);
-  free(data);
+  int samples = size / (song->track_data.channels * sizeof(float));
+
+  alBufferData(buffer, format, data, size, song->track_data.output_rate);
+  spectrum_tap((float *)data, samples, song->track_data.channels, song->track_data.output_rate, stream_frames);
+  mem_free(data);
+
+  struct chunk_owner *owner = find_chunk_owner(buffer);
+  if(owner) {
+    owner->song = song;
+    owner->frames = samples;
+    owner->stream_start = stream_frames;
+  }
+  stream_frames += samples;
+
+  // Wake the playback thread again a little before this chunk runs out
+
+  sleep_time = (((float)samples / (float)song->track_data.output_rate) * 1000000) * 0.8;
 
   if((error = alGetError()) != AL_NO_ERROR) {
     trackjack_error(JACK_ERR_BUFFERGEN, (LIB_ERROR)error);
@@ -180,23 +345,29 @@ void bind_chunk(AUDIO_SOURCE *song, uint8_t *data, int size, ALuint buffer) {
 }
 
 
-uint8_t *decode_chunk(AUDIO_SOURCE *song, int *buf_size) {
-  uint8_t **buf = NULL;
+// From the source's demuxer when playback started one, straight from the file otherwise
+static int read_packet(AUDIO_SOURCE *song) {
+  if(song->demux) {return demux_read(song->demux, song->packet);}
+  return av_read_frame(song->format_context, song->packet);
+}
+
 
+uint8_t *decode_chunk(AUDIO_SOURCE *song, int *buf_size) {
   int channels = song->track_data.channels;
 
 
   int dst_nb_samples;
-  int dst_linesize;
   int err = 0;
   bool frame_read = false;
 
-  while(av_read_frame(song->format_context, pPacket) >= 0) {
-    if((err = avcodec_send_packet(song->codec_context, pPacket)) < 0) {
+  while(read_packet(song) >= 0) {
+    err = avcodec_send_packet(song->codec_context, song->packet);
+    av_packet_unref(song->packet);
+    if(err < 0) {
       continue;
     }
 
-    err = avcodec_receive_frame(song->codec_context, pFrame);
+    err = avcodec_receive_frame(song->codec_context, song->frame);
     if(err == AVERROR(EAGAIN)) {
       continue;
     }
@@ -207,31 +378,77 @@ uint8_t *decode_chunk(AUDIO_SOURCE *song, int *buf_size) {
 
   if(frame_read == false) {return NULL;}
 
-  dst_nb_samples = swr_get_out_samples(song->swr_context, pFrame->nb_samples);
+  dst_nb_samples = swr_get_out_samples(song->swr_context, song->frame->nb_samples);
 
-  sleep_time = (((float)dst_nb_samples / (float)song->track_data.samplerate) * 1000000) * 0.8;
+  // Output is packed float, so swresample can write straight into the buffer we hand back.
+  // Whoever gets it frees it with mem_free()
+  uint8_t *ret = mem_alloc(MEM_DECODE, dst_nb_samples * channels * sizeof(float));
+  uint8_t *out[1] = {ret};
 
-  av_samples_alloc_array_and_samples(&buf, &dst_linesize, channels, dst_nb_samples, AV_SAMPLE_FMT_FLT, 0);
+  int converted = swr_convert(song->swr_context, out, dst_nb_samples, (const uint8_t **)song->frame->extended_data, song->frame->nb_samples);
+  if(converted < 0) {converted = 0;}
 
-  swr_convert(song->swr_context, buf, dst_nb_samples, (const uint8_t **)pFrame->extended_data, pFrame->nb_samples);
-  
+  *buf_size = converted * channels * sizeof(float);
 
+  return ret;
+}
 
-  *buf_size = dst_linesize;
-  uint8_t *ret = malloc(dst_linesize);
-  int i;
-  for(i = 0; i < dst_linesize; i++) {
-    ret[i] = buf[0][i];
-  }
 
-  av_packet_unref(pPacket);
+// Whatever swresample is still holding back once the file has been fully decoded.
+// Only ever non-empty when resampling
+uint8_t *flush_chunk(AUDIO_SOURCE *song, int *buf_size) {
+  int channels = song->track_data.channels;
+  int delayed = swr_get_out_samples(song->swr_context, 0);
+
+  if(delayed <= 0) {return NULL;}
+
+  uint8_t *ret = mem_alloc(MEM_DECODE, delayed * channels * sizeof(float));
+  uint8_t *out[1] = {ret};
 
-  if(buf) {
-    av_freep(&buf[0]);
+  int converted = swr_convert(song->swr_context, out, delayed, NULL, 0);
+  if(converted <= 0) {
+    mem_free(ret);
+    return NULL;
   }
-  av_freep(&buf);
+
+  *buf_size = converted * channels * sizeof(float);
+  return ret;
+}
 
 
+// Decodes until at least min_frames frames are together, or the file ends. A chunk for OpenAL
+// is then several codec frames rather than one, which for mp3 would only be 26 ms of audio.
+// The last chunk of a file includes what swresample held back, or the gapless join would lose it
+uint8_t *decode_frames(AUDIO_SOURCE *song, int min_frames, int *buf_size) {
+  int frame_bytes = song->track_data.channels * sizeof(float);
+  int size = 0, capacity = 0;
+  uint8_t *ret = NULL;
+  uint8_t *chunk;
+  int chunk_size;
+  bool flushed = false;
+
+  while(size / frame_bytes < min_frames) {
+    if((chunk = decode_chunk(song, &chunk_size)) == NULL) {
+      if(flushed || (chunk = flush_chunk(song, &chunk_size)) == NULL) {break;}
+      flushed = true;
+    }
+
+    if(ret == NULL) {
+      ret = chunk;
+      size = capacity = chunk_size;
+      continue;
+    }
+
+    if(size + chunk_size > capacity) {
+      capacity = (size + chunk_size) * 2;
+      ret = mem_realloc(ret, capacity);
+    }
+    memcpy(ret + size, chunk, chunk_size);
+    size += chunk_size;
+    mem_free(chunk);
+  }
+
+  *buf_size = size;
   return ret;
 }
 
@@ -239,27 +456,30 @@ uint8_t *decode_chunk(AUDIO_SOURCE *song, int *buf_size) {
 
 
 void free_audio_source(AUDIO_SOURCE *song) {
+  // Has to stop reading before anything it reads from goes away
+  if(song->demux) {demux_stop(song->demux);}
   if(song->codec_context) {avcodec_free_context(&song->codec_context);}
+  if(song->packet) {av_packet_free(&song->packet);}
+  if(song->frame) {av_frame_free(&song->frame);}
   if(song->swr_context) {swr_free(&song->swr_context);}
   if(song->format_context) {avformat_close_input(&song->format_context);}
 
-  free(song);
+  // Custom IO isn't closed by avformat_close_input(), so it has to go after it
+  if(song->io) {io_close(song->io);}
+
+  free(song->filename);
+  mem_free(song);
 }
 
 
 void playback_cleanup(void) {
-  stop_thread = true;
-  pthread_join(thread, NULL);
+  stop_playback_thread();
 
-
-  kill_openal_source();
+  if(audio_device_ready()) {kill_openal_source();}
 
   if(active_sources[0]) {free_audio_source(active_sources[0]);}
   if(active_sources[1]) {free_audio_source(active_sources[1]);}
 
-  if(pPacket) {av_packet_free(&pPacket);}
-  if(pFrame) {av_frame_free(&pFrame);}
-
 
   return;
 }
@@ -267,53 +487,118 @@ void playback_cleanup(void) {
 
 
 AUDIO_SOURCE *new_audio_source(const char *filename) {
-  AUDIO_SOURCE  *new_song = calloc(1, sizeof(AUDIO_SOURCE));
+  AUDIO_SOURCE  *new_song = mem_calloc(MEM_DECODE, 1, sizeof(AUDIO_SOURCE));
+  // Absolute, so the published path still names the same file after the UI changes directory
+  new_song->filename = absolute_path(filename);
+  filename = new_song->filename;
+  new_song->packet = av_packet_alloc();
+  new_song->frame = av_frame_alloc();
 
   new_song->format_context = avformat_alloc_context();
+
+  // Feed libavformat through our own reader, unless the user picked its default file protocol
+  // or the file can't be read that way (pipes etc.), in which case io_open() refuses it
+  int backend = io_get_backend();
+  if(backend != IO_BACKEND_LIBAV && (new_song->io = io_open(filename, backend))) {
+    new_song->format_context->pb = io_avio_context(new_song->io);
+    new_song->format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+
   int ret = avformat_open_input(&new_song->format_context, filename, NULL, NULL);
   if(ret < 0) {
     trackjack_error(JACK_ERR_LIBAV_MSG, (LIB_ERROR)ret);
+    free_audio_source(new_song);
     return NULL;
   }
 
   ret = avformat_find_stream_info(new_song->format_context, NULL);
   if(ret < 0) {
     trackjack_error(JACK_ERR_LIBAV_MSG, (LIB_ERROR)ret);
+    free_audio_source(new_song);
     return NULL;
   }
 
 
   new_song->codec_param = new_song->format_context->streams[0]->codecpar;
   if(new_song->codec_param->codec_type != AVMEDIA_TYPE_AUDIO) {
+    free_audio_source(new_song);
     return NULL;
   }
 
 
   new_song->track_data.channels = new_song->codec_param->ch_layout.nb_channels;
   new_song->track_data.samplerate = new_song->codec_param->sample_rate;
-  meta_duration = new_song->format_context->duration / AV_TIME_BASE;
+  new_song->track_data.duration = new_song->format_context->duration / AV_TIME_BASE;
+
+  // Container tags first, Ogg and Opus keep theirs on the stream
+  track_meta_read(new_song->format_context->metadata, &new_song->meta);
+  track_meta_read(new_song->format_context->streams[0]->metadata, &new_song->meta);
+  new_song->meta.duration = new_song->track_data.duration;
+  meta_cache_store(filename, &new_song->meta);
+
+  return new_song;
+}
 
 
-  if(metadata[0]) {free(metadata[0]);}
-  if(metadata[1]) {free(metadata[1]);}
-  if(metadata[2]) {free(metadata[2]);}
-  if(metadata[3]) {free(metadata[3]);}
+static void copy_tag(char *dst, const char *tag) {
+  snprintf(dst, STATE_STR_SIZE, "%s", tag ? tag : "");
+  return;
+}
+
+
+// Every source carries its own tags, they only become what the UI shows once the source starts playing
+void load_metadata(AUDIO_SOURCE *new_song) {
+  struct track_meta *meta = &new_song->meta;
+
+  begin_publish();
+  published.duration = new_song->track_data.duration;
+  published.year = meta->year;
+  published.position = 0;
+  published.active = true;
+  published.playing = true;
+  copy_tag(published.meta[META_TRACK_TITLE], meta->title);
+  copy_tag(published.meta[META_ABLUM_TITLE], meta->album);
+  copy_tag(published.meta[META_ALBUM_ARTIST], meta->album_artist);
+  copy_tag(published.meta[META_TRACK_ARTISTS], meta->artist);
+  snprintf(published.path, STATE_PATH_SIZE, "%s", new_song->filename);
+  published.track_serial++;
+  end_publish();
+
+  waveform_set_current(new_song->filename);
+  return;
+}
 
-  const AVDictionaryEntry *tag = NULL;
-  char *garbage_ptr; //strtol() wants a double pointer to direct us to the remaining part of the date string. it is not needed in this case, but must be created anyway
-  while((tag = av_dict_iterate(new_song->format_context->metadata, tag))) {
-    if(strcmp(tag->key, "ALBUM") == 0) {metadata[1] = strdup(tag->value);}
-    if(strcmp(tag->key, "TITLE") == 0) {metadata[0] = strdup(tag->value);}
-    if(strcmp(tag->key, "album_artist") == 0) {metadata[2] = strdup(tag->value);}
-    if(strcmp(tag->key, "ARTIST") == 0) {metadata[3] = strdup(tag->value);}
-    if(strcmp(tag->key, "DATE") == 0) {meta_year = strtol(tag->value, &garbage_ptr, BASE_TEN);}
+
+// Sets up swresample for one of the RESAMPLE_ presets, before swr_init()
+static void set_resample_options(SwrContext *swr, int quality) {
+  switch(quality) {
+    case RESAMPLE_LINEAR:
+      // Two taps, interpolated between few phases: about as cheap as linear interpolation, and as dull
+      av_opt_set_int(swr, "filter_size", 2, 0);
+      av_opt_set_int(swr, "phase_shift", 5, 0);
+      av_opt_set_int(swr, "linear_interp", 1, 0);
+      break;
+    case RESAMPLE_HIGH:
+      av_opt_set_int(swr, "filter_size", 64, 0);
+      av_opt_set_int(swr, "phase_shift", 14, 0);
+      av_opt_set_int(swr, "linear_interp", 1, 0);
+      av_opt_set_double(swr, "cutoff", 0.98, 0);
+      break;
+    case RESAMPLE_SOXR:
+      av_opt_set_int(swr, "resampler", SWR_ENGINE_SOXR, 0);
+      av_opt_set_int(swr, "precision", 28, 0);
+      break;
   }
 
-  return new_song;
+  // RESAMPLE_STANDARD and RESAMPLE_OFF keep swresample's own defaults
+  return;
 }
 
 
-int prep_audio_source(AUDIO_SOURCE *new) {
+// dst_rate is the samplerate decode_chunk() should deliver, 0 keeps the file's own.
+// quality is one of the RESAMPLE_ presets. A preset swresample wasn't built with (soxr)
+// falls back to RESAMPLE_HIGH, which is what source->resample_quality then says
+int prep_audio_source_quality(AUDIO_SOURCE *new, int dst_rate, int quality) {
   new->codec = avcodec_find_decoder(new->codec_param->codec_id);
   new->codec_context = avcodec_alloc_context3(new->codec);
 
@@ -337,7 +622,8 @@ int prep_audio_source(AUDIO_SOURCE *new) {
   unsigned int dst_sample_fmt = AV_SAMPLE_FMT_FLT;
 
   int src_rate = new->track_data.samplerate;
-  int dst_rate = src_rate;
+  if(dst_rate <= 0) {dst_rate = src_rate;}
+  new->track_data.output_rate = dst_rate;
 
   ret = swr_alloc_set_opts2(&new->swr_context, dst_ch_layout, dst_sample_fmt, dst_rate, src_ch_layout, src_sample_fmt, src_rate, 0, NULL);
   if(ret < 0) {
@@ -345,137 +631,560 @@ int prep_audio_source(AUDIO_SOURCE *new) {
     return -3;
   }
 
+  set_resample_options(new->swr_context, quality);
   ret = swr_init(new->swr_context);
+
+  if(ret < 0 && quality == RESAMPLE_SOXR) {
+    swr_free(&new->swr_context);
+    swr_alloc_set_opts2(&new->swr_context, dst_ch_layout, dst_sample_fmt, dst_rate, src_ch_layout, src_sample_fmt, src_rate, 0, NULL);
+    quality = RESAMPLE_HIGH;
+    set_resample_options(new->swr_context, quality);
+    ret = swr_init(new->swr_context);
+  }
   if(ret < 0) {
     trackjack_error(JACK_ERR_LIBAV_MSG, (LIB_ERROR)ret);
     return -4;
   }
 
+  new->resample_quality = src_rate == dst_rate ? RESAMPLE_OFF : quality;
   return 0;
 }
 
 
+int prep_audio_source_rate(AUDIO_SOURCE *new, int dst_rate) {
+  return prep_audio_source_quality(new, dst_rate, resample_quality);
+}
 
-void playback_update(void) {
 
-  if(active_sources[0] == NULL) {return;}
+// For playback: converted to the rate the device mixes at with the chosen preset, so OpenAL's
+// own resampler never has to step in. Left alone with RESAMPLE_OFF, or while the device rate
+// follows the tracks instead
+int prep_audio_source(AUDIO_SOURCE *new) {
+  struct audio_device_status status;
+  int rate = 0;
 
-  ALint value;
-  alGetSourcei(source, AL_BUFFERS_PROCESSED, &value);
-  if(value <= 0) {return;}
+  if(resample_quality != RESAMPLE_OFF && !match_rate && audio_device_ready()) {
+    audio_device_read_status(&status);
+    rate = status.frequency;
+  }
 
-  ALuint unq_buf = 0;
+  return prep_audio_source_quality(new, rate, resample_quality);
+}
 
-  buffers[2] = buffers[0];
-  buffers[0] = buffers[1];
-  buffers[1] = buffers[2];
 
-  alSourceUnqueueBuffers(source, 1, &buffers[1]);
+static const char *resample_names[MAX_RESAMPLE + 1] = {"off", "linear", "standard", "high", "soxr"};
 
+int resample_quality_from_name(const char *name) {
+  int i;
+  for(i = 0; i <= MAX_RESAMPLE; i++) {
+    if(strcmp(name, resample_names[i]) == 0) {return i;}
+  }
+  return -1;
+}
+
+const char *resample_quality_name(int quality) {
+  if(quality < 0 || quality > MAX_RESAMPLE) {return "?";}
+  return resample_names[quality];
+}
+
+
+// Applies from the next track that is opened
+void resample_set_quality(int quality) {
+  resample_quality = quality;
+  return;
+}
+
+int resample_get_quality(void) {
+  return resample_quality;
+}
+
+
+
+// Takes the front of the play queue and opens it as active_sources[1].
+// Entries that can't be opened are skipped
+void open_next_source(void) {
+  char *path;
+
+  while(active_sources[1] == NULL && (path = queue_pop())) {
+    active_sources[1] = new_audio_source(path);
+    free(path);
+  }
+  tail_prefetched = false;
+
+  // So the overview is usually there by the time the track starts
+  if(active_sources[1]) {waveform_request(active_sources[1]->filename);}
+  publish_next_path();
+
+  return;
+}
+
+
+// Decodes the first chunk of the next track, moving further down the queue if it won't decode
+uint8_t *start_next_source(int *buf_size) {
   uint8_t *buf = NULL;
-  int buf_size;
-  if((buf = decode_chunk(active_sources[0], &buf_size)))
-    {
-    bind_chunk(active_sources[0], buf, buf_size, buffers[1]);
-    alSourceQueueBuffers(source, 1, &buffers[1]);
+
+  if(active_sources[1] == NULL) {open_next_source();}
+
+  while(active_sources[1]) {
+    if(prep_audio_source(active_sources[1]) == 0) {
+      active_sources[1]->demux = demux_start(active_sources[1]->format_context, 0);
+      if((buf = decode_frames(active_sources[1], buffer_frames, buf_size))) {return buf;}
+    }
+
+    free_audio_source(active_sources[1]);
+    active_sources[1] = NULL;
+    open_next_source();
   }
-  else if(active_sources[1])
-    {
-    prep_audio_source(active_sources[1]);
 
-    buf = decode_chunk(active_sources[1], &buf_size);
+  return NULL;
+}
+
+
+
+// Takes the oldest buffer off the source, fills it with what comes next and queues it again
+static void refill_buffer(void) {
+  ALuint unqueued;
+
+  alSourceUnqueueBuffers(source, 1, &unqueued);
+  queue_head = (queue_head + 1) % buffer_count;
+
+  struct chunk_owner *finished = find_chunk_owner(unqueued);
+  if(finished && finished->song == active_sources[0]) {played_frames += finished->frames;}
 
-    if(!buf) {
-      active_sources[0] = NULL;
-      active_sources[1] = NULL;
+  // Close to the end of this track, get the whole of the next one into the page cache
+  if(active_sources[1] && !tail_prefetched) {
+    if(active_sources[0]->track_data.duration - track_position() <= PREFETCH_TAIL_SECONDS) {
+      prefetch_rest(active_sources[1]->filename);
+      tail_prefetched = true;
     }
-    bind_chunk(active_sources[1], buf, buf_size, buffers[1]);
-    alSourceQueueBuffers(source, 1, &buffers[1]);
+  }
+
+  uint8_t *buf = NULL;
+  int buf_size;
+  if((buf = decode_frames(active_sources[0], buffer_frames, &buf_size)))
+    {
+    bind_chunk(active_sources[0], buf, buf_size, unqueued);
+    alSourceQueueBuffers(source, 1, &unqueued);
+  }
+  else if((buf = start_next_source(&buf_size)))
+    {
+    bind_chunk(active_sources[1], buf, buf_size, unqueued);
+    alSourceQueueBuffers(source, 1, &unqueued);
 
     free_audio_source(active_sources[0]);
     active_sources[0] = active_sources[1];
     active_sources[1] = NULL;
+    tail_prefetched = false;
+    played_frames = 0;
+    prefetch_consumed(active_sources[0]->filename);
+    load_metadata(active_sources[0]);
   }
   else
     {
+    // Nothing left to play. The buffers already queued still play out
+    free_audio_source(active_sources[0]);
     active_sources[0] = NULL;
+    waveform_set_current(NULL);
+    publish_stopped();
   }
 
+  // Open whatever is next up now rather than at the end of the track, so the switch is gapless.
+  // Only this one entry of the queue ever has a source open
+  if(active_sources[0] && active_sources[1] == NULL) {open_next_source();}
+
 
   return;
 }
 
 
 
+void playback_update(void) {
 
-void playback_start(const char *filename) {
+  if(active_sources[0] == NULL) {return;}
+
+  publish_position();
+
+  ALint value;
+  alGetSourcei(source, AL_BUFFERS_PROCESSED, &value);
+
+  // Every buffer that finished is refilled, there may be several after a stall
+  while(value-- > 0 && active_sources[0]) {refill_buffer();}
+
+  // Every buffer ran dry before the thread got to it. Start again now they're full
+  ALint state;
+  alGetSourcei(source, AL_SOURCE_STATE, &state);
+  if(state == AL_STOPPED && active_sources[0]) {alSourcePlay(source);}
+
+  return;
+}
+
+
+
+// Opens filename, seeks to seconds and decodes enough to fill every buffer. Doesn't touch OpenAL
+// or any playback state, so it may run on any thread. Returns 0 on success
+static int prepare_start(const char *filename, unsigned int seconds, struct start_request *req) {
   AUDIO_SOURCE *new_song = new_audio_source(filename);
 
-  if(new_song == NULL) {return;}
+  if(new_song == NULL) {return -1;}
 
   int ret = prep_audio_source(new_song);
   if(ret < 0) {
     trackjack_error(JACK_ERR_PLAYBACK_SOURCE_PREP, (LIB_ERROR)ret);
     free_audio_source(new_song);
-    return;
+    return -1;
   }
 
-  // Two chunks are loaded instead of one
-  // because while the second chunk is playing later,
-  // the third will be loaded. And so on
-  int buf_size;
-  int buf_size_2;
-  uint8_t *buf = decode_chunk(new_song, &buf_size);
-  uint8_t *buf_2 = decode_chunk(new_song, &buf_size_2);
+  req->start_frames = 0;
+  if(seconds > 0 && seconds < new_song->track_data.duration) {
+    int64_t timestamp = (int64_t)seconds * AV_TIME_BASE;
+    if(avformat_seek_file(new_song->format_context, -1, INT64_MIN, timestamp, timestamp, 0) >= 0) {
+      avcodec_flush_buffers(new_song->codec_context);
+      req->start_frames = (uint64_t)seconds * new_song->track_data.output_rate;
+    }
+  }
 
-  stop_thread = true;
-  pthread_join(thread, NULL);
+  // Reading runs ahead on its own thread from here on, so a slow disk or share
+  // only holds up decoding once the packet queue has run dry
+  new_song->demux = demux_start(new_song->format_context, 0);
+
+  // Every buffer is filled up front, while one is playing the ones after it are
+  // already waiting and the first one to finish gets refilled. And so on.
+  // A track too short to fill them all just uses fewer
+  req->song = new_song;
+  req->count = 0;
+  req->frames = buffer_frames;
+  while(req->count < wanted_buffers && (req->buf[req->count] = decode_frames(new_song, req->frames, &req->size[req->count]))) {
+    req->count++;
+  }
 
-  kill_openal_source();
+  if(req->count == 0) {
+    free_audio_source(new_song);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void discard_start(struct start_request *req) {
+  size_t i;
+  for(i = 0; i < req->count; i++) {mem_free(req->buf[i]);}
+  free_audio_source(req->song);
+  return;
+}
+
+
+// Lets go of both sources. The next track was already taken off the queue, it goes back to the front
+static void release_sources(void) {
   if(active_sources[0]) {free_audio_source(active_sources[0]);}
-  if(active_sources[1]) {free_audio_source(active_sources[1]);}
+  if(active_sources[1]) {
+    queue_insert(0, active_sources[1]->filename);
+    free_audio_source(active_sources[1]);
+  }
+
+  active_sources[0] = NULL;
+  active_sources[1] = NULL;
+  return;
+}
+
+
+static void apply_gain(void) {
+  alListenerf(AL_GAIN, master_gain);
+  alGetError();
+  return;
+}
+
+
+// Only called with no source or buffer left, so the device may be replaced outright
+static void match_device_rate(int rate) {
+  struct audio_device_status status;
+  audio_device_read_status(&status);
+  if(status.frequency == rate) {return;}
+
+  audio_device_set_frequency(rate);
+  if(audio_device_move(NULL) != 0 && audio_device_reopen(NULL) == 0) {apply_gain();}
+
+  return;
+}
+
+
+// Makes a prepared track the one playing, replacing whatever was
+static void commit_start(struct start_request *req, bool paused) {
+  size_t i;
+
+  // The device has usually been opened in the background by now. The first play of a session
+  // may still have to wait for it, but has at least done its decoding meanwhile
+  if(audio_device_wait() != 0) {
+    discard_start(req);
+    return;
+  }
+
+  stop_playback_thread();
+
+  kill_openal_source();
+  release_sources();
+
+  // Tracks following on from the queue keep the rate they find, switching there would
+  // break the gapless join
+  if(match_rate) {match_device_rate(req->song->track_data.output_rate);}
 
-  active_sources[0] = new_song;
+  active_sources[0] = req->song;
   active_sources[1] = NULL;
+  tail_prefetched = false;
+  prefetch_consumed(req->song->filename);
+  load_metadata(req->song);
+  open_next_source();
 
 
   alGenSources(1, &source);
 
-  alGenBuffers(2, buffers);
+  buffer_count = req->count;
+  queue_head = 0;
+  alGenBuffers(buffer_count, buffers);
+  for(i = 0; i < buffer_count; i++) {chunk_owners[i] = (struct chunk_owner){.buffer = buffers[i]};}
+  played_frames = req->start_frames;
 
-  bind_chunk(new_song, buf, buf_size, buffers[0]);
-  bind_chunk(new_song, buf_2, buf_size_2, buffers[1]);
-  alSourceQueueBuffers(source, 2, buffers);
-  alSourcePlay(source);
+  for(i = 0; i < buffer_count; i++) {bind_chunk(req->song, req->buf[i], req->size[i], buffers[i]);}
+  alSourceQueueBuffers(source, buffer_count, buffers);
 
-  pthread_create(&thread, NULL, playback_thread, NULL);
+  begin_publish();
+  published.position = track_position();
+  end_publish();
 
+  if(paused) {publish_playing(false);}
+  else {alSourcePlay(source);}
 
-  display_metadata_bar(metadata[1], metadata[2], meta_year, metadata[3]);
-  display_song_playback_bar(metadata[0]);
+  if(!driven && pthread_create(&thread, NULL, playback_thread, NULL) == 0) {thread_running = true;}
+
+
+  struct playback_state state;
+  playback_read_state(&state);
+  display_metadata_bar(state.meta[META_ABLUM_TITLE], state.meta[META_ALBUM_ARTIST], state.year, state.meta[META_TRACK_ARTISTS]);
+  display_song_playback_bar(state.meta[META_TRACK_TITLE]);
+
+  return;
+}
+
+
+void playback_start_at(const char *filename, unsigned int seconds, bool paused) {
+  struct start_request req;
+
+  if(prepare_start(filename, seconds, &req) != 0) {return;}
+  commit_start(&req, paused);
+
+  return;
+}
+
+
+void playback_start(const char *filename) {
+  playback_start_at(filename, 0, false);
+  return;
+}
+
+
+// Reopens the current track at seconds, keeping it paused if it was.
+// Returns -1 if nothing is playing
+int playback_seek(unsigned int seconds) {
+  struct playback_state state;
+  playback_read_state(&state);
+
+  if(!state.active) {return -1;}
+  playback_start_at(state.path, seconds, !state.playing);
+
+  return 0;
+}
+
+
+
+static void *resume_thread_main(void *arg) {
+  (void)arg;
+  int ret = prepare_start(resume_path, resume_seconds, &resume_request);
+  atomic_store(&resume_state, ret == 0 ? RESUME_READY : RESUME_FAILED);
+  return NULL;
+}
+
+
+// Opens, seeks and pre-rolls a track on another thread. playback_resume_update() starts it
+// once it's ready, unless something else has been started in the meantime
+void playback_resume_async(const char *filename, unsigned int seconds, bool paused) {
+  if(atomic_load(&resume_state) != RESUME_NONE) {return;}
+
+  resume_path = strdup(filename);
+  resume_seconds = seconds;
+  resume_paused = paused;
+  atomic_store(&resume_state, RESUME_PREPARING);
+
+  resume_threaded = pthread_create(&resume_thread, NULL, resume_thread_main, NULL) == 0;
+  if(!resume_threaded) {resume_thread_main(NULL);}
+
+  return;
+}
+
+
+// Called every main loop tick
+void playback_resume_update(void) {
+  struct playback_state playing;
+  int state = atomic_load(&resume_state);
+  if(state == RESUME_NONE || state == RESUME_PREPARING) {return;}
+
+  if(resume_threaded) {pthread_join(resume_thread, NULL);}
+
+  // active_sources belong to the playback thread, the published state is what the UI may read
+  playback_read_state(&playing);
+  if(state == RESUME_READY) {
+    if(!playing.active) {commit_start(&resume_request, resume_paused);}
+    else {discard_start(&resume_request);}
+  }
+
+  free(resume_path);
+  resume_path = NULL;
+  atomic_store(&resume_state, RESUME_NONE);
+
+  return;
+}
+
+
+void playback_set_driven(bool on) {
+  driven = on;
+  return;
+}
+
+
+// Whether OpenAL is still playing out queued buffers, which it does for a while after the
+// last track has been fully decoded and playback counts as stopped
+bool playback_draining(void) {
+  ALint state = AL_STOPPED;
+  if(!audio_device_ready()) {return false;}
+  alGetSourcei(source, AL_SOURCE_STATE, &state);
+  alGetError();
+  return state == AL_PLAYING;
+}
+
+
+
+// Switches to another output device ("" for the default, NULL to reopen the same one with new
+// settings). Playback carries on from where it was, seamlessly where OpenAL can move the device
+// under the running context, otherwise by restarting the track at the same second
+int playback_reopen_device(const char *name) {
+  struct playback_state state;
+
+  // Nothing can have been started on a device that isn't open, so there is nothing to tear down
+  if(!audio_device_ready()) {
+    int ret = audio_device_reopen(name);
+    if(ret == 0) {apply_gain();}
+    return ret;
+  }
+  if(audio_device_move(name) == 0) {return 0;}
+
+  playback_read_state(&state);
+  stop_playback_thread();
+  kill_openal_source();
+  release_sources();
+  publish_stopped();
+
+  int ret = audio_device_reopen(name);
+  if(ret == 0) {apply_gain();}
+
+  if(state.active) {playback_start_at(state.path, state.position, !state.playing);}
+
+  return ret;
+}
+
+
+// A fixed mixing rate in Hz, 0 for the device's own, or PLAYBACK_RATE_MATCH to follow the content
+int playback_set_device_rate(int rate) {
+  struct playback_state state;
+
+  match_rate = rate == PLAYBACK_RATE_MATCH;
+  if(match_rate) {
+    // The rate is picked when a track starts, so the current one is started again in place
+    playback_read_state(&state);
+    if(state.active) {playback_start_at(state.path, state.position, !state.playing);}
+    return 0;
+  }
+
+  audio_device_set_frequency(rate > 0 ? rate : 0);
+  return playback_reopen_device(NULL);
+}
+
+
+// Takes effect straight away, by starting the current track again where it is
+void playback_set_buffering(unsigned int count, unsigned int frames) {
+  struct playback_state state;
+
+  if(count < 2) {count = 2;}
+  if(count > PLAYBACK_MAX_BUFFERS) {count = PLAYBACK_MAX_BUFFERS;}
+  if(frames < PLAYBACK_MIN_FRAMES) {frames = PLAYBACK_MIN_FRAMES;}
+  if(frames > PLAYBACK_MAX_FRAMES) {frames = PLAYBACK_MAX_FRAMES;}
+
+  wanted_buffers = count;
+  buffer_frames = frames;
+
+  playback_read_state(&state);
+  if(state.active) {playback_start_at(state.path, state.position, !state.playing);}
+
+  return;
+}
+
+
+void playback_get_buffering(unsigned int *count, unsigned int *frames) {
+  *count = wanted_buffers;
+  *frames = buffer_frames;
+  return;
+}
+
+
+bool playback_matches_rate(void) {
+  return match_rate;
+}
+
+
+
+// Starts the front of the play queue if nothing is playing.
+// While something is, the playback thread takes care of moving down the queue.
+// Goes by the published state, the sources belong to the playback thread while it runs
+void playback_play_queue(void) {
+  struct playback_state state;
+  char *path;
+
+  playback_read_state(&state);
+  while(!state.active && (path = queue_pop())) {
+    playback_start(path);
+    free(path);
+    playback_read_state(&state);
+  }
 
   return;
 }
 
 
 void playback_queue(const char *filename) {
-  AUDIO_SOURCE *new_song = new_audio_source(filename);
-  if(new_song == NULL) {return;}
+  queue_push(filename);
 
-  if(active_sources[1]) {free_audio_source(active_sources[1]);}
-  active_sources[1] = new_song;
+  // Only the first few entries are close enough to playing to be worth warming
+  if(queue_length() <= 2) {prefetch_track(filename);}
 
+  playback_play_queue();
   return;
 }
 
 
+unsigned int playback_track_serial(void) {
+  struct playback_state state;
+  playback_read_state(&state);
+  return state.track_serial;
+}
+
+
 
 
 int set_master_volume(unsigned int val) {
-  float gain = val / 100;
+  float gain = val / 100.0f;
   if(val > MAX_VOLUME) {return 1;}
 
   ALenum error;
+  master_gain = gain;
+  if(audio_device_wait() != 0) {return 0;}
   alListenerf(AL_GAIN, gain);
   if((error = alGetError()) != AL_NO_ERROR) {
     display_msg((char *)alGetString(error));
@@ -488,20 +1197,24 @@ int set_master_volume(unsigned int val) {
 
 
 int check_playback_active(void) {
-  if(active_sources[0]) {return 0;}
+  struct playback_state state;
+  playback_read_state(&state);
+  if(state.active) {return 0;}
   return 1;
 }
 
 int check_playback_state(void) {
-  ALint state;
-  alGetSourcei(source, AL_SOURCE_STATE, &state);
-  if(state == AL_PLAYING) {return 0;}
+  struct playback_state state;
+  playback_read_state(&state);
+  if(state.playing) {return 0;}
   return 1;
 }
 
 
 void playback_pause(void) {
+  if(!audio_device_ready()) {return;}
   alSourcePause(source);
+  publish_playing(false);
 
   // Clear error buffer to avoid misreading it later
   alGetError();
@@ -509,7 +1222,9 @@ void playback_pause(void) {
 }
 
 void playback_unpause(void) {
+  if(!audio_device_ready()) {return;}
   alSourcePlay(source);
+  publish_playing(true);
 
   // ibid.
   alGetError();
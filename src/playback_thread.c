@@ -44,7 +44,8 @@ void usleep_until(void) {
 }
 
 
-void *playback_thread(void *) {
+void *playback_thread(void *arg) {
+  (void)arg;
   usleep(sleep_time);
   last_state = clock() * 1000000 / CLOCKS_PER_SEC;
   if(stop_thread) {
@@ -0,0 +1,327 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <playlist.h>
+#include <queue.h>
+#include <playback.h>
+#include <fs_util.h>
+#include <ui.h>
+
+
+// Entries are handed to the queue in batches this big. The very first entry goes on its own
+// so playback can start while the rest of the file is still being parsed
+#define PLAYLIST_BATCH 512
+
+#define PLAYLIST_WRITE_BUFFER (1024 * 1024)
+
+#define FORMAT_M3U 0
+#define FORMAT_PLS 1
+
+
+static pthread_t loader;
+static bool loader_running = false;
+static volatile bool stop_loader = false;
+
+// Set by the loader thread, acted on by playlist_update() on the main thread
+static atomic_bool first_entry_ready = false;
+static atomic_bool load_finished = false;
+
+static char *playlist_path = NULL;
+static char *playlist_dir = NULL;
+static unsigned long loaded_count = 0;
+static double load_ms = 0;
+static bool load_failed = false;
+
+
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+static int hex_value(char c) {
+  if(c >= '0' && c <= '9') {return c - '0';}
+  if(c >= 'a' && c <= 'f') {return c - 'a' + 10;}
+  if(c >= 'A' && c <= 'F') {return c - 'A' + 10;}
+  return -1;
+}
+
+
+// Turns one playlist line into a malloc'd absolute path, or NULL if the line isn't an entry
+static char *resolve_entry(const char *line, size_t length, int format) {
+  // Trim whitespace and the CR of CRLF files
+  while(length > 0 && (*line == ' ' || *line == '\t')) {line++; length--;}
+  while(length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t')) {length--;}
+
+  if(length == 0) {return NULL;}
+
+  if(format == FORMAT_PLS) {
+    // Only "FileN=path" lines matter, the rest is titles, lengths and the header
+    if(length < 6 || strncasecmp(line, "File", 4) != 0) {return NULL;}
+    const char *equals = memchr(line, '=', length);
+    if(equals == NULL) {return NULL;}
+
+    length -= equals + 1 - line;
+    line = equals + 1;
+    if(length == 0) {return NULL;}
+  }
+  else if(line[0] == '#') {return NULL;}
+
+  char *ret;
+  size_t i, j;
+
+  if(length > 7 && strncmp(line, "file://", 7) == 0) {
+    // Local file URL: the host is empty (file:///...) or localhost, anything else isn't ours to open
+    size_t start = 7;
+    if(length - start >= 10 && strncasecmp(line + start, "localhost/", 10) == 0) {start += 9;}
+    if(line[start] != '/') {return NULL;}
+
+    // Undo the percent encoding
+    ret = malloc(length - start + 1);
+    for(i = start, j = 0; i < length; i++, j++) {
+      if(line[i] == '%' && i + 2 < length && hex_value(line[i + 1]) >= 0 && hex_value(line[i + 2]) >= 0) {
+        ret[j] = hex_value(line[i + 1]) * 16 + hex_value(line[i + 2]);
+        i += 2;
+      }
+      else {ret[j] = line[i];}
+    }
+    ret[j] = 0;
+    return ret;
+  }
+
+  // Absolute paths and anything libavformat can open as a URL are kept as they are
+  if(line[0] == '/' || memmem(line, length, "://", 3)) {return strndup(line, length);}
+
+  size_t dir_length = strlen(playlist_dir);
+  ret = malloc(dir_length + length + 2);
+  memcpy(ret, playlist_dir, dir_length);
+  ret[dir_length] = '/';
+  memcpy(ret + dir_length + 1, line, length);
+  ret[dir_length + length + 1] = 0;
+
+  return ret;
+}
+
+
+
+static void *loader_thread(void *arg) {
+  struct timespec start;
+  struct stat st;
+  char *batch[PLAYLIST_BATCH];
+  unsigned int batch_count = 0;
+  unsigned int batch_limit = 1;
+
+  (void)arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int fd = open(playlist_path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0 || fstat(fd, &st) != 0) {
+    if(fd >= 0) {close(fd);}
+    load_failed = true;
+    atomic_store(&load_finished, true);
+    return NULL;
+  }
+
+  if(st.st_size == 0) {
+    close(fd);
+    atomic_store(&load_finished, true);
+    return NULL;
+  }
+
+  const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    load_failed = true;
+    atomic_store(&load_finished, true);
+    return NULL;
+  }
+  madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+  const char *extension = strrchr(playlist_path, '.');
+  int format = FORMAT_M3U;
+  if((extension && strcasecmp(extension, ".pls") == 0) || (st.st_size >= 10 && strncasecmp(map, "[playlist]", 10) == 0)) {
+    format = FORMAT_PLS;
+  }
+
+  const char *line = map;
+  const char *end = map + st.st_size;
+  const char *newline;
+  char *entry;
+
+  // Skip a UTF-8 byte order mark
+  if(st.st_size >= 3 && memcmp(map, "\xEF\xBB\xBF", 3) == 0) {line += 3;}
+
+  while(line < end && !stop_loader) {
+    newline = memchr(line, '\n', end - line);
+    if(newline == NULL) {newline = end;}
+
+    if((entry = resolve_entry(line, newline - line, format))) {
+      batch[batch_count++] = entry;
+      loaded_count++;
+    }
+
+    if(batch_count == batch_limit) {
+      queue_push_batch(batch, batch_count);
+      batch_count = 0;
+
+      if(batch_limit == 1) {
+        batch_limit = PLAYLIST_BATCH;
+        atomic_store(&first_entry_ready, true);
+      }
+    }
+
+    line = newline + 1;
+  }
+
+  if(batch_count > 0) {queue_push_batch(batch, batch_count);}
+
+  munmap((void *)map, st.st_size);
+
+  load_ms = elapsed_ms(&start);
+  atomic_store(&load_finished, true);
+
+  return NULL;
+}
+
+
+
+static void join_loader(void) {
+  if(!loader_running) {return;}
+
+  pthread_join(loader, NULL);
+  loader_running = false;
+
+  free(playlist_path);
+  free(playlist_dir);
+  playlist_path = NULL;
+  playlist_dir = NULL;
+
+  return;
+}
+
+
+// Starts appending the playlist at path to the play queue in the background.
+// Returns 1 if another playlist is still loading, -1 if the loader thread couldn't be started
+int playlist_load(const char *path) {
+  if(loader_running) {return 1;}
+
+  playlist_path = absolute_path(path);
+  playlist_dir = strdup(playlist_path);
+  *strrchr(playlist_dir, '/') = 0;
+
+  loaded_count = 0;
+  load_failed = false;
+  stop_loader = false;
+  atomic_store(&first_entry_ready, false);
+  atomic_store(&load_finished, false);
+
+  if(pthread_create(&loader, NULL, loader_thread, NULL) != 0) {
+    free(playlist_path);
+    free(playlist_dir);
+    playlist_path = NULL;
+    playlist_dir = NULL;
+    return -1;
+  }
+  loader_running = true;
+
+  return 0;
+}
+
+
+// Called once per tick from the main loop, so playback and messages only ever start from the UI thread
+void playlist_update(void) {
+  char msg[160];
+
+  if(!loader_running) {return;}
+
+  if(atomic_exchange(&first_entry_ready, false)) {playback_play_queue();}
+
+  if(atomic_load(&load_finished)) {
+    if(load_failed) {
+      display_msg("TJ_ERR: Failed to read playlist.");
+    }
+    else {
+      snprintf(msg, sizeof(msg), "Queued %lu tracks from playlist in %.1f ms.", loaded_count, load_ms);
+      display_msg(msg);
+    }
+
+    join_loader();
+  }
+
+  return;
+}
+
+
+int playlist_loading(void) {
+  return loader_running;
+}
+
+
+void playlist_cleanup(void) {
+  stop_loader = true;
+  join_loader();
+  return;
+}
+
+
+
+// Writes the play queue out as an M3U playlist, one entry at a time through a large stdio buffer.
+// Returns 0 on success
+int playlist_save(const char *path) {
+  FILE *file = fopen(path, "w");
+  if(file == NULL) {return -1;}
+
+  char *write_buffer = malloc(PLAYLIST_WRITE_BUFFER);
+  setvbuf(file, write_buffer, _IOFBF, PLAYLIST_WRITE_BUFFER);
+
+  fputs("#EXTM3U\n", file);
+
+  unsigned int i;
+  char *entry;
+  for(i = 0; (entry = queue_copy_entry(i)); i++) {
+    fputs(entry, file);
+    fputc('\n', file);
+    free(entry);
+  }
+
+  int ret = ferror(file);
+  if(fclose(file) != 0) {ret = -1;}
+  free(write_buffer);
+
+  return ret;
+}
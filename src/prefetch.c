@@ -0,0 +1,454 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include <prefetch.h>
+#include <fs_util.h>
+#include <mem.h>
+
+
+#define PREFETCH_JOB_SLOTS 16
+#define PREFETCH_LEDGER_SLOTS 32
+
+// readahead() is issued in pieces this big, so a stop request or memory pressure is noticed quickly
+#define PREFETCH_CHUNK (1024 * 1024)
+
+// readahead() only starts the I/O, each piece is then waited for until it's resident, for at most this long
+#define PREFETCH_STEP_WAIT_MS 200
+#define PREFETCH_POLL_MS 2
+
+// The file window cursor has to rest on a file this long before it gets warmed
+#define PREFETCH_HINT_DELAY_MS 250
+
+// Files warmed this long ago stop counting against the budget. By then they have either
+// been played or the kernel has had every chance to reclaim them
+#define PREFETCH_LEDGER_TTL 120
+
+// Memory is considered under pressure once tasks have been stalled on it for this many percent
+// of the last 10 seconds (/proc/pressure/memory), or if MemAvailable drops below this many budgets
+#define PRESSURE_AVG10_LIMIT 5.0
+#define PRESSURE_AVAILABLE_BUDGETS 4
+
+// Not exported by glibc
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+#define MEGABYTE (1024 * 1024)
+
+
+struct prefetch_job {
+  char *path;
+  bool whole_file;
+};
+
+struct ledger_entry {
+  char *path;
+  unsigned long bytes;
+  time_t when;
+};
+
+
+static pthread_t thread;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static bool running = false;
+static volatile bool stop_prefetch = false;
+
+static struct prefetch_job jobs[PREFETCH_JOB_SLOTS];
+static unsigned int job_head = 0;
+static unsigned int job_count = 0;
+
+static char *pending_hint = NULL;
+static struct timespec hint_time;
+
+// Only touched by the prefetch thread, apart from prefetch_consumed() and status reads under the lock
+static struct ledger_entry ledger[PREFETCH_LEDGER_SLOTS];
+static unsigned int ledger_count = 0;
+static unsigned long warmed_bytes = 0;
+
+static unsigned long budget_bytes = 64UL * MEGABYTE;
+static unsigned long head_bytes = 4UL * MEGABYTE;
+static volatile bool under_pressure = false;
+
+
+
+static bool memory_under_pressure(void) {
+  char buf[256];
+  int fd, len;
+  char *field;
+
+  fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+  if(fd >= 0) {
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if(len > 0) {
+      buf[len] = 0;
+      if((field = strstr(buf, "avg10="))) {
+        return strtod(field + 6, NULL) > PRESSURE_AVG10_LIMIT;
+      }
+    }
+  }
+
+  // Kernels without PSI, go by available memory instead
+  fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return false;}
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(len <= 0) {return false;}
+  buf[len] = 0;
+
+  if((field = strstr(buf, "MemAvailable:")) == NULL) {return false;}
+  unsigned long available_kb = strtoul(field + 13, NULL, 10);
+
+  return available_kb * 1024 < budget_bytes * PRESSURE_AVAILABLE_BUDGETS;
+}
+
+
+
+static struct ledger_entry *ledger_find(const char *path) {
+  size_t i;
+  for(i = 0; i < ledger_count; i++) {
+    if(strcmp(ledger[i].path, path) == 0) {return &ledger[i];}
+  }
+
+  return NULL;
+}
+
+
+static void ledger_remove(struct ledger_entry *entry) {
+  warmed_bytes -= entry->bytes;
+  free(entry->path);
+
+  *entry = ledger[ledger_count - 1];
+  ledger_count--;
+
+  return;
+}
+
+
+static void ledger_expire(void) {
+  time_t now = time(NULL);
+  int i;
+
+  for(i = ledger_count - 1; i >= 0; i--) {
+    if(now - ledger[i].when > PREFETCH_LEDGER_TTL) {ledger_remove(&ledger[i]);}
+  }
+
+  return;
+}
+
+
+
+// Polls mincore() until every page of the range is in the page cache, so the next piece is only asked
+// for once this one has arrived, and memory pressure is looked at between pieces that really landed
+static void wait_resident(int fd, unsigned long offset, unsigned long length) {
+  struct timespec pause = {0, PREFETCH_POLL_MS * 1000000L};
+  long page = sysconf(_SC_PAGESIZE);
+  size_t pages = (length + page - 1) / page;
+  size_t i;
+  int waited;
+
+  // offset is always a multiple of PREFETCH_CHUNK, so page aligned
+  void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+  if(map == MAP_FAILED) {return;}
+  unsigned char *resident = malloc(pages);
+
+  for(waited = 0; waited < PREFETCH_STEP_WAIT_MS && !stop_prefetch; waited += PREFETCH_POLL_MS) {
+    if(mincore(map, length, resident) != 0) {break;}
+
+    for(i = 0; i < pages && (resident[i] & 1); i++);
+    if(i == pages) {break;}
+
+    nanosleep(&pause, NULL);
+  }
+
+  free(resident);
+  munmap(map, length);
+  return;
+}
+
+
+static void run_job(struct prefetch_job *job) {
+  struct stat st;
+
+  pthread_mutex_lock(&prefetch_lock);
+  ledger_expire();
+
+  struct ledger_entry *entry = ledger_find(job->path);
+  unsigned long start = entry ? entry->bytes : 0;
+  unsigned long available = warmed_bytes < budget_bytes ? budget_bytes - warmed_bytes : 0;
+
+  // Bytes that can't be written down can't be counted against the budget, so a full ledger warms nothing new
+  if(entry == NULL && ledger_count == PREFETCH_LEDGER_SLOTS) {available = 0;}
+  pthread_mutex_unlock(&prefetch_lock);
+
+  // Warming is the first thing to go when Trackjack itself is over its memory budget
+  under_pressure = memory_under_pressure();
+  if(under_pressure || available == 0 || mem_over_budget()) {return;}
+
+  int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return;}
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return;
+  }
+
+  unsigned long size = st.st_size;
+  unsigned long end = job->whole_file ? size : head_bytes;
+  if(end > size) {end = size;}
+  if(end > start + available) {end = start + available;}
+
+  unsigned long offset = start;
+  unsigned long length;
+
+  while(offset < end && !stop_prefetch) {
+    length = end - offset;
+    if(length > PREFETCH_CHUNK) {length = PREFETCH_CHUNK;}
+
+    if(readahead(fd, offset, length) != 0) {
+      posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+    }
+    wait_resident(fd, offset, length);
+    offset += length;
+
+    if((under_pressure = memory_under_pressure())) {break;}
+  }
+
+  close(fd);
+
+  if(offset == start) {return;}
+
+  pthread_mutex_lock(&prefetch_lock);
+  // prefetch_consumed() may have dropped the entry meanwhile, but never adds one, so there is still room
+  if((entry = ledger_find(job->path)) == NULL) {
+    entry = &ledger[ledger_count++];
+    entry->path = strdup(job->path);
+    entry->bytes = 0;
+  }
+  warmed_bytes += offset - entry->bytes;
+  entry->bytes = offset;
+  entry->when = time(NULL);
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return;
+}
+
+
+
+static bool hint_ready(struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  *deadline = hint_time;
+  deadline->tv_nsec += PREFETCH_HINT_DELAY_MS * 1000000L;
+  if(deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+
+  if(now.tv_sec != deadline->tv_sec) {return now.tv_sec > deadline->tv_sec;}
+  return now.tv_nsec >= deadline->tv_nsec;
+}
+
+
+static void *prefetch_thread(void *arg) {
+  struct prefetch_job job;
+  struct timespec deadline;
+
+  (void)arg;
+
+  // Lowest CPU and IO priority, so warming never competes with the playback thread
+  pid_t tid = syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, tid, 19);
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+  pthread_mutex_lock(&prefetch_lock);
+  while(!stop_prefetch) {
+    if(job_count > 0) {
+      job = jobs[job_head];
+      job_head = (job_head + 1) % PREFETCH_JOB_SLOTS;
+      job_count--;
+    }
+    else if(pending_hint) {
+      if(!hint_ready(&deadline)) {
+        pthread_cond_timedwait(&prefetch_cond, &prefetch_lock, &deadline);
+        continue;
+      }
+      job.path = pending_hint;
+      job.whole_file = false;
+      pending_hint = NULL;
+    }
+    else {
+      pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&prefetch_lock);
+    run_job(&job);
+    free(job.path);
+    pthread_mutex_lock(&prefetch_lock);
+  }
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return NULL;
+}
+
+
+
+void prefetch_init(void) {
+  stop_prefetch = false;
+  if(pthread_create(&thread, NULL, prefetch_thread, NULL) == 0) {running = true;}
+  return;
+}
+
+
+void prefetch_cleanup(void) {
+  if(!running) {return;}
+
+  pthread_mutex_lock(&prefetch_lock);
+  stop_prefetch = true;
+  pthread_cond_signal(&prefetch_cond);
+  pthread_mutex_unlock(&prefetch_lock);
+  pthread_join(thread, NULL);
+  running = false;
+
+  while(job_count > 0) {
+    free(jobs[job_head].path);
+    job_head = (job_head + 1) % PREFETCH_JOB_SLOTS;
+    job_count--;
+  }
+  if(pending_hint) {free(pending_hint);}
+  pending_hint = NULL;
+
+  while(ledger_count > 0) {ledger_remove(&ledger[0]);}
+
+  return;
+}
+
+
+
+static void push_job(const char *path, bool whole_file) {
+  if(!running) {return;}
+
+  pthread_mutex_lock(&prefetch_lock);
+
+  // When the queue is full the oldest request is the least likely to still matter
+  if(job_count == PREFETCH_JOB_SLOTS) {
+    free(jobs[job_head].path);
+    job_head = (job_head + 1) % PREFETCH_JOB_SLOTS;
+    job_count--;
+  }
+
+  struct prefetch_job *job = &jobs[(job_head + job_count) % PREFETCH_JOB_SLOTS];
+  job->path = absolute_path(path);
+  job->whole_file = whole_file;
+  job_count++;
+
+  pthread_cond_signal(&prefetch_cond);
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return;
+}
+
+
+void prefetch_track(const char *path) {
+  push_job(path, false);
+  return;
+}
+
+void prefetch_rest(const char *path) {
+  push_job(path, true);
+  return;
+}
+
+
+// Cursor movement in the file window. Only the latest hint is kept,
+// and it is only acted on once the cursor has rested for a moment
+void prefetch_hint(const char *path) {
+  if(!running) {return;}
+
+  pthread_mutex_lock(&prefetch_lock);
+  if(pending_hint) {free(pending_hint);}
+  pending_hint = absolute_path(path);
+  clock_gettime(CLOCK_REALTIME, &hint_time);
+
+  pthread_cond_signal(&prefetch_cond);
+  pthread_mutex_unlock(&prefetch_lock);
+
+  return;
+}
+
+
+// The track is being played now, so what was warmed for it no longer counts against the budget
+void prefetch_consumed(const char *path) {
+  char *full_path = absolute_path(path);
+
+  pthread_mutex_lock(&prefetch_lock);
+  struct ledger_entry *entry = ledger_find(full_path);
+  if(entry) {ledger_remove(entry);}
+  pthread_mutex_unlock(&prefetch_lock);
+
+  free(full_path);
+  return;
+}
+
+
+
+void prefetch_set_budget(unsigned int mb) {
+  pthread_mutex_lock(&prefetch_lock);
+  budget_bytes = (unsigned long)mb * MEGABYTE;
+  pthread_mutex_unlock(&prefetch_lock);
+  return;
+}
+
+void prefetch_set_head(unsigned int mb) {
+  pthread_mutex_lock(&prefetch_lock);
+  head_bytes = (unsigned long)mb * MEGABYTE;
+  pthread_mutex_unlock(&prefetch_lock);
+  return;
+}
+
+
+void prefetch_read_status(struct prefetch_status *out) {
+  pthread_mutex_lock(&prefetch_lock);
+  out->budget_mb = budget_bytes / MEGABYTE;
+  out->head_mb = head_bytes / MEGABYTE;
+  out->warmed_bytes = warmed_bytes;
+  out->tracked_files = ledger_count;
+  out->under_pressure = under_pressure;
+  pthread_mutex_unlock(&prefetch_lock);
+  return;
+}
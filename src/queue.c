@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <queue.h>
+#include <fs_util.h>
+#include <sort.h>
+
+
+// The queue is a ring of path strings. Capacity is always a power of two so wrapping is a mask,
+// and it only ever grows by doubling, so pushing and popping at either end is O(1)
+#define QUEUE_INITIAL_CAPACITY 64
+
+#define SLOT(i) ring[(head + (i)) & (capacity - 1)]
+
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char **ring = NULL;
+static unsigned int capacity = 0;
+static unsigned int head = 0;
+static unsigned int count = 0;
+
+
+
+static void grow_ring(void) {
+  unsigned int new_capacity = capacity ? capacity * 2 : QUEUE_INITIAL_CAPACITY;
+  char **new_ring = malloc(new_capacity * sizeof(char *));
+  size_t i;
+
+  for(i = 0; i < count; i++) {
+    new_ring[i] = SLOT(i);
+  }
+
+  free(ring);
+  ring = new_ring;
+  capacity = new_capacity;
+  head = 0;
+
+  return;
+}
+
+
+
+void queue_push(const char *path) {
+  char *entry = absolute_path(path);
+
+  pthread_mutex_lock(&queue_lock);
+  if(count == capacity) {grow_ring();}
+  SLOT(count) = entry;
+  count++;
+  pthread_mutex_unlock(&queue_lock);
+
+  return;
+}
+
+
+// Appends count entries at once, taking ownership of them. Entries must already be absolute paths.
+// Used by bulk loaders so they take the lock once per batch rather than once per track
+void queue_push_batch(char **entries, unsigned int batch_count) {
+  size_t i;
+
+  pthread_mutex_lock(&queue_lock);
+  for(i = 0; i < batch_count; i++) {
+    if(count == capacity) {grow_ring();}
+    SLOT(count) = entries[i];
+    count++;
+  }
+  pthread_mutex_unlock(&queue_lock);
+
+  return;
+}
+
+
+// Positions past the end append. Whichever side of the position is shorter gets shifted
+void queue_insert(unsigned int position, const char *path) {
+  char *entry = absolute_path(path);
+  size_t i;
+
+  pthread_mutex_lock(&queue_lock);
+  if(count == capacity) {grow_ring();}
+  if(position > count) {position = count;}
+
+  if(position < count / 2) {
+    head = (head - 1) & (capacity - 1);
+    for(i = 0; i < position; i++) {
+      SLOT(i) = SLOT(i + 1);
+    }
+  }
+  else {
+    for(i = count; i > position; i--) {
+      SLOT(i) = SLOT(i - 1);
+    }
+  }
+
+  SLOT(position) = entry;
+  count++;
+  pthread_mutex_unlock(&queue_lock);
+
+  return;
+}
+
+
+int queue_remove(unsigned int position) {
+  size_t i;
+
+  pthread_mutex_lock(&queue_lock);
+  if(position >= count) {
+    pthread_mutex_unlock(&queue_lock);
+    return 1;
+  }
+
+  free(SLOT(position));
+
+  if(position < count / 2) {
+    for(i = position; i > 0; i--) {
+      SLOT(i) = SLOT(i - 1);
+    }
+    head = (head + 1) & (capacity - 1);
+  }
+  else {
+    for(i = position; i < count - 1; i++) {
+      SLOT(i) = SLOT(i + 1);
+    }
+  }
+
+  count--;
+  pthread_mutex_unlock(&queue_lock);
+
+  return 0;
+}
+
+
+// Returns the path at the front of the queue, which the caller now owns, or NULL if the queue is empty
+char *queue_pop(void) {
+  char *ret = NULL;
+
+  pthread_mutex_lock(&queue_lock);
+  if(count > 0) {
+    ret = SLOT(0);
+    head = (head + 1) & (capacity - 1);
+    count--;
+  }
+  pthread_mutex_unlock(&queue_lock);
+
+  return ret;
+}
+
+
+// Copy of the path at position, for display. NULL if there is no such entry
+char *queue_copy_entry(unsigned int position) {
+  char *ret = NULL;
+
+  pthread_mutex_lock(&queue_lock);
+  if(position < count) {ret = strdup(SLOT(position));}
+  pthread_mutex_unlock(&queue_lock);
+
+  return ret;
+}
+
+
+unsigned int queue_length(void) {
+  pthread_mutex_lock(&queue_lock);
+  unsigned int ret = count;
+  pthread_mutex_unlock(&queue_lock);
+
+  return ret;
+}
+
+
+void queue_clear(void) {
+  size_t i;
+
+  pthread_mutex_lock(&queue_lock);
+  for(i = 0; i < count; i++) {
+    free(SLOT(i));
+  }
+  head = 0;
+  count = 0;
+  pthread_mutex_unlock(&queue_lock);
+
+  return;
+}
+
+
+
+// Some filesystems (NFS, FUSE, older XFS) don't fill in d_type. Those entries and symlinks
+// are stat()ed once the directory is known, as walk.c does
+static int audio_file_filter(const struct dirent *file) {
+  if(file->d_type != DT_REG && file->d_type != DT_UNKNOWN && file->d_type != DT_LNK) {return 0;}
+  if(file->d_name[0] == '.') {return 0;}
+
+  return is_audio_filename(file->d_name);
+}
+
+
+// Queues every audio file directly inside dir, in the same order the file window lists them.
+// Returns how many were queued, or -1 if dir couldn't be read
+int queue_push_dir(const char *dir) {
+  struct dirent **namelist;
+  struct stat st;
+  int i, queued = 0;
+
+  int file_count = scandir(dir, &namelist, audio_file_filter, NULL);
+  if(file_count < 0) {return -1;}
+  sort_dirents(dir, namelist, file_count, SORT_NAME);
+
+  for(i = 0; i < file_count; i++) {
+    char *path = malloc(strlen(dir) + strlen(namelist[i]->d_name) + 2);
+    sprintf(path, "%s/%s", dir, namelist[i]->d_name);
+
+    if(namelist[i]->d_type == DT_REG || (stat(path, &st) == 0 && S_ISREG(st.st_mode))) {
+      queue_push(path);
+      queued++;
+    }
+
+    free(path);
+    free(namelist[i]);
+  }
+  free(namelist);
+
+  return queued;
+}
@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <render.h>
+#include <audio_device.h>
+#include <playback.h>
+#include <export.h>
+#include <ui.h>
+
+
+// --render: the whole playback path, decoding, bind_chunk(), the buffer queue, gain and OpenAL's
+// mixer, but into a loopback device that is pulled from as fast as the CPU allows instead of a
+// sound card. The mix goes to a WAV file or nowhere ("null"). Either way its checksum is printed
+// at the end, so two builds can be compared without keeping the output around
+
+
+#define RENDER_CHANNELS 2
+
+
+static bool active = false;
+static int out_fd = -1;
+static int render_rate = 0;
+static uint64_t rendered_frames = 0;
+static uint64_t checksum = 14695981039346656037ULL;
+static struct timespec started;
+static double mixing_seconds = 0;
+static float block[RENDER_BLOCK * RENDER_CHANNELS];
+
+
+
+static double seconds_since(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// Returns 0 on success. Has to come before anything opens the audio device
+int render_open(const char *output, int rate) {
+  if(rate <= 0) {rate = RENDER_DEFAULT_RATE;}
+
+  if(strcmp(output, "null") != 0) {
+    out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(out_fd < 0) {
+      fprintf(stderr, "Could not open '%s' for writing: %s\n", output, strerror(errno));
+      return -1;
+    }
+    // Filled in properly once the length is known
+    write_wav_header(out_fd, SAMPLE_F32, rate, RENDER_CHANNELS, 0);
+    lseek(out_fd, WAV_HEADER_SIZE, SEEK_SET);
+  }
+
+  if(audio_device_open_loopback(rate) != 0) {
+    fprintf(stderr, "OpenAL has no loopback device (ALC_SOFT_loopback) at %d Hz\n", rate);
+    if(out_fd >= 0) {close(out_fd);}
+    out_fd = -1;
+    return -1;
+  }
+
+  playback_set_driven(true);
+  render_rate = rate;
+  active = true;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  return 0;
+}
+
+
+bool render_active(void) {
+  return active;
+}
+
+
+static void write_block(const void *data, size_t length) {
+  size_t written = 0;
+  ssize_t ret;
+
+  while(written < length) {
+    ret = write(out_fd, (const char *)data + written, length - written);
+    if(ret < 0) {
+      if(errno == EINTR) {continue;}
+      fprintf(stderr, "Writing the render failed: %s\n", strerror(errno));
+      close(out_fd);
+      out_fd = -1;
+      return;
+    }
+    written += ret;
+  }
+
+  return;
+}
+
+
+// Mixes one block, then lets playback refill whatever buffers that used up,
+// the way the playback thread would have after that much time
+void render_step(void) {
+  struct timespec mix_start;
+  const uint8_t *bytes = (const uint8_t *)block;
+  size_t length = sizeof(block);
+  size_t i;
+
+  if(!active) {return;}
+
+  clock_gettime(CLOCK_MONOTONIC, &mix_start);
+  audio_device_render(block, RENDER_BLOCK);
+  mixing_seconds += seconds_since(&mix_start);
+
+  for(i = 0; i < length; i++) {
+    checksum ^= bytes[i];
+    checksum *= 1099511628211ULL;
+  }
+  if(out_fd >= 0) {write_block(block, length);}
+  rendered_frames += RENDER_BLOCK;
+
+  playback_update();
+  return;
+}
+
+
+// Renders what OpenAL still has queued once the last track has been decoded
+void render_drain(void) {
+  while(active && playback_draining()) {render_step();}
+  return;
+}
+
+
+void render_close(void) {
+  char buffer[256];
+
+  if(!active) {return;}
+  active = false;
+
+  if(out_fd >= 0) {
+    write_wav_header(out_fd, SAMPLE_F32, render_rate, RENDER_CHANNELS, rendered_frames * RENDER_CHANNELS * sizeof(float));
+    close(out_fd);
+    out_fd = -1;
+  }
+
+  double audio_seconds = (double)rendered_frames / render_rate;
+  double wall_seconds = seconds_since(&started);
+
+  snprintf(buffer, sizeof(buffer), "Rendered %.1f s at %d Hz in %.2f s (%.0fx realtime), %.2f s of it in the mixer. Checksum %016llx", audio_seconds, render_rate, wall_seconds, wall_seconds > 0 ? audio_seconds / wall_seconds : 0, mixing_seconds, (unsigned long long)checksum);
+  display_msg(buffer);
+
+  return;
+}
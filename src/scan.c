@@ -0,0 +1,257 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+
+#include <audio_source.h>
+#include <audio_device.h>
+#include <mem.h>
+#include <fs_util.h>
+#include <ui.h>
+
+
+// Each resampling preset gets to decode at most this much of the file
+#define BENCH_SECONDS 120
+
+struct scan_totals {
+  unsigned int tracks;
+  unsigned int failed;
+  unsigned long seconds;
+};
+
+
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+static void scan_tree(const char *dir, struct scan_totals *totals) {
+  DIR *handle = opendir(dir);
+  struct dirent *entry;
+
+  if(handle == NULL) {return;}
+
+  while((entry = readdir(handle))) {
+    if(entry->d_name[0] == '.') {continue;}
+    if(entry->d_type != DT_DIR && !is_audio_filename(entry->d_name)) {continue;}
+
+    char *path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+    sprintf(path, "%s/%s", dir, entry->d_name);
+
+    if(entry->d_type == DT_DIR) {
+      scan_tree(path, totals);
+    }
+    else {
+      AUDIO_SOURCE *song = new_audio_source(path);
+      if(song) {
+        totals->tracks++;
+        totals->seconds += song->track_data.duration;
+        free_audio_source(song);
+      }
+      else {totals->failed++;}
+    }
+
+    free(path);
+  }
+
+  closedir(handle);
+  return;
+}
+
+
+// Probes every audio file under dir and reports how much music is there
+void scan_cmd(char *dir) {
+  struct scan_totals totals = {0};
+  struct timespec start;
+  char msg[160];
+
+  if(*dir == 0) {dir = ".";}
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  scan_tree(dir, &totals);
+
+  snprintf(msg, sizeof(msg), "Scanned %s: %u tracks (%u unreadable), %lu:%02lu:%02lu total, in %.0f ms", dir, totals.tracks, totals.failed, totals.seconds / 3600, totals.seconds / 60 % 60, totals.seconds % 60, elapsed_ms(&start));
+  display_msg(msg);
+
+  return;
+}
+
+
+
+// Decodes a whole file through the playback pipeline and reports its levels and how fast it decoded
+void analyze_cmd(char *path) {
+  struct timespec start;
+  char msg[160];
+  uint8_t *buf;
+  int buf_size;
+  int i;
+
+  if(*path == 0) {
+    display_msg("Usage: analyze <file>");
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  AUDIO_SOURCE *song = new_audio_source(path);
+  if(song == NULL) {return;}
+  if(prep_audio_source_rate(song, 0) < 0) {
+    free_audio_source(song);
+    return;
+  }
+
+  float peak = 0;
+  double sum_squares = 0;
+  unsigned long samples = 0;
+
+  while((buf = decode_chunk(song, &buf_size))) {
+    float *pcm = (float *)buf;
+    int count = buf_size / sizeof(float);
+
+    for(i = 0; i < count; i++) {
+      float value = fabsf(pcm[i]);
+      if(value > peak) {peak = value;}
+      sum_squares += pcm[i] * pcm[i];
+    }
+    samples += count;
+
+    mem_free(buf);
+  }
+
+  double seconds = samples / (double)(song->track_data.channels * song->track_data.samplerate);
+  double rms = samples ? sqrt(sum_squares / samples) : 0;
+  double ms = elapsed_ms(&start);
+
+  snprintf(msg, sizeof(msg), "%s: %d:%02d, peak %.1f dBFS, RMS %.1f dBFS, decoded at %.0fx realtime", path, (int)seconds / 60, (int)seconds % 60, 20 * log10(peak > 0 ? peak : 1e-10), 20 * log10(rms > 0 ? rms : 1e-10), ms > 0 ? seconds * 1000 / ms : 0);
+  display_msg(msg);
+
+  free_audio_source(song);
+  return;
+}
+
+
+
+static double thread_cpu_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+// Decodes the start of the file converted to rate with one preset, and returns the CPU time it took.
+// quality comes back as the preset that was really used. Negative if the file can't be decoded
+static double bench_decode(const char *path, int rate, int *quality, double *seconds) {
+  uint8_t *buf;
+  int buf_size;
+  unsigned long frames = 0;
+
+  AUDIO_SOURCE *song = new_audio_source(path);
+  if(song == NULL) {return -1;}
+
+  double start = thread_cpu_ms();
+  if(prep_audio_source_quality(song, rate, *quality) < 0) {
+    free_audio_source(song);
+    return -1;
+  }
+  *quality = song->resample_quality;
+
+  unsigned long limit = (unsigned long)BENCH_SECONDS * song->track_data.output_rate;
+  int frame_size = song->track_data.channels * sizeof(float);
+
+  while(frames < limit && (buf = decode_chunk(song, &buf_size))) {
+    frames += buf_size / frame_size;
+    mem_free(buf);
+  }
+
+  double ms = thread_cpu_ms() - start;
+  *seconds = frames / (double)song->track_data.output_rate;
+
+  free_audio_source(song);
+  return ms;
+}
+
+
+// 'resample bench <file> [rate]': what each preset costs on this machine, decoding included,
+// and how much of that is the conversion itself
+void resample_bench_cmd(char *arg) {
+  char msg[200];
+  char *path = arg;
+  int rate = 0;
+  int quality, used;
+  double seconds, ms, base_ms;
+
+  // A trailing number is the rate to convert to, the rest is the file
+  char *last = strrchr(arg, ' ');
+  if(last && last[1] && strspn(last + 1, "0123456789") == strlen(last + 1)) {
+    rate = atoi(last + 1);
+    *last = 0;
+  }
+
+  if(*path == 0) {
+    display_msg("Usage: resample bench <file> [rate]");
+    return;
+  }
+
+  AUDIO_SOURCE *song = new_audio_source(path);
+  if(song == NULL) {return;}
+  int source_rate = song->codec_param->sample_rate;
+  free_audio_source(song);
+
+  if(rate == 0 && audio_device_ready()) {
+    struct audio_device_status status;
+    audio_device_read_status(&status);
+    rate = status.frequency;
+  }
+  // Converting to the file's own rate is a no-op, so pick the other common one
+  if(rate == 0 || rate == source_rate) {rate = source_rate == 48000 ? 44100 : 48000;}
+
+  used = RESAMPLE_OFF;
+  base_ms = bench_decode(path, 0, &used, &seconds);
+  if(base_ms < 0) {return;}
+
+  snprintf(msg, sizeof(msg), "%s: %.0f s, %d Hz to %d Hz. Decoding alone: %.0f ms CPU, %.0fx realtime", path, seconds, source_rate, rate, base_ms, base_ms > 0 ? seconds * 1000 / base_ms : 0);
+  display_msg(msg);
+
+  for(quality = RESAMPLE_LINEAR; quality <= MAX_RESAMPLE; quality++) {
+    used = quality;
+    ms = bench_decode(path, rate, &used, &seconds);
+    if(ms < 0) {continue;}
+
+    if(used != quality) {
+      snprintf(msg, sizeof(msg), "%-9s not available in this build of swresample", resample_quality_name(quality));
+    }
+    else {
+      double resample_ms = ms > base_ms ? ms - base_ms : 0;
+      snprintf(msg, sizeof(msg), "%-9s %6.0f ms CPU, %5.0f ms resampling (%.2f%% of a core), %.0fx realtime", resample_quality_name(quality), ms, resample_ms, seconds > 0 ? resample_ms / (seconds * 10) : 0, ms > 0 ? seconds * 1000 / ms : 0);
+    }
+    display_msg(msg);
+  }
+
+  return;
+}
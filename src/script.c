@@ -0,0 +1,187 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <script.h>
+#include <fs_util.h>
+#include <jobs.h>
+#include <playback.h>
+#include <playlist.h>
+#include <walk.h>
+#include <ui.h>
+#include <render.h>
+#include <mem.h>
+
+
+void parse_cmd(char *command);
+
+
+// Commands that don't touch playback or change the current directory, and so can be
+// run in the background of a script by ending the line with '&'. Their path arguments are
+// made absolute first (see absolute_command()), a later 'open' would move relative ones
+static const char *parallel_commands[] = {"scan", "analyze", "export", NULL};
+
+
+
+static bool parallel_safe(const char *command) {
+  size_t length;
+  int i;
+
+  for(i = 0; parallel_commands[i]; i++) {
+    length = strlen(parallel_commands[i]);
+    if(strncmp(command, parallel_commands[i], length) == 0 && (command[length] == 0 || command[length] == ' ')) {return true;}
+  }
+
+  return false;
+}
+
+
+// A background command resolves its relative paths whenever its job gets to them, against whatever
+// directory the script has moved on to by then. So they are resolved here, while the line is read.
+// scan and analyze take the rest of the line as one path, export its first two words.
+// Returns a malloc'd command line
+static char *absolute_command(const char *command) {
+  char *copy = strdup(command);
+  char *args = strchr(copy, ' ');
+  char *ret, *first, *second;
+
+  if(args) {*args++ = 0;}
+  else {args = copy + strlen(copy);}
+  while(*args == ' ') {args++;}
+
+  if(strcmp(copy, "export") == 0) {
+    first = next_arg(&args);
+    second = first ? next_arg(&args) : NULL;
+    if(second == NULL) {
+      free(copy);
+      return strdup(command);
+    }
+
+    char *src = absolute_path(first);
+    char *dst = absolute_path(second);
+    ret = malloc(strlen(src) + strlen(dst) + strlen(args) + 16);
+    sprintf(ret, "export \"%s\" \"%s\" %s", src, dst, args);
+    free(src);
+    free(dst);
+  }
+  else if(*args || strcmp(copy, "scan") == 0) {
+    // A bare 'scan' means the directory the script is in now
+    char *path = *args ? absolute_path(args) : getcwd(NULL, 0);
+    if(path == NULL) {path = strdup(".");}
+    ret = malloc(strlen(copy) + strlen(path) + 2);
+    sprintf(ret, "%s %s", copy, path);
+    free(path);
+  }
+  else {ret = strdup(command);}
+
+  free(copy);
+  return ret;
+}
+
+
+// Blocks until background jobs are done and playback has run out,
+// doing the main loop's housekeeping meanwhile since there is no main loop.
+// When rendering offline, playback only moves on as fast as it is rendered here
+static void script_wait(void) {
+  unsigned int last_track = playback_track_serial();
+  struct playback_state state;
+
+  while(jobs_running() || playlist_loading() || walk_running() || check_playback_active() == 0 || check_playback_state() == 0) {
+    playlist_update();
+    walk_update();
+    mem_release();
+
+    playback_read_state(&state);
+    if(last_track != state.track_serial) {
+      last_track = state.track_serial;
+      if(state.active) {display_song_playback_bar(state.meta[META_TRACK_TITLE]);}
+    }
+
+    if(render_active() && check_playback_state() == 0) {render_step();}
+    else {usleep(50000);}
+  }
+
+  if(render_active()) {render_drain();}
+
+  return;
+}
+
+
+// Runs each line of the file at path as a command, without ever starting ncurses.
+// "wait" blocks until background jobs and playback are done, which also happens at the end of the script.
+// Returns 0, or -1 if the script couldn't be read
+int run_script(const char *path) {
+  FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+
+  if(file == NULL) {
+    fprintf(stderr, "Could not open script '%s'\n", path);
+    return -1;
+  }
+
+  while((length = getline(&line, &capacity, file)) >= 0) {
+    char *command = line;
+
+    while(length > 0 && (command[length - 1] == '\n' || command[length - 1] == '\r' || command[length - 1] == ' ')) {
+      command[--length] = 0;
+    }
+    while(*command == ' ' || *command == '\t') {command++;}
+
+    if(*command == 0 || *command == '#') {continue;}
+    if(strcmp(command, "q") == 0) {break;}
+
+    if(strcmp(command, "wait") == 0) {
+      script_wait();
+      continue;
+    }
+
+    bool background = false;
+    length = strlen(command);
+    if(command[length - 1] == '&') {
+      background = true;
+      command[--length] = 0;
+      while(length > 0 && command[length - 1] == ' ') {command[--length] = 0;}
+    }
+
+    if(background && parallel_safe(command)) {
+      char *absolute = absolute_command(command);
+      job_run_cmd(absolute);
+      free(absolute);
+    }
+    else {
+      if(background) {fprintf(stderr, "'%s' can't run in the background, running it now\n", command);}
+      parse_cmd(command);
+    }
+  }
+
+  script_wait();
+
+  free(line);
+  if(file != stdin) {fclose(file);}
+
+  return 0;
+}
@@ -0,0 +1,310 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <session.h>
+#include <playback.h>
+#include <queue.h>
+#include <jobs.h>
+#include <ui.h>
+
+
+// The snapshot is a small text file:
+//
+//   trackjack-session 1
+//   dir <cwd>
+//   cursor <selected element> <scroll offset> <cursor line>
+//   track <seconds> <paused> <path>
+//   queue <count>
+//   <one queued path per line>
+//
+// "track" is left out when nothing was playing
+
+#define SESSION_MAGIC "trackjack-session 1\n"
+
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *session_file = NULL;
+static time_t last_save = 0;
+
+// Read by session_restore_dir(), used by session_restore() once the directory is listed
+static char *saved_data = NULL;
+static size_t saved_length = 0;
+
+
+
+static const char *session_path(void) {
+  const char *base = getenv("XDG_STATE_HOME");
+  const char *home = getenv("HOME");
+
+  if(session_file) {return session_file;}
+
+  if(base && *base) {
+    session_file = malloc(strlen(base) + 32);
+    sprintf(session_file, "%s/trackjack", base);
+  }
+  else if(home) {
+    session_file = malloc(strlen(home) + 48);
+    sprintf(session_file, "%s/.local", home);
+    mkdir(session_file, 0755);
+    sprintf(session_file, "%s/.local/state", home);
+    mkdir(session_file, 0755);
+    sprintf(session_file, "%s/.local/state/trackjack", home);
+  }
+  else {return NULL;}
+
+  mkdir(session_file, 0755);
+  strcat(session_file, "/session");
+
+  return session_file;
+}
+
+
+
+static void append(char **buf, size_t *length, size_t *capacity, const char *text) {
+  size_t add = strlen(text);
+
+  if(*length + add + 1 > *capacity) {
+    *capacity = (*length + add + 1) * 2;
+    *buf = realloc(*buf, *capacity);
+  }
+
+  memcpy(*buf + *length, text, add + 1);
+  *length += add;
+  return;
+}
+
+
+// Everything that has to be read on the UI thread, as the file's contents
+static char *build_snapshot(void) {
+  struct playback_state state;
+  unsigned int selected, offset, y;
+  size_t length = 0, capacity = 4096;
+  char *buf = malloc(capacity);
+  char line[STATE_PATH_SIZE + 64];
+  unsigned int i, count;
+
+  buf[0] = 0;
+  append(&buf, &length, &capacity, SESSION_MAGIC);
+
+  char *cwd = getcwd(NULL, 0);
+  if(cwd) {
+    snprintf(line, sizeof(line), "dir %s\n", cwd);
+    append(&buf, &length, &capacity, line);
+    free(cwd);
+  }
+
+  ui_get_cursor(&selected, &offset, &y);
+  snprintf(line, sizeof(line), "cursor %u %u %u\n", selected, offset, y);
+  append(&buf, &length, &capacity, line);
+
+  playback_read_state(&state);
+  if(state.active) {
+    snprintf(line, sizeof(line), "track %d %d %s\n", state.position, !state.playing, state.path);
+    append(&buf, &length, &capacity, line);
+  }
+
+  // The track after the current one has already been taken off the queue
+  bool has_next = state.active && state.next_path[0];
+  count = queue_length();
+  snprintf(line, sizeof(line), "queue %u\n", count + has_next);
+  append(&buf, &length, &capacity, line);
+
+  if(has_next) {
+    append(&buf, &length, &capacity, state.next_path);
+    append(&buf, &length, &capacity, "\n");
+  }
+
+  for(i = 0; i < count; i++) {
+    char *entry = queue_copy_entry(i);
+    if(entry == NULL) {break;}
+    append(&buf, &length, &capacity, entry);
+    append(&buf, &length, &capacity, "\n");
+    free(entry);
+  }
+
+  return buf;
+}
+
+
+static void write_snapshot(char *contents) {
+  const char *path = session_path();
+  if(path == NULL) {return;}
+
+  char *temp = malloc(strlen(path) + 5);
+  sprintf(temp, "%s.tmp", path);
+  size_t length = strlen(contents);
+
+  // Two snapshots written at once would share the temporary file
+  pthread_mutex_lock(&session_lock);
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd >= 0) {
+    bool ok = write(fd, contents, length) == (ssize_t)length;
+    close(fd);
+    if(ok) {rename(temp, path);}
+    else {unlink(temp);}
+  }
+  pthread_mutex_unlock(&session_lock);
+
+  free(temp);
+  return;
+}
+
+
+void session_save(void) {
+  char *contents = build_snapshot();
+
+  // An older snapshot still being written in the background must not land after this one
+  jobs_wait();
+  write_snapshot(contents);
+  free(contents);
+
+  last_save = time(NULL);
+  return;
+}
+
+
+// Called every main loop tick. The snapshot is taken here, writing it out is left to a job
+void session_tick(void) {
+  time_t now = time(NULL);
+  if(now - last_save < SESSION_SAVE_INTERVAL) {return;}
+  last_save = now;
+
+  char *contents = build_snapshot();
+  job_run(write_snapshot, contents);
+  free(contents);
+
+  return;
+}
+
+
+
+static char *next_line(char **cursor, char *end) {
+  char *line = *cursor;
+  char *newline;
+
+  if(line >= end) {return NULL;}
+  if((newline = memchr(line, '\n', end - line)) == NULL) {newline = end;}
+
+  *newline = 0;
+  *cursor = newline + 1;
+  return line;
+}
+
+
+// Reads the snapshot and changes into its directory. Returns false if there was nothing to restore,
+// so the caller can fall back to wherever it would have started
+bool session_restore_dir(void) {
+  const char *path = session_path();
+  struct stat st;
+
+  if(path == NULL) {return false;}
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return false;}
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SESSION_MAGIC) - 1) {
+    close(fd);
+    return false;
+  }
+
+  saved_data = malloc(st.st_size + 1);
+  saved_length = read(fd, saved_data, st.st_size);
+  close(fd);
+
+  if(saved_length != (size_t)st.st_size || memcmp(saved_data, SESSION_MAGIC, sizeof(SESSION_MAGIC) - 1) != 0) {
+    free(saved_data);
+    saved_data = NULL;
+    return false;
+  }
+  saved_data[saved_length] = 0;
+
+  char *dir = strstr(saved_data, "\ndir ");
+  if(dir == NULL) {return false;}
+
+  dir += 5;
+  size_t length = strcspn(dir, "\n");
+  char *copy = strndup(dir, length);
+  bool ret = chdir(copy) == 0;
+  free(copy);
+
+  return ret;
+}
+
+
+// The rest of the snapshot, once the directory has been listed: cursor, queue, and the track,
+// which is opened, seeked and pre-rolled in the background
+void session_restore(void) {
+  char *cursor, *end, *line;
+  unsigned int selected, offset, y;
+
+  if(saved_data == NULL) {return;}
+
+  cursor = saved_data + sizeof(SESSION_MAGIC) - 1;
+  end = saved_data + saved_length;
+
+  while((line = next_line(&cursor, end))) {
+    if(sscanf(line, "cursor %u %u %u", &selected, &offset, &y) == 3) {
+      ui_set_cursor(selected, offset, y);
+    }
+    else if(strncmp(line, "track ", 6) == 0) {
+      unsigned int seconds;
+      int paused, consumed = 0;
+
+      if(sscanf(line, "track %u %d %n", &seconds, &paused, &consumed) >= 2 && consumed > 0) {
+        playback_resume_async(line + consumed, seconds, paused);
+      }
+    }
+    else if(strncmp(line, "queue ", 6) == 0) {
+      unsigned int count = strtoul(line + 6, NULL, 10);
+      unsigned int i;
+      char **entries = malloc((count ? count : 1) * sizeof(char *));
+
+      for(i = 0; i < count && (line = next_line(&cursor, end)); i++) {
+        entries[i] = strdup(line);
+      }
+
+      queue_push_batch(entries, i);
+      free(entries);
+    }
+  }
+
+  free(saved_data);
+  saved_data = NULL;
+  last_save = time(NULL);
+
+  return;
+}
+
+
+void session_cleanup(void) {
+  free(session_file);
+  session_file = NULL;
+  return;
+}
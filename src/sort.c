@@ -0,0 +1,325 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sort.h>
+#include <track_meta.h>
+
+
+// Below this many entries per thread, starting threads costs more than it saves
+#define SORT_CHUNK_MIN 4096
+
+// Key segments. Numbers sort before text, like in most file managers
+#define KEY_NUMBER 1
+#define KEY_TEXT 2
+#define KEY_SEPARATOR 0
+
+
+struct sort_item {
+  struct dirent *entry;
+  unsigned char *key;
+  size_t key_length;
+  bool has_meta;
+  uint32_t primary[3];
+};
+
+struct sort_chunk {
+  struct sort_item *items;
+  size_t count;
+  const char *dir;
+  int mode;
+};
+
+
+static const char *mode_names[MAX_SORT_MODE + 1] = {"name", "track", "year", "duration"};
+
+
+
+// Appends the locale's collation key for length bytes of text
+static size_t append_text(unsigned char **key, size_t *capacity, size_t used, const char *text, size_t length) {
+  char *segment = strndup(text, length);
+  size_t needed = strxfrm(NULL, segment, 0);
+
+  if(used + needed + 3 > *capacity) {
+    *capacity = (used + needed + 3) * 2;
+    *key = realloc(*key, *capacity);
+  }
+
+  (*key)[used++] = KEY_TEXT;
+  strxfrm((char *)*key + used, segment, needed + 1);
+  used += needed;
+  (*key)[used++] = KEY_SEPARATOR;
+
+  free(segment);
+  return used;
+}
+
+
+// Natural order collation key for name, compared with memcmp(). Digit runs are stored as
+// their significant digits behind a length byte, so "2" < "10" and "01" == "1", and everything
+// else goes through strxfrm() once here instead of strcoll() on every comparison
+unsigned char *collation_key(const char *name, size_t *length) {
+  size_t capacity = strlen(name) * 2 + 16;
+  unsigned char *key = malloc(capacity);
+  size_t used = 0;
+
+  while(*name) {
+    const char *start = name;
+
+    if(isdigit((unsigned char)*name)) {
+      while(*name == '0' && isdigit((unsigned char)name[1])) {name++;}
+      start = name;
+      while(isdigit((unsigned char)*name)) {name++;}
+
+      size_t digits = name - start;
+      if(digits > 255) {digits = 255;}
+
+      if(used + digits + 2 > capacity) {
+        capacity = (used + digits + 2) * 2;
+        key = realloc(key, capacity);
+      }
+      key[used++] = KEY_NUMBER;
+      key[used++] = digits;
+      memcpy(key + used, start, digits);
+      used += digits;
+    }
+    else {
+      while(*name && !isdigit((unsigned char)*name)) {name++;}
+      used = append_text(&key, &capacity, used, start, name - start);
+    }
+  }
+
+  *length = used;
+  return key;
+}
+
+
+
+static void fill_items(struct sort_chunk *chunk) {
+  char path[4096];
+  struct track_meta meta;
+  size_t i;
+
+  for(i = 0; i < chunk->count; i++) {
+    struct sort_item *item = &chunk->items[i];
+    const char *name = item->entry->d_name;
+
+    item->has_meta = false;
+    memset(item->primary, 0, sizeof(item->primary));
+
+    if(chunk->mode != SORT_NAME) {
+      snprintf(path, sizeof(path), "%s/%s", chunk->dir, name);
+      item->has_meta = meta_cache_lookup(path, &meta);
+    }
+
+    if(!item->has_meta) {
+      item->key = collation_key(name, &item->key_length);
+      continue;
+    }
+
+    switch(chunk->mode) {
+      case SORT_TRACK:
+        item->primary[0] = meta.disc;
+        item->primary[1] = meta.track;
+        break;
+      case SORT_YEAR:
+        item->primary[0] = meta.year;
+        item->primary[1] = meta.disc;
+        item->primary[2] = meta.track;
+        break;
+      case SORT_DURATION:
+        item->primary[0] = meta.duration;
+        break;
+    }
+
+    // By year, albums from the same year are kept together by putting the album ahead of the name
+    if(chunk->mode == SORT_YEAR && meta.album) {
+      size_t album_length, name_length;
+      unsigned char *album_key = collation_key(meta.album, &album_length);
+      unsigned char *name_key = collation_key(name, &name_length);
+
+      item->key_length = album_length + 1 + name_length;
+      item->key = malloc(item->key_length);
+      memcpy(item->key, album_key, album_length);
+      item->key[album_length] = KEY_SEPARATOR;
+      memcpy(item->key + album_length + 1, name_key, name_length);
+
+      free(album_key);
+      free(name_key);
+    }
+    else {
+      item->key = collation_key(name, &item->key_length);
+    }
+  }
+
+  return;
+}
+
+
+static int compare_items(const void *a, const void *b) {
+  const struct sort_item *x = a;
+  const struct sort_item *y = b;
+  int i;
+
+  // Files with known tags first, in tag order, the rest by name after them
+  if(x->has_meta != y->has_meta) {return x->has_meta ? -1 : 1;}
+
+  for(i = 0; i < 3; i++) {
+    if(x->primary[i] != y->primary[i]) {return x->primary[i] < y->primary[i] ? -1 : 1;}
+  }
+
+  size_t length = x->key_length < y->key_length ? x->key_length : y->key_length;
+  int ret = memcmp(x->key, y->key, length);
+  if(ret != 0) {return ret;}
+  if(x->key_length != y->key_length) {return x->key_length < y->key_length ? -1 : 1;}
+
+  // "01" and "1" collate the same, keep the order stable anyway
+  return strcmp(x->entry->d_name, y->entry->d_name);
+}
+
+
+static void *sort_chunk_thread(void *arg) {
+  struct sort_chunk *chunk = arg;
+
+  fill_items(chunk);
+  qsort(chunk->items, chunk->count, sizeof(struct sort_item), compare_items);
+
+  return NULL;
+}
+
+
+static void merge(struct sort_item *a, size_t a_count, struct sort_item *b, size_t b_count, struct sort_item *out) {
+  while(a_count && b_count) {
+    if(compare_items(b, a) < 0) {*out++ = *b++; b_count--;}
+    else {*out++ = *a++; a_count--;}
+  }
+
+  memcpy(out, a, a_count * sizeof(struct sort_item));
+  memcpy(out + a_count, b, b_count * sizeof(struct sort_item));
+  return;
+}
+
+
+
+// Sorts the entries of dir in place. Key building is the expensive part, so large listings are split
+// across cores, each thread building keys for and sorting its own slice, and the slices merged after
+void sort_dirents(const char *dir, struct dirent **list, int count, int mode) {
+  int i;
+
+  if(count < 2) {return;}
+  if(mode < 0 || mode > MAX_SORT_MODE) {mode = SORT_NAME;}
+
+  struct sort_item *items = malloc(count * sizeof(struct sort_item));
+  for(i = 0; i < count; i++) {items[i].entry = list[i];}
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int chunk_count = count / SORT_CHUNK_MIN;
+  if(chunk_count > cores) {chunk_count = cores;}
+  if(chunk_count < 1) {chunk_count = 1;}
+
+  struct sort_chunk *chunks = malloc(chunk_count * sizeof(struct sort_chunk));
+  pthread_t *threads = malloc(chunk_count * sizeof(pthread_t));
+  bool *started = calloc(chunk_count, sizeof(bool));
+
+  for(i = 0; i < chunk_count; i++) {
+    size_t first = (size_t)count * i / chunk_count;
+    size_t last = (size_t)count * (i + 1) / chunk_count;
+
+    chunks[i].items = items + first;
+    chunks[i].count = last - first;
+    chunks[i].dir = dir;
+    chunks[i].mode = mode;
+
+    // The calling thread takes the last slice itself, and any slice a thread couldn't be started for
+    if(i < chunk_count - 1 && pthread_create(&threads[i], NULL, sort_chunk_thread, &chunks[i]) == 0) {started[i] = true;}
+  }
+
+  sort_chunk_thread(&chunks[chunk_count - 1]);
+  for(i = 0; i < chunk_count - 1; i++) {
+    if(started[i]) {pthread_join(threads[i], NULL);}
+    else {sort_chunk_thread(&chunks[i]);}
+  }
+
+  // Merge neighbouring slices until one is left
+  struct sort_item *scratch = malloc(count * sizeof(struct sort_item));
+  int width;
+
+  for(width = 1; width < chunk_count; width *= 2) {
+    for(i = 0; i < chunk_count; i += width * 2) {
+      if(i + width >= chunk_count) {
+        memcpy(scratch + (chunks[i].items - items), chunks[i].items, chunks[i].count * sizeof(struct sort_item));
+        continue;
+      }
+
+      struct sort_chunk *a = &chunks[i];
+      struct sort_chunk *b = &chunks[i + width];
+      merge(a->items, a->count, b->items, b->count, scratch + (a->items - items));
+      a->count += b->count;
+    }
+
+    struct sort_item *swap = items;
+    items = scratch;
+    scratch = swap;
+
+    // Slices now point into the other buffer
+    for(i = 0; i < chunk_count; i += width * 2) {
+      chunks[i].items = items + (chunks[i].items - scratch);
+    }
+  }
+
+  for(i = 0; i < count; i++) {
+    list[i] = items[i].entry;
+    free(items[i].key);
+  }
+
+  free(scratch);
+  free(items);
+  free(chunks);
+  free(threads);
+  free(started);
+
+  return;
+}
+
+
+
+int sort_mode_from_name(const char *name) {
+  int i;
+  for(i = 0; i <= MAX_SORT_MODE; i++) {
+    if(strcmp(name, mode_names[i]) == 0) {return i;}
+  }
+
+  return -1;
+}
+
+
+const char *sort_mode_name(int mode) {
+  if(mode < 0 || mode > MAX_SORT_MODE) {return NULL;}
+  return mode_names[mode];
+}
@@ -0,0 +1,368 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/tx.h>
+
+#include <spectrum.h>
+#include <playback.h>
+#include <mem.h>
+
+
+#define SPECTRUM_FFT_SIZE 2048
+
+
+// Between two reports from the playback thread the heard position is moved on by the clock,
+// but no further than this past the last one, so a pause doesn't run away
+#define SPECTRUM_MAX_AHEAD_MS 250
+
+// Range of the display, in dB relative to a full scale sine
+#define SPECTRUM_FLOOR_DB -72.0f
+
+// How far a band may fall per update, as a fraction of the full height
+#define SPECTRUM_FALL 0.04f
+
+
+// Tap ring, in mono samples, indexed by stream position (see spectrum_tap()). Has to hold everything
+// the current buffering can queue on the source at once, since what is heard is the oldest of it.
+// Doubled for chunks that run past the buffer size and the window behind the heard position, and
+// rounded up to a power of two. Only allocated while the analyser is shown.
+// The UI thread allocates and frees it, and only while tap_busy says the playback thread isn't in it
+static float *ring = NULL;
+static unsigned int ring_size = 0;
+static atomic_bool tap_busy = false;
+
+// Written by the playback thread only. ring_claimed moves before a chunk is copied in and ring_end
+// after, so the UI knows both what it may read and whether it was overwritten while reading.
+// ring_start is the first position tapped since the ring was allocated
+static atomic_uint_fast64_t ring_claimed = 0;
+static atomic_uint_fast64_t ring_end = 0;
+static atomic_uint_fast64_t ring_start = UINT64_MAX;
+
+static atomic_bool tap_enabled = false;
+static atomic_uint tap_rate = 0;
+
+// The stream position OpenAL was at when the playback thread last looked, behind a seqlock
+static atomic_uint clock_seq = 0;
+static uint64_t clock_position = 0;
+static uint64_t clock_ns = 0;
+static bool clock_running = false;
+
+
+// Everything below belongs to the UI thread
+static AVTXContext *tx_context = NULL;
+static av_tx_fn tx_fn;
+static float *window = NULL;
+static float *tx_in = NULL;
+static AVComplexFloat *tx_out = NULL;
+
+static uint64_t last_heard = 0;
+
+static int *band_edges = NULL;
+static float *band_levels = NULL;
+static int band_layout_count = 0;
+static unsigned int band_layout_rate = 0;
+
+
+
+// Only done the first time the analyser is shown
+void spectrum_init(void) {
+  float scale = 1.0f;
+  int i;
+
+  if(tx_context) {return;}
+  if(av_tx_init(&tx_context, &tx_fn, AV_TX_FLOAT_RDFT, 0, SPECTRUM_FFT_SIZE, &scale, 0) < 0) {
+    tx_context = NULL;
+    return;
+  }
+
+  // av_malloc() so the SIMD versions of the transform get aligned buffers
+  window = av_malloc(SPECTRUM_FFT_SIZE * sizeof(float));
+  tx_in = av_malloc((SPECTRUM_FFT_SIZE + 2) * sizeof(float));
+  tx_out = av_malloc((SPECTRUM_FFT_SIZE / 2 + 1) * sizeof(AVComplexFloat));
+
+  // Hann window
+  for(i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / (SPECTRUM_FFT_SIZE - 1));
+  }
+
+  return;
+}
+
+
+// Once this returns the playback thread is out of spectrum_tap() and won't touch the ring again
+static void stop_tap(void) {
+  atomic_store(&tap_enabled, false);
+  while(atomic_load(&tap_busy)) {sched_yield();}
+  return;
+}
+
+
+static void free_ring(void) {
+  stop_tap();
+  mem_free(ring);
+  ring = NULL;
+  ring_size = 0;
+  return;
+}
+
+
+static unsigned int wanted_ring_size(void) {
+  unsigned int count, frames, size = SPECTRUM_FFT_SIZE * 2;
+
+  playback_get_buffering(&count, &frames);
+  while(size < count * frames * 2) {size *= 2;}
+
+  return size;
+}
+
+
+void spectrum_cleanup(void) {
+  free_ring();
+
+  if(tx_context) {av_tx_uninit(&tx_context);}
+  av_freep(&window);
+  av_freep(&tx_in);
+  av_freep(&tx_out);
+
+  free(band_edges);
+  free(band_levels);
+  band_edges = NULL;
+  band_levels = NULL;
+  band_layout_count = 0;
+
+  return;
+}
+
+
+
+// Nothing is tapped while the analyser is hidden, and the ring is given back. Enabling allocates
+// a fresh one for the current buffering, so only what is tapped from then on counts.
+// Returns -1 if the analyser can't run
+int spectrum_set_enabled(bool enabled) {
+  free_ring();
+  if(!enabled) {return 0;}
+  if(tx_context == NULL) {return -1;}
+
+  unsigned int size = wanted_ring_size();
+  ring = mem_calloc(MEM_DECODE, size, sizeof(float));
+  if(ring == NULL) {return -1;}
+  ring_size = size;
+
+  atomic_store(&ring_start, UINT64_MAX);
+  atomic_store(&tap_enabled, true);
+
+  return 0;
+}
+
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+// Called by the playback thread for every chunk it hands to OpenAL. position is the stream position of
+// its first frame, the same count spectrum_clock() reports the heard position in. Never waits
+void spectrum_tap(const float *pcm, int frames, int channels, unsigned int rate, uint64_t position) {
+  // Busy goes up before enabled is checked, so stop_tap() either stops this or waits for it
+  atomic_store(&tap_busy, true);
+  if(!atomic_load(&tap_enabled)) {
+    atomic_store(&tap_busy, false);
+    return;
+  }
+
+  int i, c;
+  unsigned int mask = ring_size - 1;
+
+  // A chunk longer than the whole ring only has its end kept
+  if(frames > (int)ring_size) {
+    pcm += (frames - ring_size) * channels;
+    position += frames - ring_size;
+    frames = ring_size;
+  }
+
+  if(atomic_load_explicit(&ring_start, memory_order_relaxed) == UINT64_MAX) {
+    atomic_store_explicit(&ring_start, position, memory_order_relaxed);
+  }
+
+  atomic_store_explicit(&ring_claimed, position + frames, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  for(i = 0; i < frames; i++) {
+    float sum = 0;
+    for(c = 0; c < channels; c++) {sum += pcm[i * channels + c];}
+    ring[(position + i) & mask] = sum / channels;
+  }
+
+  atomic_store_explicit(&tap_rate, rate, memory_order_relaxed);
+  atomic_store_explicit(&ring_end, position + frames, memory_order_release);
+  atomic_store(&tap_busy, false);
+
+  return;
+}
+
+
+// Called by the playback thread on every update with the stream position being heard
+void spectrum_clock(uint64_t position, bool running) {
+  atomic_fetch_add_explicit(&clock_seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  clock_position = position;
+  clock_ns = monotonic_ns();
+  clock_running = running;
+
+  atomic_fetch_add_explicit(&clock_seq, 1, memory_order_release);
+  return;
+}
+
+
+// Where the listener is now: the last reported position, moved on by the time since while playing
+static uint64_t heard_position(unsigned int rate) {
+  uint64_t position, ns;
+  bool running;
+  unsigned int seq;
+
+  do {
+    while((seq = atomic_load_explicit(&clock_seq, memory_order_acquire)) & 1) {}
+    position = clock_position;
+    ns = clock_ns;
+    running = clock_running;
+    atomic_thread_fence(memory_order_acquire);
+  } while(atomic_load_explicit(&clock_seq, memory_order_relaxed) != seq);
+
+  if(running) {
+    uint64_t ms = (monotonic_ns() - ns) / 1000000;
+    if(ms > SPECTRUM_MAX_AHEAD_MS) {ms = SPECTRUM_MAX_AHEAD_MS;}
+    position += ms * rate / 1000;
+  }
+
+  return position;
+}
+
+
+
+// Log spaced band edges in FFT bins, from SPECTRUM_MIN_FREQ up
+static void layout_bands(int band_count, unsigned int rate) {
+  float top = rate / 2.0f < SPECTRUM_MAX_FREQ ? rate / 2.0f : SPECTRUM_MAX_FREQ;
+  int i;
+
+  band_edges = realloc(band_edges, (band_count + 1) * sizeof(int));
+  band_levels = realloc(band_levels, band_count * sizeof(float));
+  memset(band_levels, 0, band_count * sizeof(float));
+
+  for(i = 0; i <= band_count; i++) {
+    float freq = SPECTRUM_MIN_FREQ * powf(top / SPECTRUM_MIN_FREQ, (float)i / band_count);
+    band_edges[i] = freq * SPECTRUM_FFT_SIZE / rate + 0.5f;
+    if(band_edges[i] > SPECTRUM_FFT_SIZE / 2) {band_edges[i] = SPECTRUM_FFT_SIZE / 2;}
+  }
+
+  band_layout_count = band_count;
+  band_layout_rate = rate;
+  return;
+}
+
+
+// Analyses the window of tapped audio ending at what is being heard right now and fills levels with
+// band_count values from 0 to 1. Meant to be called once per UI tick while the analyser is shown.
+// Returns 0 if there is nothing to draw
+int spectrum_update(int band_count, float *levels) {
+  int i, b;
+
+  if(tx_context == NULL || band_count <= 0) {return 0;}
+
+  // The buffering was changed while the analyser was shown
+  if(ring && wanted_ring_size() != ring_size) {spectrum_set_enabled(true);}
+  if(ring == NULL) {return 0;}
+
+  unsigned int rate = atomic_load_explicit(&tap_rate, memory_order_relaxed);
+  if(rate == 0) {return 0;}
+  if(band_count != band_layout_count || rate != band_layout_rate) {layout_bands(band_count, rate);}
+
+  uint64_t end = atomic_load_explicit(&ring_end, memory_order_acquire);
+  uint64_t start = atomic_load_explicit(&ring_start, memory_order_relaxed);
+  uint64_t heard = heard_position(rate);
+  if(heard > end) {heard = end;}
+
+  // Paused, between tracks or not tapped yet: let the bars settle rather than transforming the same window again
+  bool fresh = heard != last_heard && start != UINT64_MAX && heard >= start + SPECTRUM_FFT_SIZE;
+
+  if(fresh) {
+    uint64_t first = heard - SPECTRUM_FFT_SIZE;
+    for(i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+      tx_in[i] = ring[(first + i) & (ring_size - 1)] * window[i];
+    }
+
+    // The playback thread may have lapped the window while it was copied
+    atomic_thread_fence(memory_order_acquire);
+    if(atomic_load_explicit(&ring_claimed, memory_order_relaxed) > first + ring_size) {fresh = false;}
+  }
+  last_heard = heard;
+
+  if(!fresh) {
+    for(b = 0; b < band_count; b++) {
+      band_levels[b] = band_levels[b] > SPECTRUM_FALL ? band_levels[b] - SPECTRUM_FALL : 0;
+      levels[b] = band_levels[b];
+    }
+    return 1;
+  }
+
+  tx_fn(tx_context, tx_out, tx_in, sizeof(float));
+
+  // A full scale sine through the Hann window peaks at a quarter of the FFT size
+  const float reference = SPECTRUM_FFT_SIZE / 4.0f;
+
+  for(b = 0; b < band_count; b++) {
+    int first = band_edges[b];
+    int last = band_edges[b + 1];
+    float peak = 0;
+
+    // Low bands can be narrower than one bin, they then share the nearest one
+    if(last <= first) {last = first + 1;}
+    if(last > SPECTRUM_FFT_SIZE / 2 + 1) {last = SPECTRUM_FFT_SIZE / 2 + 1;}
+
+    for(i = first; i < last; i++) {
+      float power = tx_out[i].re * tx_out[i].re + tx_out[i].im * tx_out[i].im;
+      if(power > peak) {peak = power;}
+    }
+
+    float db = 10.0f * log10f(peak / (reference * reference) + 1e-12f);
+    float level = 1.0f - db / SPECTRUM_FLOOR_DB;
+    if(level < 0) {level = 0;}
+    if(level > 1) {level = 1;}
+
+    // Rise at once, fall slowly
+    if(level < band_levels[b] - SPECTRUM_FALL) {level = band_levels[b] - SPECTRUM_FALL;}
+    band_levels[b] = level;
+    levels[b] = level;
+  }
+
+  return 1;
+}
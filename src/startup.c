@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <startup.h>
+#include <ui.h>
+
+
+#define STARTUP_MAX_PHASES 16
+
+
+struct phase {
+  const char *name;
+  double ms;
+};
+
+
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec start_time;
+static struct phase phases[STARTUP_MAX_PHASES];
+static int phase_count = 0;
+
+
+
+// The first call, with NULL, starts the clock. Every later call records how long after that
+// the named phase finished. Safe to call from the threads doing startup work in the background
+void startup_mark(const char *phase) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&startup_lock);
+  if(phase == NULL) {
+    start_time = now;
+    phase_count = 0;
+  }
+  else if(phase_count < STARTUP_MAX_PHASES) {
+    phases[phase_count].name = phase;
+    phases[phase_count].ms = (now.tv_sec - start_time.tv_sec) * 1000.0 + (now.tv_nsec - start_time.tv_nsec) / 1000000.0;
+    phase_count++;
+  }
+  pthread_mutex_unlock(&startup_lock);
+
+  return;
+}
+
+
+void startup_report(void) {
+  char msg[160];
+  int i;
+
+  pthread_mutex_lock(&startup_lock);
+  struct phase copy[STARTUP_MAX_PHASES];
+  int count = phase_count;
+  memcpy(copy, phases, sizeof(copy));
+  pthread_mutex_unlock(&startup_lock);
+
+  display_msg("Startup, in ms since launch:");
+  for(i = 0; i < count; i++) {
+    snprintf(msg, sizeof(msg), "%8.1f  %s", copy[i].ms, copy[i].name);
+    display_msg(msg);
+  }
+
+  return;
+}
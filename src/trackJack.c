@@ -20,6 +20,8 @@ If not, see <https://www.gnu.org/licenses/>.
 
 
 #include <stdlib.h>
+#include <locale.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <ncurses.h>
@@ -27,9 +29,26 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <string.h>
 #include <unistd.h>
 #include <AL/al.h>
-#include <AL/alut.h>
 
 #include <playback.h>
+#include <prefetch.h>
+#include <waveform.h>
+#include <spectrum.h>
+#include <track_meta.h>
+#include <intern.h>
+#include <mem.h>
+#include <audio_device.h>
+#include <startup.h>
+#include <session.h>
+#include <control.h>
+#include <commands.h>
+#include <cmdline.h>
+#include <render.h>
+#include <queue.h>
+#include <playlist.h>
+#include <walk.h>
+#include <sort.h>
+#include <script.h>
 #include <clock.h>
 #include <ui.h>
 
@@ -37,56 +56,190 @@ If not, see <https://www.gnu.org/licenses/>.
 #define KEY_CR 10
 #define KEY_SPC 32
 #define KEY_COLON 58
+#define KEY_A 97
+#define KEY_SHIFT_A 65
+#define KEY_V 118
+#define KEY_SLASH 47
 
 
-#define NO_COMMAND_HINT NULL
 
 
-void parse_cmd(char *command);
 
 
+// Queues the highlighted file, or every audio file in the highlighted directory
+void queue_selected_element(void) {
+  bool type;
+  int fs_index;
+
+  if(ui_library_active()) {
+    ui_library_queue_selected();
+    return;
+  }
+
+  char *name = retrieve_fs_element(&type, &fs_index);
+  char *msg = malloc(strlen(name) + 64);
+
+  if(type == ELEM_DIR) {
+    int count = queue_push_dir(name);
+    if(count < 0) {sprintf(msg, "Could not read directory %s", name);}
+    else {sprintf(msg, "Queued %d tracks from %s", count, name);}
+    playback_play_queue();
+  }
+  else {
+    playback_queue(name);
+    sprintf(msg, "Queued: %s", name);
+  }
+
+  display_msg(msg);
+  free(msg);
+  free(name);
+  return;
+}
+
+
+// Everything under the highlighted directory, subdirectories included. Files are ordered
+// by their tags when the file window is sorted that way, by name otherwise
+void queue_selected_tree(void) {
+  bool type;
+  int fs_index;
+
+  // In the tag browser everything under the highlighted entry is queued anyway
+  if(ui_library_active()) {
+    ui_library_queue_selected();
+    return;
+  }
+
+  char *name = retrieve_fs_element(&type, &fs_index);
+  char *msg = malloc(strlen(name) + 64);
+
+  if(type != ELEM_DIR) {sprintf(msg, "%s is not a directory", name);}
+  else {
+    int ret = walk_enqueue(name, ui_get_sort_mode() == SORT_TRACK ? SORT_TRACK : SORT_NAME);
+    if(ret == 1) {sprintf(msg, "Still queueing the last directory tree");}
+    else if(ret < 0) {sprintf(msg, "Could not read directory %s", name);}
+    else {sprintf(msg, "Queueing everything under %s", name);}
+  }
+
+  display_msg(msg);
+  free(msg);
+  free(name);
+  return;
+}
+
+
+// Only what the first frame needs. The audio device is opened on its own thread meanwhile
 void init(void) {
+  startup_mark(NULL);
+  audio_device_open_async();
+  playback_init();
 
+  // The waveform overview is drawn with Unicode block characters
+  setlocale(LC_ALL, "");
   initscr();
   curs_set(TRUE);
   keypad(stdscr, TRUE);
   init_ui();
   init_clock();
+  startup_mark("terminal and windows");
+
+}
+
+
+// Everything that can wait until the first frame is on screen
+void init_background(void) {
+  prefetch_init();
+  waveform_init();
+  control_init();
+
+  // Over the memory budget, overviews are given up before tags
+  mem_add_release_hook(waveform_trim);
+  mem_add_release_hook(meta_cache_trim);
+  startup_mark("background workers");
+
+  return;
+}
+
+
+
+
+// --script: everything init() does except ncurses, then run the script instead of the main loop.
+// With a render output (--render), audio is mixed offline into it instead of played
+int run_headless(const char *script, const char *render_output, int render_rate) {
+  startup_mark(NULL);
+  ui_set_headless();
+  if(render_output) {
+    if(render_open(render_output, render_rate) != 0) {return -1;}
+  }
+  else {audio_device_open_async();}
   playback_init();
-  alutInit(NULL, NULL);
+  prefetch_init();
+  mem_add_release_hook(meta_cache_trim);
+
+  int ret = run_script(script);
+  render_close();
 
+  playlist_cleanup();
+  walk_cleanup();
+  prefetch_cleanup();
+  playback_cleanup();
+  queue_clear();
+  meta_cache_cleanup();
+  intern_cleanup();
+  audio_device_close();
+
+  return ret;
 }
 
 
 
 
 int main(int argc, char **argv) {
-  char *command = malloc(160);
+  bool render = argc > 1 && strcmp(argv[1], "--render") == 0;
 
-  if(argc > 3) {
+  if(argc > (render ? 5 : 3)) {
     fprintf(stderr, "Too many arguments.\nUse --help for help.\n");
     return -1;
   }
 
   if(argc > 1) {
-    if(strcmp(argv[1], "--help") != 0 && strcmp(argv[1], "--script") != 0) {
+    if(strcmp(argv[1], "--help") != 0 && strcmp(argv[1], "--script") != 0 && !render) {
       fprintf(stderr, "Unrecognized argument '%s'\n", argv[1]);
       return -2;
     }
 
     if(strcmp(argv[1], "--help") == 0) {
-      printf("Trackjack plays music.\n--help to print this screen.\n--script to run a script.\n");
+      printf("Trackjack plays music.\n--help to print this screen.\n--script <file> to run the commands in file without the terminal UI ('-' reads them from stdin).\n--render <out.wav|null> <file> [rate] to run a script with audio mixed offline as fast as possible, into a WAV file or nowhere, and print a checksum of it.\n");
       return 0;
     }
 
+    if(render) {
+      if(argc < 4) {
+        fprintf(stderr, "--render needs an output and a script to run.\n");
+        return -3;
+      }
+      return run_headless(argv[3], argv[2], argc > 4 ? atoi(argv[4]) : 0) == 0 ? 0 : -4;
+    }
 
+    if(argc < 3) {
+      fprintf(stderr, "--script needs a file to run.\n");
+      return -3;
+    }
+
+    return run_headless(argv[2], NULL, 0) == 0 ? 0 : -4;
   }
 
   init();
-  chdir("test_homedir/");
+  if(!session_restore_dir()) {chdir("test_homedir/");}
   ui_open_dir(".");
+  startup_mark("directory listing");
+  session_restore();
 
   display_msg("Welcome to Trackjack. Type \':\' to open command window. Use command \'h\' for help.");
+  update_msgbox();
+  ui_render();
+  startup_mark("first frame");
+
+  init_background();
 
   int ch;
   char *name = NULL;
@@ -94,12 +247,33 @@ int main(int argc, char **argv) {
   bool exit = false;
   int fs_index = 0;
   int last_pos = 0;
+  unsigned int last_track = playback_track_serial();
+  struct playback_state state;
+  struct pollfd watched[CLOCK_MAX_WATCHED];
 
   noecho();
   nodelay(stdscr, 1);
   while(ch != KEY_ESC && exit == false) {
     ch = getch();
 
+    // The filter takes every key while open, Enter on a match then opens it like Enter in the list
+    if(ui_filter_active() && ch != ERR) {
+      ch = ui_filter_key(ch) == FILTER_SELECTED ? KEY_CR : ERR;
+    }
+
+    // So does the command line. The rest of the loop keeps running while a command is typed
+    if(ui_cmdline_active() && ch != ERR) {
+      if(ui_cmdline_key(ch) == CMDLINE_SUBMIT) {
+        // Copied, a command may open the command line again
+        char *command = strdup(cmdline_text());
+
+        if(strcmp(command, "q") == 0) {exit = true;}
+        else {parse_cmd(command);}
+        free(command);
+      }
+      ch = ERR;
+    }
+
     switch(ch) {
       case KEY_UP:
         user_nav_up();
@@ -108,6 +282,12 @@ int main(int argc, char **argv) {
         user_nav_down();
         break;
       case KEY_CR:
+        if(ui_library_active()) {
+          if((name = ui_library_enter())) {playback_start(name);}
+          free(name);
+          break;
+        }
+
         name = retrieve_fs_element(&type, &fs_index);
         if(type == ELEM_DIR) {
           ui_open_dir(name);
@@ -117,6 +297,18 @@ int main(int argc, char **argv) {
         }
         free(name);
         break;
+      case KEY_A:
+        queue_selected_element();
+        break;
+      case KEY_SHIFT_A:
+        queue_selected_tree();
+        break;
+      case KEY_V:
+        ui_toggle_spectrum();
+        break;
+      case KEY_SLASH:
+        ui_filter_begin();
+        break;
       case KEY_SPC:
         if(check_playback_state()) {
           playback_unpause();
@@ -126,46 +318,53 @@ int main(int argc, char **argv) {
         }
         break;
       case KEY_COLON:
-        curs_set(TRUE);
-        display_command_bar(NO_COMMAND_HINT);
-        nodelay(stdscr, 0);
-        echo();
-        refresh();
-        getstr(command);
-
-        if(strcmp(command, "q") == 0) {
-          exit = true;
-        }
-        else {
-          parse_cmd(command);
-        }
-
-        noecho();
-        clear_command_bar();
-        nodelay(stdscr, 1);
+        ui_cmdline_begin(NULL);
         break;
     }
 
+    playlist_update();
+    walk_update();
+    playback_resume_update();
+    session_tick();
+    control_poll();
+    mem_release();
     update_msgbox();
+    update_spectrum();
 
-    if(last_pos != playback_read_clock()) {
-      last_pos = playback_read_clock();
-      display_playback_bar();
-    }
+    playback_read_state(&state);
 
-    reset_cursor();
+    // The playback thread moved on to the next track in the queue
+    if(last_track != state.track_serial) {
+      last_track = state.track_serial;
+      display_metadata_bar(state.meta[META_ABLUM_TITLE], state.meta[META_ALBUM_ARTIST], state.year, state.meta[META_TRACK_ARTISTS]);
+      display_song_playback_bar(state.meta[META_TRACK_TITLE]);
+    }
 
+    if(last_pos != state.position) {
+      last_pos = state.position;
+      display_playback_bar();
+    }
 
-    refresh();
-    sleep_until_next_tick();
+    // Everything drawn this tick goes out at once. Frames slow down while nothing changes
+    bool busy = ui_render() || ch != ERR;
+    sleep_until_next_tick(busy, watched, control_pollfds(watched, CLOCK_MAX_WATCHED));
   }
   nodelay(stdscr, 0);
 
-  free(command);
-
+  cmdline_cleanup();
+  session_save();
+  session_cleanup();
+  control_cleanup();
+  playlist_cleanup();
+  walk_cleanup();
   cleanup_ui();
+  prefetch_cleanup();
   playback_cleanup();
-  alutExit();
+  waveform_cleanup();
+  spectrum_cleanup();
+  meta_cache_cleanup();
+  intern_cleanup();
+  audio_device_close();
   endwin();
   return 0;
 }
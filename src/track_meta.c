@@ -0,0 +1,264 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <libavutil/dict.h>
+
+#include <track_meta.h>
+#include <intern.h>
+#include <fs_util.h>
+#include <mem.h>
+
+
+#define META_CACHE_MIN_SLOTS 1024
+
+
+struct meta_cache_slot {
+  const char *path;
+  struct track_meta meta;
+};
+
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Keyed by the interned absolute path, so lookups compare pointers only
+static struct meta_cache_slot *cache = NULL;
+static unsigned int cache_slots = 0;
+static unsigned int cache_count = 0;
+
+
+
+static bool key_is(const char *key, const char *a, const char *b, const char *c) {
+  if(strcasecmp(key, a) == 0) {return true;}
+  if(b && strcasecmp(key, b) == 0) {return true;}
+  if(c && strcasecmp(key, c) == 0) {return true;}
+  return false;
+}
+
+
+static void set_string(const char **field, const char *value) {
+  if(*field == NULL && value[0] != 0) {*field = intern(value);}
+  return;
+}
+
+
+// "3" or "3/12"
+static void set_number_pair(uint16_t *number, uint16_t *total, const char *value) {
+  char *end;
+
+  if(*number != 0) {return;}
+  *number = strtoul(value, &end, 10);
+  if(*end == '/') {*total = strtoul(end + 1, NULL, 10);}
+
+  return;
+}
+
+
+// Fills in whatever meta doesn't have yet, so the container's tags can be read first and the stream's after.
+// Keys differ between ID3, Vorbis comments and MP4, libav only normalises some of them
+void track_meta_read(const struct AVDictionary *dict, struct track_meta *meta) {
+  const AVDictionaryEntry *tag = NULL;
+
+  while((tag = av_dict_iterate((const AVDictionary *)dict, tag))) {
+    if(key_is(tag->key, "title", NULL, NULL)) {set_string(&meta->title, tag->value);}
+    else if(key_is(tag->key, "album", NULL, NULL)) {set_string(&meta->album, tag->value);}
+    else if(key_is(tag->key, "album_artist", "albumartist", "album artist")) {set_string(&meta->album_artist, tag->value);}
+    else if(key_is(tag->key, "artist", NULL, NULL)) {set_string(&meta->artist, tag->value);}
+    else if(key_is(tag->key, "genre", NULL, NULL)) {set_string(&meta->genre, tag->value);}
+    else if(key_is(tag->key, "label", "publisher", "organization")) {set_string(&meta->label, tag->value);}
+    else if(key_is(tag->key, "producer", NULL, NULL)) {set_string(&meta->producer, tag->value);}
+    else if(key_is(tag->key, "composer", NULL, NULL)) {set_string(&meta->composer, tag->value);}
+    else if(key_is(tag->key, "track", "tracknumber", NULL)) {set_number_pair(&meta->track, &meta->track_total, tag->value);}
+    else if(key_is(tag->key, "disc", "discnumber", NULL)) {set_number_pair(&meta->disc, &meta->disc_total, tag->value);}
+    else if(key_is(tag->key, "date", "year", NULL) && meta->year == 0) {meta->year = strtoul(tag->value, NULL, 10);}
+  }
+
+  return;
+}
+
+
+
+static unsigned int hash_pointer(const char *p) {
+  uint64_t value = (uintptr_t)p;
+  return (value * 11400714819323198485ULL) >> 40;
+}
+
+
+static struct meta_cache_slot *find_slot(const char *path) {
+  unsigned int mask = cache_slots - 1;
+  unsigned int i = hash_pointer(path) & mask;
+
+  while(cache[i].path && cache[i].path != path) {
+    i = (i + 1) & mask;
+  }
+
+  return &cache[i];
+}
+
+
+static void grow_cache(void) {
+  struct meta_cache_slot *old = cache;
+  unsigned int old_slots = cache_slots;
+  size_t i;
+
+  cache_slots = cache_slots ? cache_slots * 2 : META_CACHE_MIN_SLOTS;
+  cache = mem_calloc(MEM_CACHE, cache_slots, sizeof(struct meta_cache_slot));
+
+  for(i = 0; i < old_slots; i++) {
+    if(old[i].path) {*find_slot(old[i].path) = old[i];}
+  }
+
+  mem_free(old);
+  return;
+}
+
+
+// Every file that gets opened leaves its tags here, so listings can be ordered and filtered
+// by them later without opening anything again
+void meta_cache_store(const char *path, const struct track_meta *meta) {
+  char *full_path = absolute_path(path);
+  const char *key = intern_find(full_path);
+
+  pthread_mutex_lock(&cache_lock);
+
+  // Over the memory budget the table stops growing. Files already in it are still updated,
+  // new ones go unremembered until a listing or 'scan' opens them again
+  bool full = (cache_count + 1) * 2 > cache_slots;
+  if(full && (cache_slots == 0 || !mem_over_budget())) {
+    grow_cache();
+    full = false;
+  }
+
+  struct meta_cache_slot *slot = key ? find_slot(key) : NULL;
+  if(slot == NULL || slot->path == NULL) {
+    // Only a path that is actually stored is interned, the string pool never shrinks
+    if(full) {
+      pthread_mutex_unlock(&cache_lock);
+      free(full_path);
+      return;
+    }
+    if(key == NULL) {
+      key = intern(full_path);
+      slot = find_slot(key);
+    }
+    cache_count++;
+  }
+  slot->path = key;
+  slot->meta = *meta;
+  pthread_mutex_unlock(&cache_lock);
+
+  free(full_path);
+  return;
+}
+
+
+// Returns 1 and fills meta if path has been seen, 0 otherwise
+int meta_cache_lookup(const char *path, struct track_meta *meta) {
+  char *full_path = absolute_path(path);
+  const char *key = intern_find(full_path);
+  int ret = 0;
+  free(full_path);
+
+  if(key == NULL) {return 0;}
+
+  pthread_mutex_lock(&cache_lock);
+  if(cache_slots > 0) {
+    struct meta_cache_slot *slot = find_slot(key);
+    if(slot->path) {
+      *meta = slot->meta;
+      ret = 1;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return ret;
+}
+
+
+// Copies up to max entries out of the cache, in no particular order. Returns how many it copied
+unsigned int meta_cache_copy(const char **paths, struct track_meta *metas, unsigned int max) {
+  unsigned int i, copied = 0;
+
+  pthread_mutex_lock(&cache_lock);
+  for(i = 0; i < cache_slots && copied < max; i++) {
+    if(cache[i].path == NULL) {continue;}
+
+    paths[copied] = cache[i].path;
+    metas[copied] = cache[i].meta;
+    copied++;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return copied;
+}
+
+
+unsigned int meta_cache_count(void) {
+  return cache_count;
+}
+
+
+// Release hook for the memory budget. Halves the table, keeping whatever still fits, and drops it
+// once it's down to the smallest size. Dropped files come back when they're listed or opened again
+void meta_cache_trim(void) {
+  struct meta_cache_slot *old;
+  unsigned int old_slots;
+  size_t i;
+
+  pthread_mutex_lock(&cache_lock);
+  old = cache;
+  old_slots = cache_slots;
+
+  cache = NULL;
+  cache_slots = 0;
+  cache_count = 0;
+  if(old_slots > META_CACHE_MIN_SLOTS && (cache = mem_calloc(MEM_CACHE, old_slots / 2, sizeof(struct meta_cache_slot)))) {
+    cache_slots = old_slots / 2;
+  }
+
+  for(i = 0; i < old_slots && cache_slots > 0 && (cache_count + 1) * 2 <= cache_slots; i++) {
+    if(old[i].path) {
+      *find_slot(old[i].path) = old[i];
+      cache_count++;
+    }
+  }
+
+  mem_free(old);
+  pthread_mutex_unlock(&cache_lock);
+
+  return;
+}
+
+
+void meta_cache_cleanup(void) {
+  pthread_mutex_lock(&cache_lock);
+  mem_free(cache);
+  cache = NULL;
+  cache_slots = 0;
+  cache_count = 0;
+  pthread_mutex_unlock(&cache_lock);
+  return;
+}
@@ -21,14 +21,24 @@ If not, see <https://www.gnu.org/licenses/>.
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <ncurses.h>
 
 #include <playback.h>
+#include <prefetch.h>
+#include <waveform.h>
+#include <spectrum.h>
+#include <sort.h>
+#include <filter.h>
+#include <cmdline.h>
+#include <mem.h>
+#include <library.h>
 #include <error_codes.h>
 #include <error.h>
 
@@ -64,6 +74,11 @@ static int message_count = 0;
 #define ELEM_DIR false
 #define ELEM_FILE true
 
+// What ui_filter_key() did with a key
+#define FILTER_KEEP 0
+#define FILTER_SELECTED 1
+#define FILTER_CLOSED 2
+
 struct fs_elem_data {
   unsigned int line_count;
   bool type;
@@ -83,8 +98,12 @@ static char *msg_ptr[] = {upstream_fs};
 static const struct fs_elem_data upstream_fs_data = {.line_count = 1, .type = ELEM_DIR};
 
 static FS_ELEMENT head = {.name = msg_ptr, .fs_elem_data = upstream_fs_data, .next = NULL};
+static FS_ELEMENT *tail = &head;
 static unsigned int file_list_depth = 0;
 
+// How files (not directories) in the file window are ordered
+static int file_sort_mode = SORT_NAME;
+
 
 
 typedef struct msg_node {
@@ -100,6 +119,59 @@ typedef struct msg_node {
 static MSG *latest_msg = NULL;
 static unsigned int msgbox_total_linecount = 0;
 
+// Messages can come from the playback thread and background jobs, not just the UI thread
+static pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set for --script runs. No ncurses windows exist, messages go to stdout instead
+static bool headless = false;
+
+// Windows drawn into since the last frame. Drawing only marks them, ui_render() sends them
+// all to the terminal at once
+#define DIRTY_FILE_WINDOW 1
+#define DIRTY_MESSAGE_BOX 2
+#define DIRTY_PLAYBACK_BAR 4
+#define DIRTY_METADATA_BAR 8
+#define DIRTY_COMMAND_BAR 16
+
+static unsigned int dirty_windows = 0;
+static int rendered_cursor_y = -1, rendered_cursor_x = -1;
+
+// The spectrum analyser takes the place of the message box while shown
+static bool spectrum_visible = false;
+static bool msgbox_stale = false;
+
+// '/' filter mode. filter_elems maps candidate numbers back to file window elements, head included
+static bool filter_active = false;
+static char filter_query[FILTER_MAX_QUERY + 1];
+static int filter_query_length = 0;
+static FS_ELEMENT **filter_elems = NULL;
+static unsigned int filter_match_count = 0;
+static unsigned int filter_selected = 0;
+static unsigned int filter_offset = 0;
+
+// ':' command line, edited in cmdline.c
+static bool cmdline_active = false;
+static unsigned int cmdline_column = 0;
+
+// Tag browser (library.c) in place of the directory listing. One line per row, row 0 is "../" like
+// in the listing. The rows, scroll positions and parents of the levels above are kept for the way back
+static bool library_mode = false;
+static int library_level = LIBRARY_ARTISTS;
+static unsigned int library_parent = 0;
+static unsigned int library_row = 0;
+static unsigned int library_top = 0;
+static unsigned int library_saved[LIBRARY_TRACKS + 1][3];
+
+
+void ui_set_headless(void) {
+  headless = true;
+  return;
+}
+
+bool ui_is_headless(void) {
+  return headless;
+}
+
 
 void init_ui(void) {
   getmaxyx(stdscr, term_size_y, term_size_x);
@@ -132,24 +204,62 @@ void init_ui(void) {
 
 
 void reset_cursor(void) {
-  move(user_y_pos, 0);
+  if(headless) {return;}
+  if(filter_active) {move(term_size_y, 3 + filter_query_length);}
+  else if(cmdline_active) {move(term_size_y, 3 + cmdline_column);}
+  else if(library_mode) {move(library_row - library_top, 0);}
+  else {move(user_y_pos, 0);}
+  return;
+}
+
+
+static void mark_dirty(unsigned int windows) {
+  dirty_windows |= windows;
   return;
 }
 
 
+// One frame: every window drawn into since the last one goes out in a single doupdate().
+// Returns false if there was nothing to send, not even a cursor movement
+bool ui_render(void) {
+  int cursor_y, cursor_x;
+
+  if(headless) {return false;}
+
+  reset_cursor();
+  getyx(stdscr, cursor_y, cursor_x);
+  if(dirty_windows == 0 && cursor_y == rendered_cursor_y && cursor_x == rendered_cursor_x) {return false;}
+
+  if(dirty_windows & DIRTY_FILE_WINDOW) {wnoutrefresh(file_window);}
+  if(dirty_windows & DIRTY_MESSAGE_BOX) {wnoutrefresh(message_box);}
+  if(dirty_windows & DIRTY_PLAYBACK_BAR) {wnoutrefresh(playback_bar);}
+  if(dirty_windows & DIRTY_METADATA_BAR) {wnoutrefresh(metadata_bar);}
+  if(dirty_windows & DIRTY_COMMAND_BAR) {wnoutrefresh(command_bar);}
+
+  // stdscr itself is never drawn into, this only carries the cursor position
+  wnoutrefresh(stdscr);
+  doupdate();
+
+  dirty_windows = 0;
+  rendered_cursor_y = cursor_y;
+  rendered_cursor_x = cursor_x;
+
+  return true;
+}
+
 
 
 
 void free_msg(MSG *msg) {
-  int i;
+  size_t i;
 
   for(i = 0; i < msg->line_count; i++) {
-    free(msg->message[i]);
+    mem_free(msg->message[i]);
   }
-  free(msg->message);
+  mem_free(msg->message);
   msgbox_total_linecount -= msg->line_count;
 
-  free(msg);
+  mem_free(msg);
 
   message_count--;
 
@@ -194,11 +304,19 @@ void update_msgbox(void) {
   int i, y = message_box_size_y - 1;
   static int message_count_last = 0;
 
+  // Messages keep arriving while the spectrum analyser has the box, they are drawn once it's closed
+  if(spectrum_visible) {return;}
+  if(message_count_last == message_count && !msgbox_stale) {return;}
+  msgbox_stale = false;
+
+  pthread_mutex_lock(&msg_lock);
   MSG *temp = latest_msg;
-  if(message_count_last == message_count) {return;}
   message_count_last = message_count;
 
-  if(temp == NULL) {return;}
+  if(temp == NULL) {
+    pthread_mutex_unlock(&msg_lock);
+    return;
+  }
   werase(message_box);
 
   while(msgbox_total_linecount > message_box_size_y) {free_oldest_msg();}
@@ -210,8 +328,9 @@ void update_msgbox(void) {
     }
     temp = temp->last;
   }
+  pthread_mutex_unlock(&msg_lock);
 
-  wrefresh(message_box);
+  mark_dirty(DIRTY_MESSAGE_BOX);
 
   return;
 }
@@ -219,17 +338,25 @@ void update_msgbox(void) {
 
 
 void display_msg(char *msg) {
-  MSG *temp = malloc(sizeof(MSG));
+  if(headless) {
+    pthread_mutex_lock(&msg_lock);
+    printf("%s\n", msg);
+    fflush(stdout);
+    pthread_mutex_unlock(&msg_lock);
+    return;
+  }
+
+  MSG *temp = mem_alloc(MEM_MESSAGES, sizeof(MSG));
   unsigned int length = strlen(msg);
   unsigned int remainder_buffer = 1;
-  int i;
+  size_t i;
 
   if(length % message_box_size_x == 0) {remainder_buffer = 0;}
   unsigned int ptr_count = (length / message_box_size_x) + remainder_buffer;
-  char **message_ptrs = malloc(ptr_count * sizeof(char *));
+  char **message_ptrs = mem_alloc(MEM_MESSAGES, ptr_count * sizeof(char *));
 
   for(i = 0; i < ptr_count; i++) {
-    message_ptrs[i] = malloc(message_box_size_x + 1);
+    message_ptrs[i] = mem_alloc(MEM_MESSAGES, message_box_size_x + 1);
     strncpy(message_ptrs[i], msg, message_box_size_x);
     message_ptrs[i][message_box_size_x] = 0;
     msg += message_box_size_x;
@@ -238,10 +365,12 @@ void display_msg(char *msg) {
   temp->message = message_ptrs;
   temp->line_count = ptr_count;
 
+  pthread_mutex_lock(&msg_lock);
   temp->last = latest_msg;
   latest_msg = temp;
   msgbox_total_linecount += ptr_count;
   message_count++;
+  pthread_mutex_unlock(&msg_lock);
 
   return;
 }
@@ -249,13 +378,13 @@ void display_msg(char *msg) {
 
 
 void free_fs_element(FS_ELEMENT *elem) {
-  int i;
+  size_t i;
   for(i = 0; i < elem->fs_elem_data.line_count; i ++) {
-    free(elem->name[i]);
+    mem_free(elem->name[i]);
   }
-  free(elem->name);
+  mem_free(elem->name);
 
-  free(elem);
+  mem_free(elem);
 }
 
 
@@ -272,6 +401,7 @@ void free_fs_list(void) {
 
     head.next = NULL;
   }
+  tail = &head;
   file_list_depth = 0;
 
   return;
@@ -280,7 +410,7 @@ void free_fs_list(void) {
 
 
 void add_fs_element(struct dirent *dir) {
-  FS_ELEMENT *new_elem = malloc(sizeof(FS_ELEMENT));
+  FS_ELEMENT *new_elem = mem_alloc(MEM_LISTING, sizeof(FS_ELEMENT));
 
   if(dir->d_type == DT_DIR) {
     new_elem->fs_elem_data.type = ELEM_DIR;
@@ -291,7 +421,7 @@ void add_fs_element(struct dirent *dir) {
 
   if(length % file_window_size_x == 0) {remainder_buffer = 0;}
   unsigned int ptr_count = (length / file_window_size_x) + remainder_buffer;
-  char **name_ptrs = malloc(ptr_count * sizeof(char *));
+  char **name_ptrs = mem_alloc(MEM_LISTING, ptr_count * sizeof(char *));
 
   new_elem->fs_elem_data.line_count = ptr_count;
   char *name = dir->d_name;
@@ -299,13 +429,13 @@ void add_fs_element(struct dirent *dir) {
 
   if(dir->d_type == DT_DIR) {
     name = calloc(strlen(dir->d_name) + 2, 1);
-    sprintf(name, "%s/\0", dir->d_name);
+    sprintf(name, "%s/", dir->d_name);
     save_name = name;
   }
 
-  int i;
+  size_t i;
   for(i = 0;i < ptr_count; i++) {
-    name_ptrs[i] = malloc(file_window_size_x + 1);
+    name_ptrs[i] = mem_alloc(MEM_LISTING, file_window_size_x + 1);
     strncpy(name_ptrs[i], name, file_window_size_x);
     name_ptrs[i][file_window_size_x] = 0;
     name += file_window_size_x;
@@ -316,13 +446,8 @@ void add_fs_element(struct dirent *dir) {
   new_elem->name = name_ptrs;
   new_elem->next = NULL;
 
-  FS_ELEMENT *temp = &head;
-
-  while(temp->next != NULL) {
-    temp = temp->next;
-  }
-
-  temp->next = new_elem;
+  tail->next = new_elem;
+  tail = new_elem;
 
   file_list_depth++;
 
@@ -331,7 +456,14 @@ void add_fs_element(struct dirent *dir) {
 
 
 
+static void display_library(void);
+
 void display_file_window(void) {
+  if(headless) {return;}
+  if(library_mode) {
+    display_library();
+    return;
+  }
   // start_line_number refers to which line of the first element in the offset is to be displayed at the very top of the file window
   unsigned int start_line_number = 0;
   FS_ELEMENT *start_element = &head;
@@ -355,7 +487,7 @@ void display_file_window(void) {
     }
   }
 
-  int i;
+  size_t i;
 
   for(i = start_line_number; i < start_element->fs_elem_data.line_count; i++) {
     mvwprintw(file_window, y, 0, "%s", start_element->name[i]);
@@ -381,19 +513,21 @@ void display_file_window(void) {
     }
   }
 
-  wrefresh(file_window);
+  mark_dirty(DIRTY_FILE_WINDOW);
 
 }
 
 
 void clear_command_bar(void) {
+  if(headless) {return;}
   werase(command_bar);
-  wrefresh(command_bar);
+  mark_dirty(DIRTY_COMMAND_BAR);
   return;
 }
 
 
 void display_command_bar(char *msg) {
+  if(headless) {return;}
   int msg_length = 0;
 
   werase(command_bar);
@@ -407,37 +541,150 @@ void display_command_bar(char *msg) {
 
   move(term_size_y, 4 + msg_length);
 
-  wrefresh(command_bar);
+  mark_dirty(DIRTY_COMMAND_BAR);
   return;
 }
 
 
 
 void display_metadata_bar(char *album, char *artist, unsigned int year, char *features) {
+  if(headless) {return;}
   werase(metadata_bar);
   mvwprintw(metadata_bar, 0, 0, "   %s - %s  %d  Artists: %s", album, artist, year, features);
 
-  wrefresh(metadata_bar);
+  mark_dirty(DIRTY_METADATA_BAR);
 
   return;
 }
 
 
+// Block characters from one eighth up to full height, needs ncursesw and a UTF-8 locale
+static const char *level_blocks[WAVEFORM_LEVELS + 1] = {" ", "\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588"};
+
+void display_waveform(int song_dur, int play_pos) {
+  int width = term_size_x - message_box_x;
+  int i;
+
+  if(width <= 0) {return;}
+  uint8_t *levels = malloc(width);
+
+  if(waveform_render(width, levels) == 0) {
+    mvwprintw(playback_bar, 0, message_box_x, "%*s", width, "");
+    free(levels);
+    return;
+  }
+
+  int playhead = song_dur > 0 ? play_pos * width / song_dur : 0;
+  if(playhead >= width) {playhead = width - 1;}
+
+  wmove(playback_bar, 0, message_box_x);
+  for(i = 0; i < width; i++) {
+    // What has already been played is drawn dim, the playhead itself reversed
+    if(i == playhead) {wattron(playback_bar, A_REVERSE);}
+    else if(i < playhead) {wattron(playback_bar, A_DIM);}
+
+    waddstr(playback_bar, level_blocks[levels[i]]);
+    wattroff(playback_bar, A_REVERSE | A_DIM);
+  }
+
+  free(levels);
+  return;
+}
+
+void ui_toggle_spectrum(void) {
+  if(headless) {return;}
+
+  spectrum_visible = !spectrum_visible;
+  if(spectrum_visible) {spectrum_init();}
+  if(spectrum_set_enabled(spectrum_visible) != 0) {
+    spectrum_visible = false;
+    display_msg("The spectrum analyser couldn't be started.");
+    return;
+  }
+
+  if(!spectrum_visible) {
+    msgbox_stale = true;
+    werase(message_box);
+    update_msgbox();
+    mark_dirty(DIRTY_MESSAGE_BOX);
+  }
+
+  return;
+}
+
+
+// Called every UI tick, so the analyser refreshes at the frame rate of the clock
+void update_spectrum(void) {
+  if(!spectrum_visible) {return;}
+
+  int bands = message_box_size_x - 1;
+  int rows = message_box_size_y;
+  int x, y;
+
+  if(bands <= 0) {return;}
+  float *levels = malloc(bands * sizeof(float));
+
+  if(spectrum_update(bands, levels) == 0) {
+    free(levels);
+    return;
+  }
+
+  werase(message_box);
+  for(x = 0; x < bands; x++) {
+    int height = levels[x] * rows * WAVEFORM_LEVELS;
+
+    for(y = 0; y < rows && height > 0; y++) {
+      int fill = height > WAVEFORM_LEVELS ? WAVEFORM_LEVELS : height;
+      mvwaddstr(message_box, rows - 1 - y, x + 1, level_blocks[fill]);
+      height -= fill;
+    }
+  }
+  mark_dirty(DIRTY_MESSAGE_BOX);
+
+  free(levels);
+  return;
+}
+
+
 void display_song_playback_bar(char *song_title) {
-  int song_dur = metadata_retrieve_int(META_TRACK_DURATION);
+  if(headless) {
+    if(song_title) {
+      char *msg = malloc(strlen(song_title) + 14);
+      sprintf(msg, "Now playing: %s", song_title);
+      display_msg(msg);
+      free(msg);
+    }
+    return;
+  }
+
+  struct playback_state state;
+  playback_read_state(&state);
+  int song_dur = state.duration;
+
+  // The title gets the left half of the bar, the waveform overview the right half
+  int title_width = message_box_x - 12;
+  if(title_width < 0) {title_width = 0;}
+
+  char *line = malloc(title_width + 1);
+  snprintf(line, title_width + 1, "%d:%2d  %s", song_dur / 60, song_dur % 60, song_title);
+  mvwprintw(playback_bar, 0, 11, "%-*s", title_width, line);
+  free(line);
 
-  mvwprintw(playback_bar, 0, 11, "                                                         ");
-  mvwprintw(playback_bar, 0, 11, "%d:%2d  %s", song_dur / 60, song_dur % 60, song_title);
+  display_waveform(song_dur, state.position);
 
-  wrefresh(playback_bar);
+  mark_dirty(DIRTY_PLAYBACK_BAR);
   return;
 }
 
 void display_playback_bar(void) {
-  int play_pos = playback_read_clock();
+  if(headless) {return;}
+  struct playback_state state;
+  playback_read_state(&state);
+  int play_pos = state.position;
 
   mvwprintw(playback_bar, 0, 0, "    %d:%2d / ", play_pos / 60, play_pos % 60);
-  wrefresh(playback_bar);
+  if(state.active) {display_waveform(state.duration, play_pos);}
+  mark_dirty(DIRTY_PLAYBACK_BAR);
 
   return;
 }
@@ -455,7 +702,7 @@ FS_ELEMENT *find_fs_element(int index) {
 
 
 int fs_list_check_valid(int index) {
-  if(index > file_list_depth) {return 1;}
+  if(index < 0 || (unsigned int)index > file_list_depth) {return 1;}
   FS_ELEMENT *temp = find_fs_element(index);
 
   if(temp->fs_elem_data.type == 0) {return 1;}
@@ -464,6 +711,21 @@ int fs_list_check_valid(int index) {
 
 
 
+// A long name is split over several display lines, this joins them back up. Returns a malloc'd string
+static char *element_name(FS_ELEMENT *elem) {
+  char *name = calloc((strlen(elem->name[0]) * elem->fs_elem_data.line_count) + 1, 1);
+  char *save_name = name;
+  size_t i;
+
+  for(i = 0; i < elem->fs_elem_data.line_count; i++) {
+    sprintf(name, "%s", elem->name[i]);
+    name += strlen(elem->name[i]);
+  }
+
+  return save_name;
+}
+
+
 char *fs_list_find_name(int index) {
   int i;
   FS_ELEMENT *elem = &head;
@@ -472,19 +734,33 @@ char *fs_list_find_name(int index) {
     elem = elem->next;
   }
 
-  char *ret = calloc((strlen(elem->name[0]) * elem->fs_elem_data.line_count) + 1, 1);
-  char *ret_save = ret;
-  for(i = 0; i < elem->fs_elem_data.line_count; i++) {
-    sprintf(ret, "%s\0", elem->name[i]);
-    ret += strlen(elem->name[i]);
-  }
+  return element_name(elem);
+}
 
-  return ret_save;
+
+
+// Files the cursor rests on are likely to be played next, so start pulling them off the disk
+void hint_selected_element(void) {
+  FS_ELEMENT *selected = find_fs_element(user_selected_element);
+  if(selected->fs_elem_data.type != ELEM_FILE) {return;}
+
+  char *name = fs_list_find_name(user_selected_element);
+  prefetch_hint(name);
+  free(name);
+
+  return;
 }
 
 
 
+static void library_nav(int step);
+
 void user_nav_up(void) {
+  if(headless) {return;}
+  if(library_mode) {
+    library_nav(-1);
+    return;
+  }
 
   if(user_selected_element == 0) {return;}
   user_selected_element--;
@@ -502,9 +778,15 @@ void user_nav_up(void) {
 
   move(user_y_pos, 0);
   display_file_window();
+  hint_selected_element();
 }
 
 void user_nav_down(void) {
+  if(headless) {return;}
+  if(library_mode) {
+    library_nav(1);
+    return;
+  }
 
   if(user_selected_element == file_list_depth) {return;}
   user_selected_element++;
@@ -523,35 +805,252 @@ void user_nav_down(void) {
 
   move(user_y_pos, 0);
   display_file_window();
+  hint_selected_element();
 }
 
 
 char *retrieve_fs_element(_Bool *type, int *index) {
   FS_ELEMENT *elem = find_fs_element(user_selected_element);
-  int i;
 
   *type = elem->fs_elem_data.type;
   *index = user_selected_element;
 
-  char *name = malloc((strlen(elem->name[0]) * elem->fs_elem_data.line_count) + 1);
-  char *save_name = name;
+  return element_name(elem);
+}
 
-  for(i = 0; i < elem->fs_elem_data.line_count; i++) {
-    sprintf(name, "%s", elem->name[i]);
-    name += strlen(elem->name[i]);
+
+
+// Selects element index of the file window and scrolls it into the middle
+static void jump_to_element(unsigned int index) {
+  FS_ELEMENT *elem = &head;
+  unsigned int lines_before = 0;
+  size_t i;
+
+  for(i = 0; i < index && elem->next; i++) {
+    lines_before += elem->fs_elem_data.line_count;
+    elem = elem->next;
   }
 
-  return save_name;
+  current_file_window_display_offset = lines_before > file_window_size_y / 2 ? lines_before - file_window_size_y / 2 : 0;
+  user_y_pos = lines_before - current_file_window_display_offset;
+  user_selected_element = i;
+
+  display_file_window();
+  move(user_y_pos, 0);
+  hint_selected_element();
+
+  return;
+}
+
+
+
+void ui_get_cursor(unsigned int *selected, unsigned int *offset, unsigned int *y) {
+  *selected = user_selected_element;
+  *offset = current_file_window_display_offset;
+  *y = user_y_pos;
+  return;
+}
+
+
+// Puts the cursor back where ui_get_cursor() found it, if the listing still fits those numbers.
+// Otherwise the element is just scrolled into view
+void ui_set_cursor(unsigned int selected, unsigned int offset, unsigned int y) {
+  FS_ELEMENT *elem = &head;
+  unsigned int lines_before = 0;
+  size_t i;
+
+  if(headless) {return;}
+  if(selected > file_list_depth) {selected = 0;}
+
+  for(i = 0; i < selected && elem->next; i++) {
+    lines_before += elem->fs_elem_data.line_count;
+    elem = elem->next;
+  }
+
+  if(lines_before < offset || lines_before - offset != y || y >= file_window_size_y) {
+    jump_to_element(selected);
+    return;
+  }
+
+  user_selected_element = selected;
+  current_file_window_display_offset = offset;
+  user_y_pos = y;
+
+  display_file_window();
+  move(user_y_pos, 0);
+  hint_selected_element();
+
+  return;
+}
+
+
+
+// One match per line, never wrapped, with the characters the query matched highlighted
+static void display_filter(void) {
+  int positions[FILTER_MAX_QUERY];
+  unsigned int row;
+  int j;
+
+  if(filter_selected < filter_offset) {filter_offset = filter_selected;}
+  if(filter_selected >= filter_offset + file_window_size_y) {filter_offset = filter_selected - file_window_size_y + 1;}
+
+  werase(file_window);
+
+  for(row = 0; row < file_window_size_y && filter_offset + row < filter_match_count; row++) {
+    unsigned int candidate = filter_result(filter_offset + row);
+    char *name = element_name(filter_elems[candidate]);
+    int length = strlen(name);
+    int matched = filter_positions(candidate, filter_query, positions);
+    int next = 0;
+    attr_t base = filter_offset + row == filter_selected ? A_REVERSE : A_NORMAL;
+
+    if(length > (int)file_window_size_x) {length = file_window_size_x;}
+    wmove(file_window, row, 0);
+
+    // Runs of plain and highlighted characters
+    for(j = 0; j < length;) {
+      bool highlight = next < matched && positions[next] == j;
+      int run = 0;
+
+      while(j + run < length && (next < matched && positions[next] == j + run) == highlight) {
+        if(highlight) {next++;}
+        run++;
+      }
+
+      wattrset(file_window, highlight ? base | A_BOLD | A_UNDERLINE : base);
+      waddnstr(file_window, name + j, run);
+      j += run;
+    }
+    wattrset(file_window, A_NORMAL);
+
+    free(name);
+  }
+
+  mark_dirty(DIRTY_FILE_WINDOW);
+
+  werase(command_bar);
+  mvwprintw(command_bar, 0, 0, " /%s   (%u of %u)", filter_query, filter_match_count, file_list_depth + 1);
+  mark_dirty(DIRTY_COMMAND_BAR);
+  move(term_size_y, 3 + filter_query_length);
+
+  return;
+}
+
+
+void ui_filter_begin(void) {
+  if(headless || filter_active || library_mode) {return;}
+
+  unsigned int count = file_list_depth + 1;
+  const char **names = malloc(count * sizeof(char *));
+  FS_ELEMENT *elem = &head;
+  size_t i;
+
+  filter_elems = mem_alloc(MEM_LISTING, count * sizeof(FS_ELEMENT *));
+  for(i = 0; i < count && elem; i++) {
+    filter_elems[i] = elem;
+    names[i] = element_name(elem);
+    elem = elem->next;
+  }
+
+  filter_set_candidates(names, i);
+  for(count = i, i = 0; i < count; i++) {free((char *)names[i]);}
+  free(names);
+
+  filter_active = true;
+  filter_query[0] = 0;
+  filter_query_length = 0;
+  filter_match_count = count;
+  filter_selected = 0;
+  filter_offset = 0;
+
+  display_filter();
+  return;
+}
+
+
+static void filter_end(void) {
+  filter_active = false;
+  filter_clear();
+  mem_free(filter_elems);
+  filter_elems = NULL;
+
+  werase(command_bar);
+  mark_dirty(DIRTY_COMMAND_BAR);
+  display_file_window();
+
+  return;
+}
+
+
+bool ui_filter_active(void) {
+  return filter_active;
+}
+
+
+// Takes every key while the filter is open. Returns FILTER_SELECTED once Enter picked a match,
+// which is then the selected element of the file window, as if the user had navigated to it
+int ui_filter_key(int ch) {
+  switch(ch) {
+    case 27:
+      filter_end();
+      reset_cursor();
+      return FILTER_CLOSED;
+
+    case KEY_UP:
+      if(filter_selected > 0) {filter_selected--;}
+      break;
+
+    case KEY_DOWN:
+      if(filter_selected + 1 < filter_match_count) {filter_selected++;}
+      break;
+
+    case KEY_ENTER:
+    case 10:
+      if(filter_match_count > 0) {
+        unsigned int index = filter_result(filter_selected);
+        filter_end();
+        jump_to_element(index);
+        return FILTER_SELECTED;
+      }
+      break;
+
+    case KEY_BACKSPACE:
+    case 127:
+    case 8:
+      if(filter_query_length == 0) {
+        filter_end();
+        reset_cursor();
+        return FILTER_CLOSED;
+      }
+      filter_query[--filter_query_length] = 0;
+      filter_match_count = filter_update(filter_query);
+      filter_selected = 0;
+      break;
+
+    default:
+      if(ch < 32 || ch > 255 || ch == 127 || filter_query_length == FILTER_MAX_QUERY) {break;}
+      filter_query[filter_query_length++] = ch;
+      filter_query[filter_query_length] = 0;
+      filter_match_count = filter_update(filter_query);
+      filter_selected = 0;
+      break;
+  }
+
+  display_filter();
+  return FILTER_KEEP;
 }
 
 
 
 void update_playback_bar(void) {
   static int temp = 99;
-  if(temp != playback_read_clock()) {
+  struct playback_state state;
+  playback_read_state(&state);
+
+  if(temp != state.position) {
     display_playback_bar();
-    if(check_playback_active() == 0) {display_song_playback_bar(metadata_retrieve_str(META_TRACK_TITLE));}
-    temp = playback_read_clock();
+    if(state.active) {display_song_playback_bar(state.meta[META_TRACK_TITLE]);}
+    temp = state.position;
   }
 
   return;
@@ -586,27 +1085,37 @@ void ui_open_dir(const char *dir_name) {
     return;
   }
 
+  // There is no file window to fill, changing directory is all that's wanted
+  if(headless) {return;}
+
+  // Opening a directory always goes back to the directory listing
+  if(library_mode) {
+    library_mode = false;
+    library_cleanup();
+  }
 
 
   struct dirent **dir_namelist;
   struct dirent **file_namelist;
 
 
-  // scandir() is used to seperate directories and files, and sort both alphabetically
-  // I'm surprised the C standard library has this functionality,
-  // I expected to have to implement sorting myself
-  int dir_count = scandir(".", &dir_namelist, dir_filter, alphasort);
+  // scandir() is used to seperate directories and files. Sorting is left to sort_dirents(),
+  // alphasort() would strcoll() on every comparison and put "10" before "2"
+  int dir_count = scandir(".", &dir_namelist, dir_filter, NULL);
   if(dir_count < 0) {
     trackjack_error(JACK_ERR_OPENDIR, (LIB_ERROR)errno);
     return;
   }
 
-  int file_count = scandir(".", &file_namelist, file_filter, alphasort);
+  int file_count = scandir(".", &file_namelist, file_filter, NULL);
   if(file_count < 0) {
     trackjack_error(JACK_ERR_OPENDIR, (LIB_ERROR)errno);
     return;
   }
 
+  sort_dirents(".", dir_namelist, dir_count, SORT_NAME);
+  sort_dirents(".", file_namelist, file_count, file_sort_mode);
+
   free_fs_list();
 
   int i;
@@ -645,7 +1154,22 @@ void ui_open_dir(const char *dir_name) {
 
 
 
+// Files whose tags haven't been read yet still go by name, after the ones that have
+void ui_set_sort_mode(int mode) {
+  file_sort_mode = mode;
+  if(!headless) {ui_open_dir(".");}
+  return;
+}
+
+int ui_get_sort_mode(void) {
+  return file_sort_mode;
+}
+
+
+
 void cleanup_ui(void) {
+  if(headless) {return;}
+
   delwin(file_window);
   delwin(message_box);
   delwin(playback_bar);
@@ -653,4 +1177,202 @@ void cleanup_ui(void) {
 
   free_all_msg();
   free_fs_list();
+  library_cleanup();
+}
+
+
+
+
+// Draws as much of the command line as fits, scrolled so the cursor stays in view
+static void display_cmdline(void) {
+  const char *text = cmdline_text();
+  unsigned int column = cmdline_cursor_column();
+  unsigned int width = term_size_x > 4 ? term_size_x - 4 : 1;
+  unsigned int skip = column >= width ? column - width + 1 : 0;
+
+  // skip counts characters, the text is UTF-8
+  while(*text && skip > 0) {
+    text++;
+    while((*text & 0xC0) == 0x80) {text++;}
+    skip--;
+  }
+  cmdline_column = column >= width ? width - 1 : column;
+
+  werase(command_bar);
+  mvwprintw(command_bar, 0, 0, " : %s", text);
+  mark_dirty(DIRTY_COMMAND_BAR);
+  move(term_size_y, 3 + cmdline_column);
+
+  return;
+}
+
+
+void ui_cmdline_begin(const char *initial) {
+  if(headless) {return;}
+
+  cmdline_begin(initial);
+  cmdline_active = true;
+  curs_set(TRUE);
+  display_cmdline();
+
+  return;
+}
+
+
+bool ui_cmdline_active(void) {
+  return cmdline_active;
+}
+
+
+// Takes every key while the command line is open. Returns CMDLINE_SUBMIT once Enter was pressed,
+// cmdline_text() then holds the command until the line is opened again
+int ui_cmdline_key(int ch) {
+  int ret = cmdline_key(ch);
+
+  if(ret == CMDLINE_KEEP) {
+    display_cmdline();
+    return ret;
+  }
+
+  cmdline_active = false;
+  werase(command_bar);
+  mark_dirty(DIRTY_COMMAND_BAR);
+  reset_cursor();
+
+  return ret;
+}
+
+
+
+static void display_library(void) {
+  char label[512];
+  unsigned int rows = library_count(library_level, library_parent) + 1;
+  unsigned int row;
+
+  werase(file_window);
+
+  // Only the rows on screen are looked at, however big the library is
+  for(row = library_top; row < rows && row - library_top < file_window_size_y; row++) {
+    if(row == 0) {snprintf(label, sizeof(label), "%s", upstream_fs);}
+    else {library_label(library_level, library_child(library_level, library_parent, row - 1), label, sizeof(label));}
+
+    mvwaddnstr(file_window, row - library_top, 0, label, file_window_size_x);
+  }
+
+  mark_dirty(DIRTY_FILE_WINDOW);
+  return;
+}
+
+
+static void library_nav(int step) {
+  unsigned int rows = library_count(library_level, library_parent) + 1;
+
+  if(step < 0 && library_row == 0) {return;}
+  if(step > 0 && library_row + 1 >= rows) {return;}
+  library_row += step;
+
+  if(library_row < library_top) {library_top = library_row;}
+  if(library_row >= library_top + file_window_size_y) {library_top = library_row - file_window_size_y + 1;}
+
+  display_library();
+  reset_cursor();
+
+  if(library_level == LIBRARY_TRACKS && library_row > 0) {
+    prefetch_hint(library_track_path(library_child(library_level, library_parent, library_row - 1)));
+  }
+
+  return;
+}
+
+
+// Indexes the tags read so far and shows them in the file window, artists first
+void ui_library_open(void) {
+  char msg[160];
+
+  if(headless || library_mode) {return;}
+
+  unsigned int count = library_build();
+  if(count == 0) {
+    display_msg("No tags have been read yet. 'scan <dir>' reads them.");
+    return;
+  }
+
+  library_mode = true;
+  library_level = LIBRARY_ARTISTS;
+  library_parent = 0;
+  library_row = 0;
+  library_top = 0;
+
+  snprintf(msg, sizeof(msg), "Library: %u tracks by %u artists. Enter on ../ goes back to the directory.", count, library_count(LIBRARY_ARTISTS, 0));
+  display_msg(msg);
+
+  display_library();
+  reset_cursor();
+  return;
+}
+
+
+void ui_library_close(void) {
+  if(!library_mode) {return;}
+
+  library_mode = false;
+  library_cleanup();
+
+  display_file_window();
+  reset_cursor();
+  return;
+}
+
+
+bool ui_library_active(void) {
+  return library_mode;
+}
+
+
+// Enter in the tag browser. Goes down a level or back up one, or returns the path
+// of the track to play (malloc'd), NULL otherwise
+char *ui_library_enter(void) {
+  if(library_row == 0) {
+    if(library_level == LIBRARY_ARTISTS) {
+      ui_library_close();
+      return NULL;
+    }
+
+    library_level--;
+    library_row = library_saved[library_level][0];
+    library_top = library_saved[library_level][1];
+    library_parent = library_saved[library_level][2];
+  }
+  else {
+    unsigned int id = library_child(library_level, library_parent, library_row - 1);
+    if(library_level == LIBRARY_TRACKS) {return strdup(library_track_path(id));}
+
+    library_saved[library_level][0] = library_row;
+    library_saved[library_level][1] = library_top;
+    library_saved[library_level][2] = library_parent;
+
+    library_level++;
+    library_parent = id;
+    library_row = 0;
+    library_top = 0;
+  }
+
+  display_library();
+  reset_cursor();
+  return NULL;
+}
+
+
+// 'a' in the tag browser: the highlighted artist, album or track goes to the play queue
+void ui_library_queue_selected(void) {
+  char msg[160];
+
+  if(library_row == 0) {return;}
+
+  unsigned int count = library_queue(library_level, library_child(library_level, library_parent, library_row - 1));
+  snprintf(msg, sizeof(msg), "Queued %u tracks.", count);
+  display_msg(msg);
+  playback_play_queue();
+
+  return;
 }
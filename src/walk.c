@@ -0,0 +1,488 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <walk.h>
+#include <queue.h>
+#include <playback.h>
+#include <sort.h>
+#include <track_meta.h>
+#include <fs_util.h>
+#include <mem.h>
+#include <ui.h>
+
+
+// Directories are read on up to this many threads. Past that the disk, not the CPU, is the limit
+#define WALK_MAX_WORKERS 8
+
+#define WALK_GETDENTS_BUFFER (64 * 1024)
+
+// Like the playlist loader: the first track goes to the queue on its own so it can start playing,
+// the rest follow in batches
+#define WALK_BATCH 512
+
+
+// Not in every libc's headers
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// One directory of the tree. A worker reads it, sorts what it found and creates the nodes for
+// its subdirectories. The emitting thread then hands on its files and moves on to its children
+struct walk_dir {
+  char *path;
+  bool read;
+
+  struct dirent **files;
+  int file_count;
+
+  struct walk_dir **children;
+  int child_count;
+};
+
+// One walk_tree() call, so a dupes run and a queue walk can go at the same time
+struct walk_tree {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  // Directories waiting for a worker. Taken from the end, and children are pushed last to first,
+  // so workers go depth first in the same order the tree is emitted in
+  struct walk_dir **pending;
+  unsigned int pending_count;
+  unsigned int pending_capacity;
+  bool workers_done;
+
+  int mode;
+  volatile bool *stop;
+  unsigned long dir_count;
+
+  void (*found)(char *path, void *data);
+  void *data;
+};
+
+// What the queue walk hands its files on to
+struct queue_sink {
+  char *batch[WALK_BATCH];
+  unsigned int count;
+  unsigned int limit;
+};
+
+
+static pthread_t walker;
+static bool walker_running = false;
+static volatile bool stop_walk = false;
+
+static char *walk_root = NULL;
+static int walk_mode = SORT_NAME;
+
+// Set by the walker thread, acted on by walk_update() on the main thread
+static atomic_bool first_entry_ready = false;
+static atomic_bool walk_finished = false;
+
+static unsigned long queued_count = 0;
+static unsigned long dir_count = 0;
+static double walk_ms = 0;
+static bool walk_failed = false;
+
+
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+
+static bool stopped(struct walk_tree *tree) {
+  return tree->stop && *tree->stop;
+}
+
+
+static struct walk_dir *new_dir(const char *parent, const char *name) {
+  struct walk_dir *node = mem_calloc(MEM_LISTING, 1, sizeof(struct walk_dir));
+
+  if(name == NULL) {node->path = mem_strdup(MEM_LISTING, parent);}
+  else {
+    node->path = mem_alloc(MEM_LISTING, strlen(parent) + strlen(name) + 2);
+    sprintf(node->path, "%s/%s", parent, name);
+  }
+
+  return node;
+}
+
+
+// Sized to the name, the way scandir() does it, since sort_dirents() only looks at d_name
+static struct dirent *new_entry(const char *name) {
+  size_t length = strlen(name);
+  struct dirent *entry = mem_alloc(MEM_LISTING, offsetof(struct dirent, d_name) + length + 1);
+
+  memcpy(entry->d_name, name, length + 1);
+  return entry;
+}
+
+
+static void append_entry(struct dirent ***list, int *count, int *capacity, const char *name) {
+  if(*count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    *list = *list ? mem_realloc(*list, *capacity * sizeof(struct dirent *)) : mem_alloc(MEM_LISTING, *capacity * sizeof(struct dirent *));
+  }
+
+  (*list)[(*count)++] = new_entry(name);
+  return;
+}
+
+
+// Audio by extension, or anything that has been opened as audio before and so has cached tags
+static bool wanted_file(const char *dir, const char *name) {
+  char path[4096];
+  struct track_meta meta;
+
+  if(is_audio_filename(name)) {return true;}
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return meta_cache_lookup(path, &meta);
+}
+
+
+
+static void push_pending(struct walk_tree *tree, struct walk_dir *node) {
+  if(tree->pending_count == tree->pending_capacity) {
+    tree->pending_capacity = tree->pending_capacity ? tree->pending_capacity * 2 : 64;
+    tree->pending = realloc(tree->pending, tree->pending_capacity * sizeof(struct walk_dir *));
+  }
+
+  tree->pending[tree->pending_count++] = node;
+  return;
+}
+
+
+static void read_dir(struct walk_tree *tree, struct walk_dir *node) {
+  char *buffer = malloc(WALK_GETDENTS_BUFFER);
+  struct dirent **subdirs = NULL;
+  int subdir_count = 0, subdir_capacity = 0, file_capacity = 0;
+  struct stat st;
+  long length, offset;
+  int i;
+
+  int fd = openat(AT_FDCWD, node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  while(fd >= 0 && !stopped(tree) && (length = syscall(SYS_getdents64, fd, buffer, WALK_GETDENTS_BUFFER)) > 0) {
+    for(offset = 0; offset < length; offset += ((struct linux_dirent64 *)(buffer + offset))->d_reclen) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+      unsigned char type = entry->d_type;
+
+      // Hidden files, and . and ..
+      if(entry->d_name[0] == '.') {continue;}
+
+      // Symlinks are followed to files, never to directories, so a link back up the tree can't loop
+      if(type == DT_UNKNOWN || type == DT_LNK) {
+        if(fstatat(fd, entry->d_name, &st, 0) != 0) {continue;}
+
+        if(S_ISREG(st.st_mode)) {type = DT_REG;}
+        else if(S_ISDIR(st.st_mode) && type == DT_UNKNOWN) {type = DT_DIR;}
+        else {continue;}
+      }
+
+      if(type == DT_DIR) {append_entry(&subdirs, &subdir_count, &subdir_capacity, entry->d_name);}
+      else if(type == DT_REG && wanted_file(node->path, entry->d_name)) {
+        append_entry(&node->files, &node->file_count, &file_capacity, entry->d_name);
+      }
+    }
+  }
+
+  if(fd >= 0) {close(fd);}
+  free(buffer);
+
+  // Sorting happens here on the workers, so it is spread over them too
+  sort_dirents(node->path, node->files, node->file_count, tree->mode);
+  sort_dirents(node->path, subdirs, subdir_count, SORT_NAME);
+
+  if(subdir_count > 0) {node->children = mem_alloc(MEM_LISTING, subdir_count * sizeof(struct walk_dir *));}
+  for(i = 0; i < subdir_count; i++) {
+    node->children[i] = new_dir(node->path, subdirs[i]->d_name);
+    mem_free(subdirs[i]);
+  }
+  node->child_count = subdir_count;
+  mem_free(subdirs);
+
+  pthread_mutex_lock(&tree->lock);
+  for(i = subdir_count - 1; i >= 0; i--) {push_pending(tree, node->children[i]);}
+  node->read = true;
+  tree->dir_count++;
+  pthread_cond_broadcast(&tree->cond);
+  pthread_mutex_unlock(&tree->lock);
+
+  return;
+}
+
+
+static void *worker_thread(void *arg) {
+  struct walk_tree *tree = arg;
+  struct walk_dir *node;
+
+  pthread_mutex_lock(&tree->lock);
+  while(true) {
+    if(tree->pending_count == 0) {
+      if(tree->workers_done) {break;}
+      pthread_cond_wait(&tree->cond, &tree->lock);
+      continue;
+    }
+
+    node = tree->pending[--tree->pending_count];
+    pthread_mutex_unlock(&tree->lock);
+
+    // Once stopped, what is left is only marked read so the emitting thread can free it
+    if(stopped(tree)) {
+      pthread_mutex_lock(&tree->lock);
+      node->read = true;
+      pthread_cond_broadcast(&tree->cond);
+      continue;
+    }
+
+    read_dir(tree, node);
+    pthread_mutex_lock(&tree->lock);
+  }
+  pthread_mutex_unlock(&tree->lock);
+
+  return NULL;
+}
+
+
+// Hands on node's files, then each subdirectory's in turn, waiting for the workers wherever it
+// catches up with them. Frees the nodes as it goes
+static void emit(struct walk_tree *tree, struct walk_dir *node) {
+  int i;
+
+  pthread_mutex_lock(&tree->lock);
+  while(!node->read) {pthread_cond_wait(&tree->cond, &tree->lock);}
+  pthread_mutex_unlock(&tree->lock);
+
+  for(i = 0; i < node->file_count; i++) {
+    if(!stopped(tree)) {
+      char *path = malloc(strlen(node->path) + strlen(node->files[i]->d_name) + 2);
+      sprintf(path, "%s/%s", node->path, node->files[i]->d_name);
+      tree->found(path, tree->data);
+    }
+    mem_free(node->files[i]);
+  }
+
+  for(i = 0; i < node->child_count; i++) {emit(tree, node->children[i]);}
+
+  mem_free(node->files);
+  mem_free(node->children);
+  mem_free(node->path);
+  mem_free(node);
+
+  return;
+}
+
+
+// Reads the tree under dir on up to WALK_MAX_WORKERS threads and calls found on the calling thread
+// with each audio file in it, malloc'd and the caller's to free. Files come directory by directory
+// in name order, and within a directory ordered by sort_mode. Hidden files are skipped and symlinks
+// only followed to files. Stops early once *stop is set, if stop isn't NULL.
+// Returns the number of directories read, or -1 if no thread could be started
+long walk_tree(const char *dir, int sort_mode, volatile bool *stop, void (*found)(char *path, void *data), void *data) {
+  struct walk_tree tree = {.mode = sort_mode, .stop = stop, .found = found, .data = data};
+  pthread_t workers[WALK_MAX_WORKERS];
+  int worker_count = 0;
+  int i;
+
+  struct walk_dir *root = new_dir(dir, NULL);
+  size_t length = strlen(root->path);
+  while(length > 1 && root->path[length - 1] == '/') {root->path[--length] = 0;}
+
+  pthread_mutex_init(&tree.lock, NULL);
+  pthread_cond_init(&tree.cond, NULL);
+  push_pending(&tree, root);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if(cores > WALK_MAX_WORKERS) {cores = WALK_MAX_WORKERS;}
+
+  for(i = 0; i < cores; i++) {
+    if(pthread_create(&workers[worker_count], NULL, worker_thread, &tree) == 0) {worker_count++;}
+  }
+
+  if(worker_count == 0) {
+    mem_free(root->path);
+    mem_free(root);
+  }
+  else {emit(&tree, root);}
+
+  // Every node has been emitted, so nothing is pending any more
+  pthread_mutex_lock(&tree.lock);
+  tree.workers_done = true;
+  pthread_cond_broadcast(&tree.cond);
+  pthread_mutex_unlock(&tree.lock);
+  for(i = 0; i < worker_count; i++) {pthread_join(workers[i], NULL);}
+
+  free(tree.pending);
+  pthread_cond_destroy(&tree.cond);
+  pthread_mutex_destroy(&tree.lock);
+
+  return worker_count > 0 ? (long)tree.dir_count : -1;
+}
+
+
+
+static void flush_batch(struct queue_sink *sink) {
+  queue_push_batch(sink->batch, sink->count);
+  sink->count = 0;
+
+  if(sink->limit == 1) {
+    sink->limit = WALK_BATCH;
+    atomic_store(&first_entry_ready, true);
+  }
+
+  return;
+}
+
+
+static void queue_found(char *path, void *data) {
+  struct queue_sink *sink = data;
+
+  sink->batch[sink->count++] = path;
+  queued_count++;
+  if(sink->count == sink->limit) {flush_batch(sink);}
+
+  return;
+}
+
+
+static void *walker_thread(void *arg) {
+  struct timespec start;
+  struct queue_sink sink = {.count = 0, .limit = 1};
+
+  (void)arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  long dirs = walk_tree(walk_root, walk_mode, &stop_walk, queue_found, &sink);
+  if(dirs < 0) {walk_failed = true;}
+  else {dir_count = dirs;}
+
+  if(sink.count > 0) {flush_batch(&sink);}
+
+  free(walk_root);
+  walk_root = NULL;
+
+  walk_ms = elapsed_ms(&start);
+  atomic_store(&walk_finished, true);
+
+  return NULL;
+}
+
+
+
+static void join_walker(void) {
+  if(!walker_running) {return;}
+
+  pthread_join(walker, NULL);
+  walker_running = false;
+
+  return;
+}
+
+
+// Starts appending every audio file under dir to the play queue in the background, directory by
+// directory in name order, and within a directory ordered by sort_mode (SORT_NAME or SORT_TRACK).
+// Returns 1 if another walk is still going, -1 if dir isn't a directory
+int walk_enqueue(const char *dir, int sort_mode) {
+  struct stat st;
+
+  if(walker_running) {return 1;}
+  if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {return -1;}
+
+  walk_root = absolute_path(dir);
+
+  walk_mode = sort_mode;
+  queued_count = 0;
+  dir_count = 0;
+  walk_failed = false;
+  stop_walk = false;
+  atomic_store(&first_entry_ready, false);
+  atomic_store(&walk_finished, false);
+
+  if(pthread_create(&walker, NULL, walker_thread, NULL) != 0) {
+    free(walk_root);
+    walk_root = NULL;
+    return -1;
+  }
+  walker_running = true;
+
+  return 0;
+}
+
+
+// Called once per tick from the main loop, so playback and messages only ever start from the UI thread
+void walk_update(void) {
+  char msg[160];
+
+  if(!walker_running) {return;}
+
+  if(atomic_exchange(&first_entry_ready, false)) {playback_play_queue();}
+
+  if(atomic_load(&walk_finished)) {
+    if(walk_failed) {display_msg("TJ_ERR: Could not start reading the directory tree.");}
+    else {
+      snprintf(msg, sizeof(msg), "Queued %lu tracks from %lu directories in %.1f ms.", queued_count, dir_count, walk_ms);
+      display_msg(msg);
+    }
+
+    join_walker();
+  }
+
+  return;
+}
+
+
+int walk_running(void) {
+  return walker_running;
+}
+
+
+void walk_cleanup(void) {
+  stop_walk = true;
+  join_walker();
+  return;
+}
@@ -0,0 +1,458 @@
+/*
+Copyright (C) 2025 Quinn Borrok
+
+This file is part of Trackjack.
+
+Trackjack is free software: you can redistribute it and/or modify it under the terms
+of the GNU General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Trackjack is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program.
+If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include <audio_source.h>
+#include <waveform.h>
+#include <fs_util.h>
+#include <mem.h>
+
+
+// Overviews kept in memory for the current track and the next few
+#define WAVEFORM_SLOTS 16
+#define WAVEFORM_JOB_SLOTS 32
+
+// Decoded audio is first reduced to min/max blocks of this many frames, then the blocks to bins,
+// so the length of the track doesn't need to be known up front
+#define WAVEFORM_BLOCK_FRAMES 1024
+
+#define WAVEFORM_MAGIC "TJPK"
+#define WAVEFORM_VERSION 1
+#define WAVEFORM_HEADER_SIZE 8
+#define WAVEFORM_FILE_SIZE (WAVEFORM_HEADER_SIZE + WAVEFORM_BINS * 2)
+
+#define STATE_EMPTY 0
+#define STATE_PENDING 1
+#define STATE_READY 2
+#define STATE_FAILED 3
+
+
+struct overview {
+  char *path;
+  int state;
+  unsigned int stamp;
+  // Counted against the cache pool, only there once the overview is ready
+  int8_t *peaks;
+};
+
+
+static pthread_mutex_t waveform_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t waveform_cond = PTHREAD_COND_INITIALIZER;
+
+static struct overview overviews[WAVEFORM_SLOTS];
+static unsigned int stamp_counter = 0;
+static char *current_path = NULL;
+
+static char *jobs[WAVEFORM_JOB_SLOTS];
+static unsigned int job_head = 0;
+static unsigned int job_count = 0;
+
+static pthread_t *workers = NULL;
+static unsigned int worker_count = 0;
+static bool stop_workers = false;
+
+static char *cache_dir = NULL;
+
+
+
+static void clear_overview(struct overview *entry) {
+  free(entry->path);
+  mem_free(entry->peaks);
+  entry->path = NULL;
+  entry->peaks = NULL;
+  entry->state = STATE_EMPTY;
+  return;
+}
+
+
+static struct overview *find_overview(const char *path) {
+  int i;
+  for(i = 0; i < WAVEFORM_SLOTS; i++) {
+    if(overviews[i].path && strcmp(overviews[i].path, path) == 0) {return &overviews[i];}
+  }
+
+  return NULL;
+}
+
+
+// Cache files are named after the file's identity, so a re-ripped or retagged file gets a fresh overview
+static char *cache_file(const char *path) {
+  if(cache_dir == NULL) {return NULL;}
+
+  uint64_t hash = file_identity(path);
+  if(hash == 0) {return NULL;}
+
+  char *ret = malloc(strlen(cache_dir) + 22);
+  sprintf(ret, "%s/%016llx", cache_dir, (unsigned long long)hash);
+  return ret;
+}
+
+
+static bool load_cached(const char *file, int8_t *peaks) {
+  uint8_t data[WAVEFORM_FILE_SIZE];
+
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {return false;}
+  ssize_t length = read(fd, data, WAVEFORM_FILE_SIZE);
+  close(fd);
+
+  if(length != WAVEFORM_FILE_SIZE || memcmp(data, WAVEFORM_MAGIC, 4) != 0) {return false;}
+  if(data[4] != WAVEFORM_VERSION || data[6] + data[7] * 256 != WAVEFORM_BINS) {return false;}
+
+  memcpy(peaks, data + WAVEFORM_HEADER_SIZE, WAVEFORM_BINS * 2);
+  return true;
+}
+
+
+static void store_cached(const char *file, int8_t *peaks) {
+  uint8_t data[WAVEFORM_FILE_SIZE] = {0};
+  char *temp = malloc(strlen(file) + 5);
+
+  memcpy(data, WAVEFORM_MAGIC, 4);
+  data[4] = WAVEFORM_VERSION;
+  data[6] = WAVEFORM_BINS & 0xFF;
+  data[7] = WAVEFORM_BINS >> 8;
+  memcpy(data + WAVEFORM_HEADER_SIZE, peaks, WAVEFORM_BINS * 2);
+
+  // Written under a temporary name first so a reader never sees half a file
+  sprintf(temp, "%s.tmp", file);
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd >= 0) {
+    if(write(fd, data, WAVEFORM_FILE_SIZE) == WAVEFORM_FILE_SIZE) {rename(temp, file);}
+    else {unlink(temp);}
+    close(fd);
+  }
+
+  free(temp);
+  return;
+}
+
+
+
+// Decodes the whole file with a source of its own, never the one being played
+static bool compute_overview(const char *path, int8_t *peaks) {
+  AUDIO_SOURCE *song = new_audio_source(path);
+  uint8_t *buf;
+  int buf_size;
+  size_t i, b;
+
+  if(song == NULL) {return false;}
+  if(prep_audio_source_rate(song, 0) < 0) {
+    free_audio_source(song);
+    return false;
+  }
+
+  unsigned int channels = song->track_data.channels;
+  unsigned int block_capacity = 256;
+  unsigned int block_count = 0;
+  float *block_min = malloc(block_capacity * sizeof(float));
+  float *block_max = malloc(block_capacity * sizeof(float));
+  unsigned int frames_in_block = 0;
+  float low = 0, high = 0;
+
+  while((buf = decode_chunk(song, &buf_size))) {
+    float *pcm = (float *)buf;
+    unsigned int frames = buf_size / (channels * sizeof(float));
+
+    for(i = 0; i < frames * channels; i++) {
+      if(pcm[i] < low) {low = pcm[i];}
+      if(pcm[i] > high) {high = pcm[i];}
+
+      if(i % channels == channels - 1 && ++frames_in_block == WAVEFORM_BLOCK_FRAMES) {
+        if(block_count == block_capacity) {
+          block_capacity *= 2;
+          block_min = realloc(block_min, block_capacity * sizeof(float));
+          block_max = realloc(block_max, block_capacity * sizeof(float));
+        }
+        block_min[block_count] = low;
+        block_max[block_count] = high;
+        block_count++;
+        frames_in_block = 0;
+        low = high = 0;
+      }
+    }
+
+    mem_free(buf);
+  }
+
+  if(frames_in_block > 0) {
+    if(block_count == block_capacity) {
+      block_capacity++;
+      block_min = realloc(block_min, block_capacity * sizeof(float));
+      block_max = realloc(block_max, block_capacity * sizeof(float));
+    }
+    block_min[block_count] = low;
+    block_max[block_count] = high;
+    block_count++;
+  }
+
+  free_audio_source(song);
+
+  if(block_count == 0) {
+    free(block_min);
+    free(block_max);
+    return false;
+  }
+
+  for(b = 0; b < WAVEFORM_BINS; b++) {
+    unsigned int first = (uint64_t)b * block_count / WAVEFORM_BINS;
+    unsigned int last = (uint64_t)(b + 1) * block_count / WAVEFORM_BINS;
+    if(last <= first) {last = first + 1;}
+
+    low = high = 0;
+    for(i = first; i < last; i++) {
+      if(block_min[i] < low) {low = block_min[i];}
+      if(block_max[i] > high) {high = block_max[i];}
+    }
+
+    if(low < -1) {low = -1;}
+    if(high > 1) {high = 1;}
+    peaks[b * 2] = low * 127;
+    peaks[b * 2 + 1] = high * 127;
+  }
+
+  free(block_min);
+  free(block_max);
+  return true;
+}
+
+
+
+static void *waveform_worker(void *arg) {
+  int8_t peaks[WAVEFORM_BINS * 2];
+  char *path;
+
+  (void)arg;
+
+  // Overviews are nice to have, decoding for playback is not
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+  pthread_mutex_lock(&waveform_lock);
+  while(!stop_workers) {
+    if(job_count == 0) {
+      pthread_cond_wait(&waveform_cond, &waveform_lock);
+      continue;
+    }
+
+    path = jobs[job_head];
+    job_head = (job_head + 1) % WAVEFORM_JOB_SLOTS;
+    job_count--;
+    pthread_mutex_unlock(&waveform_lock);
+
+    char *file = cache_file(path);
+    bool ok = file && load_cached(file, peaks);
+
+    if(!ok && (ok = compute_overview(path, peaks)) && file) {
+      store_cached(file, peaks);
+    }
+    free(file);
+
+    pthread_mutex_lock(&waveform_lock);
+    // Only once: a slot trimmed and requested again can have a second job for the same file queued
+    struct overview *entry = find_overview(path);
+    if(entry && entry->state == STATE_PENDING) {
+      if(ok && (entry->peaks = mem_alloc(MEM_CACHE, sizeof(peaks)))) {memcpy(entry->peaks, peaks, sizeof(peaks));}
+      entry->state = entry->peaks ? STATE_READY : STATE_FAILED;
+    }
+    free(path);
+  }
+  pthread_mutex_unlock(&waveform_lock);
+
+  return NULL;
+}
+
+
+
+void waveform_init(void) {
+  size_t i;
+
+  cache_dir = cache_path("peaks");
+  if(cache_dir) {mkdir(cache_dir, 0755);}
+
+  // Leave at least one core to the playback thread and the UI
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int wanted = cores > 2 ? cores / 2 : 1;
+
+  stop_workers = false;
+  workers = malloc(wanted * sizeof(pthread_t));
+  for(i = 0; i < wanted; i++) {
+    if(pthread_create(&workers[worker_count], NULL, waveform_worker, NULL) == 0) {worker_count++;}
+  }
+
+  return;
+}
+
+
+void waveform_cleanup(void) {
+  size_t i;
+
+  pthread_mutex_lock(&waveform_lock);
+  stop_workers = true;
+  pthread_cond_broadcast(&waveform_cond);
+  pthread_mutex_unlock(&waveform_lock);
+
+  for(i = 0; i < worker_count; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  workers = NULL;
+  worker_count = 0;
+
+  while(job_count > 0) {
+    free(jobs[job_head]);
+    job_head = (job_head + 1) % WAVEFORM_JOB_SLOTS;
+    job_count--;
+  }
+
+  for(i = 0; i < WAVEFORM_SLOTS; i++) {clear_overview(&overviews[i]);}
+
+  free(current_path);
+  current_path = NULL;
+  free(cache_dir);
+  cache_dir = NULL;
+
+  return;
+}
+
+
+
+// Makes sure an overview of path is on its way. Cheap enough to call from the playback thread,
+// the cache lookup and any decoding happen on the workers
+void waveform_request(const char *path) {
+  struct overview *slot = NULL;
+  int i;
+
+  if(worker_count == 0) {return;}
+
+  char *full_path = absolute_path(path);
+  pthread_mutex_lock(&waveform_lock);
+
+  // Over the memory budget, only the playing track's overview is worth decoding a whole file for
+  if(mem_over_budget() && (current_path == NULL || strcmp(full_path, current_path) != 0)) {
+    pthread_mutex_unlock(&waveform_lock);
+    free(full_path);
+    return;
+  }
+
+  if((slot = find_overview(full_path))) {
+    slot->stamp = ++stamp_counter;
+    pthread_mutex_unlock(&waveform_lock);
+    free(full_path);
+    return;
+  }
+
+  // Reuse the least recently requested slot that isn't the current track's
+  for(i = 0; i < WAVEFORM_SLOTS; i++) {
+    struct overview *candidate = &overviews[i];
+    if(candidate->path && current_path && strcmp(candidate->path, current_path) == 0) {continue;}
+    if(slot == NULL || candidate->stamp < slot->stamp) {slot = candidate;}
+  }
+
+  if(slot == NULL || job_count == WAVEFORM_JOB_SLOTS) {
+    pthread_mutex_unlock(&waveform_lock);
+    free(full_path);
+    return;
+  }
+
+  clear_overview(slot);
+  slot->path = strdup(full_path);
+  slot->state = STATE_PENDING;
+  slot->stamp = ++stamp_counter;
+
+  jobs[(job_head + job_count) % WAVEFORM_JOB_SLOTS] = full_path;
+  job_count++;
+
+  pthread_cond_signal(&waveform_cond);
+  pthread_mutex_unlock(&waveform_lock);
+
+  return;
+}
+
+
+// Release hook for the memory budget. Overviews of anything but the playing track are dropped,
+// they come back from the disk cache when requested again
+void waveform_trim(void) {
+  int i;
+
+  pthread_mutex_lock(&waveform_lock);
+  for(i = 0; i < WAVEFORM_SLOTS; i++) {
+    if(overviews[i].path && current_path && strcmp(overviews[i].path, current_path) == 0) {continue;}
+    clear_overview(&overviews[i]);
+  }
+  pthread_mutex_unlock(&waveform_lock);
+
+  return;
+}
+
+
+void waveform_set_current(const char *path) {
+  pthread_mutex_lock(&waveform_lock);
+  free(current_path);
+  current_path = path ? absolute_path(path) : NULL;
+  pthread_mutex_unlock(&waveform_lock);
+
+  if(path) {waveform_request(path);}
+  return;
+}
+
+
+// Squeezes the current track's overview into width columns of 0 to WAVEFORM_LEVELS.
+// Returns 0 if there is no overview to show (yet)
+int waveform_render(int width, uint8_t *levels) {
+  int column, i;
+
+  pthread_mutex_lock(&waveform_lock);
+
+  struct overview *entry = current_path ? find_overview(current_path) : NULL;
+  if(entry == NULL || entry->state != STATE_READY || width <= 0) {
+    pthread_mutex_unlock(&waveform_lock);
+    return 0;
+  }
+
+  for(column = 0; column < width; column++) {
+    int first = column * WAVEFORM_BINS / width;
+    int last = (column + 1) * WAVEFORM_BINS / width;
+    int peak = 0;
+    if(last <= first) {last = first + 1;}
+
+    for(i = first * 2; i < last * 2; i++) {
+      int value = entry->peaks[i] < 0 ? -entry->peaks[i] : entry->peaks[i];
+      if(value > peak) {peak = value;}
+    }
+
+    levels[column] = (peak * WAVEFORM_LEVELS + 126) / 127;
+  }
+
+  pthread_mutex_unlock(&waveform_lock);
+  return 1;
+}